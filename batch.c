@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "code.h"
+#include "dict.h"
+#include "run.h"
+
+// Most bytes a stream of a message of len symbols can take: every pair adds at least one symbol, and
+// takes at most 24 bits, then come the pair of the last phrase and STOP_CODE.
+static inline size_t stream_bound(const BatchEncoder *b, size_t len) {
+    return b->head_len + 3 * len + 3 + 3 + 1;
+}
+
+BatchEncoder *batch_encoder_create(const EncodeOptions *opts, uint16_t protection) {
+    if (opts->mem_limit || opts->flush_ms || opts->flush_bytes || opts->check || opts->flexible
+        || opts->verify != NULL || opts->dedup || opts->checkpoint != NULL || opts->lanes
+        || opts->filter || opts->resets != NULL) {
+        return NULL;
+    }
+    BatchEncoder *b = (BatchEncoder *) malloc(sizeof(BatchEncoder));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->chains = chain_trie_create();
+    if (b->chains == NULL) {
+        free(b);
+        return NULL;
+    }
+    b->dict = opts->dict;
+    b->runs = opts->runs;
+    b->first_code = START_CODE;
+    if (b->dict != NULL) {
+        dict_load_chains(b->dict, b->chains);
+        b->first_code = dict_next_code(b->dict);
+    }
+    chain_trie_save(b->chains);
+
+    // The header is the same for every stream: little-endian, as write_header writes it.
+    uint16_t flags = encode_flags(opts);
+    uint32_t magic = flags ? MAGIC_EXT : MAGIC;
+    uint32_t fields[] = { magic, protection, flags, b->dict != NULL ? b->dict->id : 0 };
+    int sizes[] = { 4, 2, 2, b->dict != NULL ? 4 : 0 };
+    b->head_len = 0;
+    for (int f = 0; f < 4; f++) {
+        for (int k = 0; k < sizes[f]; k++) {
+            b->head[b->head_len++] = (uint8_t) (fields[f] >> 8 * k);
+        }
+    }
+    b->arena = NULL;
+    b->cap = 0;
+    return b;
+}
+
+void batch_encoder_delete(BatchEncoder *b) {
+    if (b == NULL) {
+        return;
+    }
+    chain_trie_delete(b->chains);
+    free(b->arena);
+    free(b);
+}
+
+// Walks the trie over the len symbols of syms, packing the pairs of the stream into pk, then takes
+// the trie back to where it started. The pairs are the ones encode_stream writes for the same input,
+// but that a run is looked for at the start of every phrase.
+static void batch_walk(BatchEncoder *b, BitPacker *pk, const uint8_t *syms, size_t len) {
+    ChainTrie *t = b->chains;
+    uint32_t chain = 0;
+    uint32_t depth = 0;
+    uint16_t next_code = b->first_code;
+    int bitlen = bit_len(next_code);
+    size_t i = 0;
+    while (i < len) {
+        if (chain == 0 && b->runs && len - i >= RUN_MIN && run_length(syms + i, RUN_MIN) == RUN_MIN) {
+            uint32_t count = run_length(syms + i, len - i > UINT32_MAX ? UINT32_MAX : (uint32_t) (len - i));
+            bp_pair(pk, STOP_CODE, CTRL_RUN, bitlen);
+            bp_bits(pk, syms[i], 8);
+            bp_bits(pk, count, 32);
+            i += count;
+            continue;
+        }
+        Chain *ch = &t->chains[chain];
+        uint32_t below = ch->len - 1 - depth;
+        if (below > 0) {
+            uint32_t span = len - i < below ? (uint32_t) (len - i) : below;
+            uint32_t same = common_prefix(syms + i, ch->syms + depth + 1, span);
+            i += same;
+            depth += same;
+            if (same == span) {
+                continue;
+            }
+        } else if (ch->forks) {
+            uint32_t next = chain_trie_child(t, ch->codes[depth], syms[i]);
+            if (next != 0) {
+                chain = next;
+                depth = 0;
+                i += 1;
+                continue;
+            }
+        }
+        uint8_t sym = syms[i];
+        i += 1;
+        bp_pair(pk, ch->codes[depth], sym, bitlen);
+        chain_trie_add(t, chain, depth, sym, next_code);
+        chain = 0;
+        depth = 0;
+        next_code += 1;
+        if (next_code == MAX_CODE) {
+            chain_trie_restore(t);
+            next_code = b->first_code;
+        }
+        bitlen = bit_len(next_code);
+    }
+
+    // The phrase still being matched and STOP_CODE, as encode_stream ends.
+    if (chain != 0) {
+        uint16_t code = 0;
+        uint8_t sym = 0;
+        chain_trie_pair(t, chain, depth, &code, &sym);
+        bp_pair(pk, code, sym, bitlen);
+        next_code += 1;
+        if (next_code == MAX_CODE) {
+            next_code = b->first_code;
+        }
+        bitlen = bit_len(next_code);
+    }
+    bp_pair(pk, STOP_CODE, 0, bitlen);
+    if (pk->nbits > 0) {
+        *pk->out++ = (uint8_t) pk->acc;
+    }
+    chain_trie_restore(t);
+}
+
+bool batch_encode(BatchEncoder *b, const Message *in, Message *out, size_t count) {
+    // Room for every stream at its longest, so that the arena never moves while it's written.
+    size_t need = 0;
+    for (size_t m = 0; m < count; m++) {
+        need += stream_bound(b, in[m].len);
+    }
+    if (need > b->cap) {
+        uint8_t *arena = (uint8_t *) realloc(b->arena, need);
+        if (arena == NULL) {
+            return false;
+        }
+        b->arena = arena;
+        b->cap = need;
+    }
+
+    uint8_t *at = b->arena;
+    for (size_t m = 0; m < count; m++) {
+        memcpy(at, b->head, b->head_len);
+        BitPacker pk = { .out = at + b->head_len, .acc = 0, .nbits = 0 };
+        batch_walk(b, &pk, in[m].data, in[m].len);
+        out[m].data = at;
+        out[m].len = (size_t) (pk.out - at);
+        at = pk.out;
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chain.h"
+#include "encoder.h"
+#include "io.h"
+
+// a buffer in memory: a message, or the stream it was compressed to
+typedef struct Message {
+    const uint8_t *data;
+    size_t len;
+} Message;
+
+//
+// Compresses many small messages held in memory, each to a stream of its own that decode reads like
+// any other. The trie, with the dictionary loaded, is kept between messages and taken back to that
+// state after each one, and every stream of a batch is written into one arena, so that a message
+// costs no setup and no allocations of its own.
+//
+typedef struct BatchEncoder {
+    ChainTrie *chains;
+    const Dict *dict;
+    bool runs;
+    uint16_t first_code; // Where next_code starts for every message.
+    uint8_t head[sizeof(FileHeader) + sizeof(uint32_t)]; // The header every stream starts with...
+    size_t head_len; // ...and its length.
+    uint8_t *arena; // The streams of the last batch, one after the other.
+    size_t cap;
+} BatchEncoder;
+
+/*
+ * Constructor: Creates a batch encoder writing streams encoded with opts, with protection in their
+ * headers
+ * Only the dict and runs options are supported: returns NULL if any other is set, or if it can't be
+ * allocated
+ */
+BatchEncoder *batch_encoder_create(const EncodeOptions *opts, uint16_t protection);
+
+/*
+ * Destructor: Frees b and its arena
+ */
+void batch_encoder_delete(BatchEncoder *b);
+
+/*
+ * Compresses the count messages of in, setting out[i] to the stream of in[i]
+ * The streams are held by b until the next call. Returns false if the arena can't grow to hold them
+ */
+bool batch_encode(BatchEncoder *b, const Message *in, Message *out, size_t count);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain.h"
+#include "code.h"
+
+#define CHAIN_KEEP 4096 // Chains with room for more nodes than this give it back on a reset.
+
+// Returns the slot of key in the child table, or the empty slot it would go in.
+static inline uint32_t child_slot(const uint64_t *children, uint32_t key) {
+    uint32_t i = child_home(key);
+    while (children[i] != 0 && (uint32_t) (children[i] >> 32) != key) {
+        i = (i + 1) & (CHILD_SLOTS - 1);
+    }
+    return i;
+}
+
+// Makes room in ch for at least n nodes. Returns false, leaving ch as it was, if it can't be allocated.
+static bool chain_grow(Chain *ch, uint32_t n) {
+    if (n <= ch->cap) {
+        return true;
+    }
+    uint32_t cap = ch->cap ? 2 * ch->cap : 16;
+    while (cap < n) {
+        cap *= 2;
+    }
+    // codes and syms share one allocation, codes first so that they stay aligned
+    uint16_t *codes = (uint16_t *) malloc(cap * (sizeof(uint16_t) + 1));
+    if (codes == NULL) {
+        return false;
+    }
+    if (ch->len > 0) {
+        memcpy(codes, ch->codes, ch->len * sizeof(uint16_t));
+        memcpy(codes + cap, ch->syms, ch->len);
+    }
+    free(ch->codes);
+    ch->codes = codes;
+    ch->syms = (uint8_t *) (codes + cap);
+    ch->cap = cap;
+    return true;
+}
+
+// Appends the node sym, with code, to the end of chain c, which must have room for it.
+static void chain_push(ChainTrie *t, uint32_t c, uint8_t sym, uint16_t code) {
+    Chain *ch = &t->chains[c];
+    ch->syms[ch->len] = sym;
+    ch->codes[ch->len] = code;
+    t->chain_of[code] = c;
+    t->index_of[code] = (uint16_t) ch->len;
+    ch->len += 1;
+}
+
+ChainTrie *chain_trie_create(void) {
+    ChainTrie *t = (ChainTrie *) malloc(sizeof(ChainTrie));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->chains = (Chain *) calloc(MAX_CODE + 1, sizeof(Chain));
+    t->children = (uint64_t *) calloc(CHILD_SLOTS, sizeof(uint64_t));
+    t->chain_of = (uint32_t *) malloc((MAX_CODE + 1) * sizeof(uint32_t));
+    t->index_of = (uint16_t *) malloc((MAX_CODE + 1) * sizeof(uint16_t));
+    if (t->chains == NULL || t->children == NULL || t->chain_of == NULL || t->index_of == NULL) {
+        free(t->chains);
+        free(t->children);
+        free(t->chain_of);
+        free(t->index_of);
+        free(t);
+        return NULL;
+    }
+    t->count = 0;
+    t->undo = NULL;
+    t->undo_len = 0;
+    // The root keeps its room on a reset, so that a reset can't run out of memory.
+    if (!chain_grow(&t->chains[0], 1)) {
+        chain_trie_delete(t);
+        return NULL;
+    }
+    chain_trie_reset(t);
+    return t;
+}
+
+void chain_trie_delete(ChainTrie *t) {
+    if (t == NULL) {
+        return;
+    }
+    for (uint32_t c = 0; c <= MAX_CODE; c++) {
+        free(t->chains[c].codes);
+    }
+    free(t->chains);
+    free(t->children);
+    free(t->chain_of);
+    free(t->index_of);
+    free(t->undo);
+    free(t);
+}
+
+// Starts a new chain of the one node sym, with code, as a child of the node with code parent.
+static uint32_t chain_start(ChainTrie *t, uint16_t parent, uint8_t sym, uint16_t code) {
+    uint32_t c = t->count;
+    t->count += 1;
+    Chain *ch = &t->chains[c];
+    ch->len = 0;
+    ch->parent = parent;
+    ch->forks = false;
+    ch->saved = false;
+    uint32_t key = child_key(parent, sym);
+    ch->slot = child_slot(t->children, key);
+    t->children[ch->slot] = (uint64_t) key << 32 | c;
+    chain_push(t, c, sym, code);
+    return c;
+}
+
+void chain_trie_reset(ChainTrie *t) {
+    // Only the slots of the chains in use can be full: each chain but the root has one.
+    for (uint32_t c = 1; c < t->count; c++) {
+        Chain *ch = &t->chains[c];
+        t->children[ch->slot] = 0;
+        if (ch->cap > CHAIN_KEEP) {
+            free(ch->codes);
+            ch->codes = NULL;
+            ch->syms = NULL;
+            ch->cap = 0;
+        }
+        ch->len = 0;
+        ch->saved = false;
+    }
+    t->count = 1;
+    t->base = 0;
+    t->undo_len = 0;
+    Chain *root = &t->chains[0];
+    root->len = 0;
+    root->parent = EMPTY_CODE;
+    root->forks = true;
+    chain_push(t, 0, 0, EMPTY_CODE);
+}
+
+uint32_t chain_trie_child(const ChainTrie *t, uint16_t code, uint8_t sym) {
+    return (uint32_t) t->children[child_slot(t->children, child_key(code, sym))];
+}
+
+void chain_trie_save(ChainTrie *t) {
+    if (t->undo == NULL) {
+        t->undo = (ChainUndo *) malloc((MAX_CODE + 1) * sizeof(ChainUndo));
+    }
+    for (uint32_t k = 0; k < t->undo_len; k++) {
+        t->chains[t->undo[k].chain].saved = false;
+    }
+    t->undo_len = 0;
+    t->base = t->count;
+}
+
+void chain_trie_restore(ChainTrie *t) {
+    for (uint32_t c = t->base; c < t->count; c++) {
+        t->children[t->chains[c].slot] = 0;
+        t->chains[c].len = 0;
+    }
+    t->count = t->base;
+    // A chain only ever loses nodes off its end to a split, which leaves them in place, or gains
+    // them there, so putting its len back restores it. Its nodes may have moved to other chains.
+    for (uint32_t k = 0; k < t->undo_len; k++) {
+        uint32_t c = t->undo[k].chain;
+        Chain *ch = &t->chains[c];
+        ch->len = t->undo[k].len;
+        ch->forks = t->undo[k].forks;
+        ch->saved = false;
+        for (uint32_t j = 0; j < ch->len; j++) {
+            t->chain_of[ch->codes[j]] = c;
+            t->index_of[ch->codes[j]] = (uint16_t) j;
+        }
+    }
+    t->undo_len = 0;
+}
+
+bool chain_trie_add(ChainTrie *t, uint32_t c, uint32_t j, uint8_t sym, uint16_t code) {
+    Chain *ch = &t->chains[c];
+    // Room is made in every chain the node goes in before any of them changes.
+    bool split = j + 1 < ch->len;
+    if (j + 1 == ch->len && !ch->forks) {
+        if (!chain_grow(ch, ch->len + 1)) {
+            return false;
+        }
+    } else if (!chain_grow(&t->chains[t->count], split ? ch->len - j - 1 : 1)
+               || (split && !chain_grow(&t->chains[t->count + 1], 1))) {
+        return false;
+    }
+    if (c < t->base && !ch->saved) {
+        t->undo[t->undo_len] = (ChainUndo) { .chain = c, .len = ch->len, .forks = ch->forks };
+        t->undo_len += 1;
+        ch->saved = true;
+    }
+    if (j + 1 == ch->len && !ch->forks) {
+        chain_push(t, c, sym, code);
+        return true;
+    }
+    if (split) {
+        // The nodes after j move to a chain of their own, which takes over their children.
+        uint32_t tail = chain_start(t, ch->codes[j], ch->syms[j + 1], ch->codes[j + 1]);
+        for (uint32_t k = j + 2; k < ch->len; k++) {
+            chain_push(t, tail, ch->syms[k], ch->codes[k]);
+        }
+        t->chains[tail].forks = ch->forks;
+        ch->len = j + 1;
+        ch->forks = true;
+    }
+    chain_start(t, ch->codes[j], sym, code);
+    return true;
+}
+
+bool chain_trie_insert(ChainTrie *t, uint16_t parent, uint8_t sym, uint16_t code) {
+    return chain_trie_add(t, t->chain_of[parent], t->index_of[parent], sym, code);
+}
+
+void chain_trie_pair(const ChainTrie *t, uint32_t c, uint32_t j, uint16_t *code, uint8_t *sym) {
+    const Chain *ch = &t->chains[c];
+    *code = j > 0 ? ch->codes[j - 1] : ch->parent;
+    *sym = ch->syms[j];
+}
@@ -0,0 +1,117 @@
+#ifndef __CHAIN_H__
+#define __CHAIN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHILD_BITS 17 // The child table holds at most MAX_CODE chains, so it stays under half full.
+#define CHILD_SLOTS (1 << CHILD_BITS)
+
+//
+// A trie stored as chains: runs of nodes in which each node is the only child of the one before it.
+// A chain keeps the symbols of its nodes in order, the way they came in, so that a walk down it is a
+// comparison of the input against those symbols rather than one lookup per symbol. Only the children
+// of the last node of a chain, the branch points, are kept in a table, by the code of their parent.
+//
+// Chain 0 is the root, a chain of the one node with EMPTY_CODE whose children always start chains of
+// their own. A position in the trie is a chain and the index of a node in it.
+//
+typedef struct Chain {
+    uint8_t *syms; // syms[j] is the symbol node j adds to the phrase of the node before it.
+    uint16_t *codes; // codes[j] is the code of node j.
+    uint32_t len;
+    uint32_t cap;
+    uint16_t parent; // The code of the node the chain hangs off.
+    uint32_t slot; // Where the chain is in the child table.
+    bool forks; // The last node has children, in the child table.
+    bool saved; // Its len and forks are in the undo log.
+} Chain;
+
+// how a chain was when chain_trie_save was called, before it changed
+typedef struct ChainUndo {
+    uint32_t chain;
+    uint32_t len;
+    bool forks;
+} ChainUndo;
+
+typedef struct ChainTrie {
+    Chain *chains; // Room for one chain for each code.
+    uint32_t count;
+    uint64_t *children; // Open-addressed: (code << 8 | sym) + 1 in the top half, the chain below. 0 is empty.
+    uint32_t *chain_of; // chain_of[code] is the chain of the node with that code...
+    uint16_t *index_of; // ...and index_of[code] its index in the chain.
+    uint32_t base; // count at the last chain_trie_save. Chains before it are logged before they change.
+    ChainUndo *undo; // NULL until the first chain_trie_save.
+    uint32_t undo_len;
+} ChainTrie;
+
+static inline uint32_t child_key(uint16_t code, uint8_t sym) {
+    return ((uint32_t) code << 8 | sym) + 1;
+}
+
+// Returns the slot of the child table that the search for key starts at.
+static inline uint32_t child_home(uint32_t key) {
+    return (key * 0x9E3779B1u) >> (32 - CHILD_BITS);
+}
+
+//
+// Starts loading the slot of the child table that chain_trie_child(t, code, sym) looks at first, so
+// that the lookup doesn't have to wait on memory if it comes a little later.
+//
+static inline void chain_trie_prefetch(const ChainTrie *t, uint16_t code, uint8_t sym) {
+    __builtin_prefetch(&t->children[child_home(child_key(code, sym))]);
+}
+
+/*
+ * Constructor: Creates a trie of just the root
+ * Returns NULL if it can't be allocated
+ */
+ChainTrie *chain_trie_create(void);
+
+/*
+ * Destructor: Frees t and all of its chains
+ */
+void chain_trie_delete(ChainTrie *t);
+
+/*
+ * Resets t to just the root: called whenever the trie is reset
+ */
+void chain_trie_reset(ChainTrie *t);
+
+/*
+ * Saves the trie as it is now, for chain_trie_restore to go back to
+ */
+void chain_trie_save(ChainTrie *t);
+
+/*
+ * Takes the trie back to how it was at the last chain_trie_save, in time proportional to the chains
+ * added or changed since rather than to the size of the trie
+ */
+void chain_trie_restore(ChainTrie *t);
+
+/*
+ * Returns the chain starting with the child sym of the node with code, which must be the last node of
+ * its chain, or 0 if it has no such child
+ */
+uint32_t chain_trie_child(const ChainTrie *t, uint16_t code, uint8_t sym);
+
+/*
+ * Adds the child sym, with code, to node j of chain c, which must not have that child yet
+ * A node in the middle of a chain splits it, the nodes after it moving to a chain of their own
+ * Returns false, leaving t as it was, if memory runs out: the trie then just doesn't learn the word
+ */
+bool chain_trie_add(ChainTrie *t, uint32_t c, uint32_t j, uint8_t sym, uint16_t code);
+
+/*
+ * Adds the child sym, with code, to the node with code parent
+ * Returns false, leaving t as it was, if memory runs out
+ */
+bool chain_trie_insert(ChainTrie *t, uint16_t parent, uint8_t sym, uint16_t code);
+
+/*
+ * Sets *code and *sym to the pair of node j of chain c: the code of its parent and its symbol
+ */
+void chain_trie_pair(const ChainTrie *t, uint32_t c, uint32_t j, uint16_t *code, uint8_t *sym);
+
+#endif
@@ -0,0 +1,193 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "code.h"
+#include "endian.h"
+#include "io.h"
+
+// reads the little-endian 16-bit number at p
+static uint16_t load16(const uint8_t *p) {
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+// writes value as a little-endian 16-bit number at p
+static void store16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t) value;
+    p[1] = (uint8_t) (value >> 8);
+}
+
+// swaps the byte order of the fields of h, which are little-endian in the file
+static void swap_header(CheckpointHeader *h) {
+    h->magic = swap32(h->magic);
+    h->flags = swap16(h->flags);
+    h->next_code = swap16(h->next_code);
+    h->stop_bit = swap64(h->stop_bit);
+    h->mem_limit = swap64(h->mem_limit);
+    h->count = swap32(h->count);
+    h->crc = swap32(h->crc);
+}
+
+/*
+ * Constructor: Creates an empty checkpoint, with no stream to carry on
+ */
+Checkpoint *checkpoint_create(void) {
+    Checkpoint *cp = (Checkpoint *) calloc(1, sizeof(Checkpoint));
+    if (cp == NULL) {
+        return NULL;
+    }
+    cp->entries = (uint8_t *) malloc((size_t) MAX_CODE * CHECKPOINT_ENTRY);
+    if (cp->entries == NULL) {
+        free(cp);
+        return NULL;
+    }
+    cp->header.magic = CHECKPOINT_MAGIC;
+    return cp;
+}
+
+/*
+ * Destructor: Frees cp
+ */
+void checkpoint_delete(Checkpoint *cp) {
+    if (cp == NULL) {
+        return;
+    }
+    free(cp->entries);
+    free(cp);
+}
+
+/*
+ * Reads the checkpoint file at path into cp
+ * Checks its header and that every parent comes before its child
+ * Returns false if it can't be read or isn't a valid checkpoint
+ */
+bool checkpoint_read(Checkpoint *cp, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    CheckpointHeader *h = &cp->header;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && read_bytes(fd, (uint8_t *) h, sizeof(*h)) == sizeof(*h);
+    if (big_endian()) {
+        swap_header(h);
+    }
+    valid = valid && h->magic == CHECKPOINT_MAGIC && h->count < MAX_CODE
+                 && (size_t) st.st_size == sizeof(*h) + (size_t) h->count * CHECKPOINT_ENTRY
+                 && read_bytes(fd, cp->entries, h->count * CHECKPOINT_ENTRY) == (int) h->count * CHECKPOINT_ENTRY;
+    close(fd);
+
+    // The state must be one the encoder can be in, and every entry must extend an earlier one with a
+    // symbol none of the others add to it.
+    valid = valid && h->next_code >= START_CODE && h->next_code < MAX_CODE && h->tail >> h->stop_bit % 8 == 0;
+    uint8_t *seen = (uint8_t *) calloc(MAX_CODE, 1);
+    // bit (parent << 8 | sym) set once an entry adds sym to parent
+    uint8_t *added = (uint8_t *) calloc(MAX_CODE * ALPHABET / 8, 1);
+    seen[EMPTY_CODE] = 1;
+    for (uint32_t i = 0; valid && i < h->count; i++) {
+        uint16_t code = load16(cp->entries + i * CHECKPOINT_ENTRY);
+        uint16_t parent = load16(cp->entries + i * CHECKPOINT_ENTRY + 2);
+        uint32_t word = (uint32_t) parent << 8 | cp->entries[i * CHECKPOINT_ENTRY + 4];
+        valid = code >= START_CODE && code < h->next_code && !seen[code] && seen[parent]
+                && !(added[word >> 3] & (1 << (word & 7)));
+        seen[code] = 1;
+        added[word >> 3] |= 1 << (word & 7);
+    }
+    free(added);
+    free(seen);
+    if (!valid) {
+        h->next_code = 0;
+    }
+    return valid;
+}
+
+/*
+ * Writes cp to the checkpoint file at path, replacing it all at once
+ * Returns false if it can't be written
+ */
+bool checkpoint_write(const Checkpoint *cp, const char *path) {
+    char temp[4096];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int) sizeof(temp)) {
+        return false;
+    }
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    int size = cp->header.count * CHECKPOINT_ENTRY;
+    CheckpointHeader header = cp->header;
+    if (big_endian()) {
+        swap_header(&header);
+    }
+    bool ok = write_bytes(fd, (uint8_t *) &header, sizeof(header)) == sizeof(header)
+              && write_bytes(fd, cp->entries, size) == size && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) {
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Records every node below root in cp
+ */
+void checkpoint_save_trie(Checkpoint *cp, TrieNode *root) {
+    // Walk the trie breadth first, so that parents come before their children.
+    TrieNode **queue = (TrieNode **) malloc((size_t) MAX_CODE * sizeof(TrieNode *));
+    uint32_t head = 0;
+    uint32_t len = 1;
+    queue[0] = root;
+    cp->header.count = 0;
+    while (head < len) {
+        TrieNode *node = queue[head];
+        head += 1;
+        for (int sym = 0; sym < ALPHABET; sym++) {
+            TrieNode *child = node->children[sym];
+            if (child != NULL) {
+                uint8_t *e = cp->entries + (size_t) cp->header.count * CHECKPOINT_ENTRY;
+                store16(e, child->code);
+                store16(e + 2, node->code);
+                e[4] = (uint8_t) sym;
+                e[5] = 0;
+                cp->header.count += 1;
+                queue[len] = child;
+                len += 1;
+            }
+        }
+    }
+    free(queue);
+}
+
+/*
+ * Adds every node recorded in cp below root, which must have no children yet
+ * The nodes two levels below root are also recorded in jump
+ */
+void checkpoint_load_trie(const Checkpoint *cp, TrieNode *root, TrieJump *jump) {
+    // nodes[code] is the node with that code, and first[code] its symbol if it is a child of root
+    TrieNode **nodes = (TrieNode **) malloc((size_t) MAX_CODE * sizeof(TrieNode *));
+    int16_t *first = (int16_t *) malloc((size_t) MAX_CODE * sizeof(int16_t));
+    nodes[EMPTY_CODE] = root;
+    first[EMPTY_CODE] = -1;
+    for (uint32_t i = 0; i < cp->header.count; i++) {
+        const uint8_t *e = cp->entries + (size_t) i * CHECKPOINT_ENTRY;
+        uint16_t code = load16(e);
+        uint16_t parent = load16(e + 2);
+        uint8_t sym = e[4];
+        TrieNode *node = trie_node_create(code);
+        nodes[parent]->children[sym] = node;
+        nodes[code] = node;
+        first[code] = parent == EMPTY_CODE ? sym : -1;
+        if (first[parent] >= 0) {
+            jump[first[parent] << 8 | sym] = node;
+        }
+    }
+    free(first);
+    free(nodes);
+}
@@ -0,0 +1,75 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "trie.h"
+
+#define CHECKPOINT_MAGIC 0xBAADC4EC // Magic number of encoder checkpoint files.
+
+//
+// A checkpoint file is a CheckpointHeader followed by count entries of 6 bytes, all little-endian.
+// It holds the encoder's state right before the STOP_CODE ending a stream, so that encode --append
+// can carry on the same stream. Each entry is a node of the trie: its code, the code of its parent,
+// and its symbol. Parents always come before their children, so the entries can be loaded in order.
+//
+// +-------+-------+-----------+----------+-----------+-------+-----+------+----------+------+--------+-----+----------+----
+// | magic | flags | next_code | stop_bit | mem_limit | count | crc | tail | reserved | code | parent | sym | reserved | ...
+// +-------+-------+-----------+----------+-----------+-------+-----+------+----------+------+--------+-----+----------+----
+//    32      16        16          64         64         32     32     8       56        16      16      8       8
+//
+typedef struct CheckpointHeader {
+    uint32_t magic;
+    uint16_t flags; // Of the stream's file header.
+    uint16_t next_code;
+    uint64_t stop_bit; // Where STOP_CODE starts, in bits from the start of the file.
+    uint64_t mem_limit; // Of the encoder, if the stream has FLAG_RESETS.
+    uint32_t count;
+    uint32_t crc; // With FLAG_CHECK, of the bytes after the last CTRL_CHECK block, up to the byte STOP_CODE starts in.
+    uint8_t tail; // The bits before STOP_CODE in the byte it starts in.
+    uint8_t reserved[7];
+} CheckpointHeader;
+
+#define CHECKPOINT_ENTRY 6 // Bytes per entry.
+
+typedef struct Checkpoint {
+    CheckpointHeader header; // next_code is 0 until there is a stream to carry on.
+    uint8_t *entries; // Room for a whole trie.
+} Checkpoint;
+
+/*
+ * Constructor: Creates an empty checkpoint, with no stream to carry on
+ */
+Checkpoint *checkpoint_create(void);
+
+/*
+ * Destructor: Frees cp
+ */
+void checkpoint_delete(Checkpoint *cp);
+
+/*
+ * Reads the checkpoint file at path into cp
+ * Checks its header and that every parent comes before its child
+ * Returns false if it can't be read or isn't a valid checkpoint
+ */
+bool checkpoint_read(Checkpoint *cp, const char *path);
+
+/*
+ * Writes cp to the checkpoint file at path, replacing it all at once
+ * Returns false if it can't be written
+ */
+bool checkpoint_write(const Checkpoint *cp, const char *path);
+
+/*
+ * Records every node below root in cp
+ */
+void checkpoint_save_trie(Checkpoint *cp, TrieNode *root);
+
+/*
+ * Adds every node recorded in cp below root, which must have no children yet
+ * The nodes two levels below root are also recorded in jump
+ */
+void checkpoint_load_trie(const Checkpoint *cp, TrieNode *root, TrieJump *jump);
+
+#endif
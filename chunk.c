@@ -0,0 +1,190 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "code.h"
+
+// A cut needs more of the top bits of the gear hash clear before CHUNK_AVG, and fewer after it, so
+// that chunk lengths bunch up around CHUNK_AVG.
+#define CUT_MASK_SHORT (UINT64_C(0x7FFF) << 49) // 15 bits.
+#define CUT_MASK_LONG  (UINT64_C(0x7FF) << 53) // 11 bits.
+
+// the murmur3 64-bit multipliers
+#define MIX_K1 UINT64_C(0x87C37B91114253D5)
+#define MIX_K2 UINT64_C(0x4CF5AD432745937F)
+
+// gear[b] is a random 64-bit number for symbol b, added into the gear hash
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void gear_init(void) {
+    // splitmix64, from a fixed seed, so that every encoder cuts the same input the same way
+    uint64_t x = 0x4C5A3738;
+    for (int b = 0; b < 256; b++) {
+        x += UINT64_C(0x9E3779B97F4A7C15);
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+        gear[b] = z ^ (z >> 31);
+    }
+}
+
+uint32_t chunk_length(const uint8_t *syms, uint32_t n) {
+    if (n <= CHUNK_MIN) {
+        return n;
+    }
+    pthread_once(&gear_once, gear_init);
+    uint32_t end = n < CHUNK_MAX ? n : CHUNK_MAX;
+    uint32_t avg = end < CHUNK_AVG ? end : CHUNK_AVG;
+    // Each symbol shifts the hash left, so its top bits only depend on the last 64 symbols.
+    uint64_t hash = 0;
+    uint32_t i = CHUNK_MIN;
+    for (; i < avg; i++) {
+        hash = (hash << 1) + gear[syms[i]];
+        if (!(hash & CUT_MASK_SHORT)) {
+            return i + 1;
+        }
+    }
+    for (; i < end; i++) {
+        hash = (hash << 1) + gear[syms[i]];
+        if (!(hash & CUT_MASK_LONG)) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return x << r | x >> (64 - r);
+}
+
+// mixes the 8 symbols in word into hash, like murmur3
+static inline uint64_t mix(uint64_t hash, uint64_t word) {
+    word *= MIX_K1;
+    word = rotl64(word, 31);
+    word *= MIX_K2;
+    hash ^= word;
+    return rotl64(hash, 27) * 5 + 0x52DCE729;
+}
+
+uint64_t chunk_fingerprint(const uint8_t *syms, uint32_t n) {
+    uint64_t hash = n * MIX_K2;
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, syms + i, 8);
+        hash = mix(hash, word);
+    }
+    if (i < n) {
+        uint64_t word = 0;
+        memcpy(&word, syms + i, n - i);
+        hash = mix(hash, word);
+    }
+    // murmur3's finalizer, so that every bit of the hash depends on every symbol
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xFF51AFD7ED558CCD);
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xC4CEB9FE1A85EC53);
+    return hash ^ (hash >> 33);
+}
+
+ChunkIndex *chunk_index_create(void) {
+    ChunkIndex *ix = (ChunkIndex *) malloc(sizeof(ChunkIndex));
+    if (ix == NULL) {
+        return NULL;
+    }
+    ix->count = 0;
+    ix->cap = 1024;
+    ix->entries = (ChunkEntry *) calloc(ix->cap, sizeof(ChunkEntry));
+    ix->order = (ChunkEntry *) malloc(ix->cap / 2 * sizeof(ChunkEntry));
+    ix->head = 0;
+    if (ix->entries == NULL || ix->order == NULL) {
+        free(ix->entries);
+        free(ix->order);
+        free(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+void chunk_index_delete(ChunkIndex *ix) {
+    if (ix == NULL) {
+        return;
+    }
+    free(ix->entries);
+    free(ix->order);
+    free(ix);
+}
+
+// Returns the slot of the entry with fingerprint and len in entries, or the empty slot it would go in.
+static ChunkEntry *chunk_slot(ChunkEntry *entries, size_t cap, uint64_t fingerprint, uint32_t len) {
+    size_t i = (size_t) fingerprint & (cap - 1);
+    while (entries[i].len != 0 && (entries[i].fingerprint != fingerprint || entries[i].len != len)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &entries[i];
+}
+
+// Empties the slot of the entry with fingerprint and len, moving the entries probed past it back so
+// that every entry can still be found from its home slot.
+static void chunk_remove(ChunkIndex *ix, uint64_t fingerprint, uint32_t len) {
+    size_t mask = ix->cap - 1;
+    size_t hole = (size_t) (chunk_slot(ix->entries, ix->cap, fingerprint, len) - ix->entries);
+    for (size_t i = (hole + 1) & mask; ix->entries[i].len != 0; i = (i + 1) & mask) {
+        // An entry can fill the hole if the hole is between its home slot and where it is.
+        size_t home = (size_t) ix->entries[i].fingerprint & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            ix->entries[hole] = ix->entries[i];
+            hole = i;
+        }
+    }
+    ix->entries[hole].len = 0;
+    ix->count -= 1;
+}
+
+const ChunkEntry *chunk_index_find(ChunkIndex *ix, uint64_t fingerprint, uint32_t len, uint64_t offset) {
+    // Drop the chunks the window has moved past, which the decoder no longer keeps.
+    while (ix->count > 0 && ix->order[ix->head].offset + DUP_WINDOW < offset) {
+        chunk_remove(ix, ix->order[ix->head].fingerprint, ix->order[ix->head].len);
+        ix->head = (ix->head + 1) % (ix->cap / 2);
+    }
+
+    ChunkEntry *slot = chunk_slot(ix->entries, ix->cap, fingerprint, len);
+    if (slot->len != 0) {
+        return slot;
+    }
+
+    // Keep the table at most half full, so that probes stay short. If there's no memory for more,
+    // the chunk just isn't remembered.
+    if (2 * (ix->count + 1) > ix->cap) {
+        size_t cap = 2 * ix->cap;
+        ChunkEntry *entries = (ChunkEntry *) calloc(cap, sizeof(ChunkEntry));
+        ChunkEntry *order = (ChunkEntry *) malloc(cap / 2 * sizeof(ChunkEntry));
+        if (entries == NULL || order == NULL) {
+            free(entries);
+            free(order);
+            return NULL;
+        }
+        for (size_t i = 0; i < ix->count; i++) {
+            ChunkEntry *e = &ix->order[(ix->head + i) % (ix->cap / 2)];
+            *chunk_slot(entries, cap, e->fingerprint, e->len) = *e;
+            order[i] = *e;
+        }
+        free(ix->entries);
+        free(ix->order);
+        ix->entries = entries;
+        ix->cap = cap;
+        ix->order = order;
+        ix->head = 0;
+        slot = chunk_slot(ix->entries, ix->cap, fingerprint, len);
+    }
+
+    slot->fingerprint = fingerprint;
+    slot->offset = offset;
+    slot->len = len;
+    ix->order[(ix->head + ix->count) % (ix->cap / 2)] = *slot;
+    ix->count += 1;
+    return NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef __CHUNK_H__
+#define __CHUNK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHUNK_MIN (1 << 11) // Shortest chunk, but for the last one of the input.
+#define CHUNK_AVG (1 << 13) // Length chunks are cut around.
+#define CHUNK_MAX (1 << 16) // Longest chunk.
+
+//
+// The chunks seen in the last DUP_WINDOW symbols, by fingerprint: an open-addressed hash table of
+// ChunkEntry, a len of 0 marking an empty slot. The same entries are also kept in the order they
+// were added, so that the oldest can be dropped once the window has moved past them.
+//
+typedef struct ChunkEntry {
+    uint64_t fingerprint;
+    uint64_t offset; // Where the chunk was first seen, in symbols from the start of the stream.
+    uint32_t len;
+} ChunkEntry;
+
+typedef struct ChunkIndex {
+    ChunkEntry *entries;
+    size_t count;
+    size_t cap; // A power of two.
+    ChunkEntry *order; // A ring of cap / 2 slots holding the count entries, oldest first from head.
+    size_t head;
+} ChunkIndex;
+
+/*
+ * Returns the length of the chunk starting the n symbols of syms, which must hold at least
+ * CHUNK_MAX symbols unless the input ends sooner
+ * Chunks are cut where a gear hash of the last 64 symbols has its top bits clear, so that an insert
+ * or delete only moves the cuts around it
+ */
+uint32_t chunk_length(const uint8_t *syms, uint32_t n);
+
+/*
+ * Returns a 64-bit hash of the n symbols of syms
+ */
+uint64_t chunk_fingerprint(const uint8_t *syms, uint32_t n);
+
+/*
+ * Constructor: Creates an empty chunk index
+ */
+ChunkIndex *chunk_index_create(void);
+
+/*
+ * Destructor: Frees ix
+ */
+void chunk_index_delete(ChunkIndex *ix);
+
+/*
+ * Returns the entry of a chunk seen before with the same fingerprint and len, no more than
+ * DUP_WINDOW symbols before offset: chunks seen longer ago are dropped first
+ * If there isn't one, the chunk is added as seen at offset, and NULL is returned
+ */
+const ChunkEntry *chunk_index_find(ChunkIndex *ix, uint64_t fingerprint, uint32_t len, uint64_t offset);
+
+#endif
@@ -8,4 +8,25 @@
 #define START_CODE 2
 #define MAX_CODE   UINT16_MAX
 
+// A pair with STOP_CODE and a non-zero symbol is a control pair. Control pairs are only found in
+// streams with the MAGIC_EXT header and introduce the blocks below. (STOP_CODE, 0) still ends the
+// stream.
+#define CTRL_RUN 1 // 8-bit symbol and 32-bit count: the symbol repeated count times.
+#define CTRL_RESET 2 // No payload: the dictionary is reset, as when next_code reaches MAX_CODE.
+#define CTRL_SYNC 3 // No payload: flush everything so far, padded to a byte, keeping the dictionary.
+#define CTRL_CHECK 4 // Padded to a byte, then the 32-bit CRC32Cs of the symbols and of the bytes since the last one.
+#define CTRL_DUP 5 // 64-bit offset and 32-bit length: the length symbols decoded offset symbols after the start of the stream, again.
+
+#define DUP_WINDOW (1 << 26) // A CTRL_DUP block only copies from the last this many symbols decoded.
+
+// Returns the bit length of n, the number of bits a code is written with while next_code is n
+static inline int bit_len(uint16_t n) {
+    int count = 0;
+    while (n != 0) {
+        count += 1;
+        n = n >> 1;
+    }
+    return count;
+}
+
 #endif
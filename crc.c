@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_X86
+#endif
+
+#define CRC_POLY 0x82F63B78 // The Castagnoli polynomial, bit reversed.
+
+// crc_table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = (uint32_t) b;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC_POLY : crc >> 1;
+        }
+        crc_table[0][b] = crc;
+    }
+    for (int b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t crc = crc_table[k - 1][b];
+            crc_table[k][b] = (crc >> 8) ^ crc_table[0][crc & 0xFF];
+        }
+    }
+}
+
+// eight bytes at a time with one table lookup per byte, all independent of each other
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t *buf, size_t len) {
+    pthread_once(&crc_table_once, crc_table_init);
+    while (len >= 8) {
+        uint32_t lo = crc
+                      ^ ((uint32_t) buf[0] | (uint32_t) buf[1] << 8 | (uint32_t) buf[2] << 16
+                          | (uint32_t) buf[3] << 24);
+        uint32_t hi = (uint32_t) buf[4] | (uint32_t) buf[5] << 8 | (uint32_t) buf[6] << 16 | (uint32_t) buf[7] << 24;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^ crc_table[5][(lo >> 16) & 0xFF]
+              ^ crc_table[4][lo >> 24] ^ crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF]
+              ^ crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf) & 0xFF];
+        buf += 1;
+        len -= 1;
+    }
+    return crc;
+}
+
+#ifdef CRC_X86
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t len) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t bytes;
+        memcpy(&bytes, buf, sizeof(bytes));
+        crc64 = _mm_crc32_u64(crc64, bytes);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (len >= 4) {
+        uint32_t bytes;
+        memcpy(&bytes, buf, sizeof(bytes));
+        crc = _mm_crc32_u32(crc, bytes);
+        buf += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *buf);
+        buf += 1;
+        len -= 1;
+    }
+    return crc;
+}
+#endif
+
+/*
+ * Returns the CRC32C of the len bytes of buf, continuing from crc, the CRC32C of the bytes before
+ * them (0 to start)
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, and slice-by-8 tables otherwise
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len) {
+#ifdef CRC_X86
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c_sse42(~crc, buf, len);
+    }
+#endif
+    return ~crc32c_slice8(~crc, buf, len);
+}
@@ -0,0 +1,14 @@
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Returns the CRC32C of the len bytes of buf, continuing from crc, the CRC32C of the bytes before
+ * them (0 to start)
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, and slice-by-8 tables otherwise
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, size_t len);
+
+#endif
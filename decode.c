@@ -1,25 +1,26 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h> //atof
+#include <getopt.h> // getopt_long().
 #include <unistd.h> //getopt().
 #include <fcntl.h> // read open
 #include <sys/stat.h>
 
 #include "code.h"
-#include "endian.h"
+#include "decoder.h"
+#include "dict.h"
+#include "filter.h"
 #include "io.h"
-#include "trie.h"
+#include "pipeline.h"
+#include "solid.h"
 
-#define OPTIONS "i:o:vh"
+#define OPTIONS "i:o:D:t:x:pvh"
 
-// this function takes a uint16 and returns its bit length
-int bit_len(uint16_t n) {
-    int count = 0;
-    while (n != 0) {
-        count += 1;
-        n = n >> 1;
-    }
-    return count;
-}
+static const struct option long_options[] = {
+    { "list", no_argument, NULL, 'l' },
+    { "solid", no_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 },
+};
 
 int main(int argc, char **argv) {
     int opt = 0;
@@ -27,6 +28,17 @@ int main(int argc, char **argv) {
     // disable verbose by default
     int verbose = 0;
 
+    // threads decoding dictionary epochs in parallel
+    int threads = 1;
+
+    // read, decode and write on separate threads
+    bool pipelined = false;
+
+    // list the files of a solid archive, extract one of them, or extract them all
+    bool list = false;
+    char *extract_name = NULL;
+    bool extract_all = false;
+
     // file descriptors
     int infile_descriptor = STDIN_FILENO;
     int outfile_descriptor = STDOUT_FILENO;
@@ -34,6 +46,7 @@ int main(int argc, char **argv) {
     // default names for files
     char *infile_name = NULL;
     char *outfile_name = NULL;
+    char *dict_name = NULL;
 
     // help_message
     const char *help_message
@@ -42,24 +55,54 @@ int main(int argc, char **argv) {
           "   Used with files compressed with the corresponding encoder.\n"
           "\n"
           "USAGE\n"
-          "   ./decode [-vh] [-i input] [-o output]\n"
+          "   ./decode [-vph] [-i input] [-o output] [-D dict] [-t threads]\n"
+          "   ./decode -i archive [-D dict] [--list | -x file [-o output] | --solid [-o dir]]\n"
           "\n"
           "OPTIONS\n"
           "   -v          Display decompression statistics\n"
           "   -i input    Specify input to decompress (stdin by default)\n"
           "   -o output   Specify output of decompressed input (stdout by default)\n"
+          "   -D dict     Dictionary the input was encoded with\n"
+          "   -t threads  Decode each dictionary epoch of a file without control blocks on one of threads\n"
+          "   -p          Read, decode and write on separate threads, for files without checksums\n"
+          "               or duplicates\n"
+          "   --list      List the files of a solid archive\n"
+          "   -x file     Extract one file of a solid archive, decoding from the last dictionary\n"
+          "               reset before it\n"
+          "   --solid     Extract every file of a solid archive into the directory output (. by default)\n"
           "   -h          Display program usage\n";
 
     // 1. Parse command-line options using getopt() and handle them accordingly.
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'i': infile_name = optarg; break;
         case 'o': outfile_name = optarg; break;
         case 'v': verbose = 1; break;
+        case 'D': dict_name = optarg; break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Error: invalid number of threads -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p': pipelined = true; break;
+        case 'l': list = true; break;
+        case 'x': extract_name = optarg; break;
+        case 'S': extract_all = true; break;
         case 'h': printf("%s", help_message); return 1;
-        default: fprintf(stderr, "Usage: %s [-i input] [-o output] [-v] [-h]\n", argv[0]); exit(1);
+        default: fprintf(stderr, "Usage: %s [-i input] [-o output] [-D dict] [-t threads] [-p] [-v] [--list] [-x file] [--solid] [-h]\n", argv[0]); exit(1);
         }
     }
+    bool archive = list || extract_name != NULL || extract_all;
+    if (list + (extract_name != NULL) + extract_all > 1) {
+        fprintf(stderr, "Error: only one of --list, -x and --solid can be given\n");
+        exit(1);
+    }
+    if (archive && (threads > 1 || pipelined)) {
+        fprintf(stderr, "Error: --list, -x and --solid can't be used with -t or -p\n");
+        exit(1);
+    }
 
     // 1. Open infile with open(). If an error occurs, print a helpful message and exit with a status code indicating
     // that an error occurred. infile should be stdin if an input file wasn’t specified.
@@ -71,17 +114,79 @@ int main(int argc, char **argv) {
         }
     }
 
-    // 2. Read in the file header with read_header(), which also verifies the magic number. If the magic number is
-    // verified then decompression is good to go and you now have a header which contains the original protection
-    // bit mask.
+    Dict *dict = NULL;
+    if (dict_name != NULL) {
+        dict = dict_open(dict_name);
+        if (dict == NULL) {
+            fprintf(stderr, "Error: unable to load dictionary -- '%s'\n", dict_name);
+            exit(1);
+        }
+    }
+
+    // 2. Read in the file header with decode_header(), which also checks that the stream can be decoded. If it can,
+    // then decompression is good to go and you now have a header which contains the original protection bit mask.
+    Decoder *decoder = decoder_create();
+    decoder->sparse = true;
     FileHeader infile_header;
-    read_header(infile_descriptor, &infile_header);
+    if (!decode_header(decoder, infile_descriptor, &infile_header, dict)) {
+        fprintf(stderr, "Error: %s\n", decoder->error);
+        exit(1);
+    }
+    // The dictionary is only used if the stream names it.
+    if (!(infile_header.flags & FLAG_DICT)) {
+        dict_close(dict);
+        dict = NULL;
+    }
+
+    // The files of a solid archive are found from its file table, at the end of the input.
+    if (archive) {
+        SolidTable *table = solid_read_table(decoder, infile_descriptor);
+        if (table == NULL) {
+            fprintf(stderr, "Error: %s\n", decoder->error);
+            exit(1);
+        }
+        bool ok = true;
+        if (list) {
+            for (uint32_t k = 0; k < table->count; k++) {
+                printf("%12lu  %04o  %s\n", table->files[k].size, table->files[k].mode & 07777, table->files[k].name);
+            }
+            fflush(stdout);
+        } else if (extract_name != NULL) {
+            int k = solid_find(table, extract_name);
+            if (k == -1) {
+                fprintf(stderr, "Error: no such file in the archive -- '%s'\n", extract_name);
+                exit(1);
+            }
+            if (outfile_name != NULL) {
+                outfile_descriptor = open(outfile_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                if (outfile_descriptor == -1) {
+                    fprintf(stderr, "Error: unable to open output file -- '%s'\n", outfile_name);
+                    exit(1);
+                }
+                fchmod(outfile_descriptor, table->files[k].mode & 0777);
+            }
+            ok = solid_extract(decoder, infile_descriptor, table, k, outfile_descriptor, dict);
+        } else {
+            ok = solid_extract_all(decoder, infile_descriptor, table, outfile_name != NULL ? outfile_name : ".", dict);
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: %s\n", decoder->error);
+            exit(1);
+        }
+        solid_table_delete(table);
+        decoder_delete(decoder);
+        dict_close(dict);
+        close(infile_descriptor);
+        close(outfile_descriptor);
+        return 0;
+    }
 
     // 3. Open outfile using open(). The permissions for outfile should match the protection bits as set in
     // your file header that you just read. Any errors with opening outfile should be handled like with infile.
     // outfile should be stdout if an output file wasn’t specified.
     if (outfile_name != NULL) {
-        outfile_descriptor = open(outfile_name, O_WRONLY | O_CREAT);
+        // Opened for reading too, so that chunks copied by CTRL_DUP blocks can be read back from it.
+        outfile_descriptor = open(outfile_name, O_RDWR | O_CREAT);
         if (outfile_descriptor == -1) {
             fprintf(stderr, "Error: unable to open output file -- '%s'\n", outfile_name);
             exit(1);
@@ -89,43 +194,32 @@ int main(int argc, char **argv) {
     }
     fchmod(outfile_descriptor, infile_header.protection);
 
-    // 4. Create a new word table with wt_create() and make sure each of its entries are set to NULL. Initialize the
-    // table to have just the empty word, a word of length 0, at the index EMPTY_CODE. We will refer to this table as
-    // table.
-    WordTable *table = wt_create();
-
-    // 5. You will need two uint16_t to keep track of the current code and next code. These will be referred to as
-    // curr_code and next_code, respectively. next_code should be initialized as START_CODE and functions
-    // exactly the same as the monotonic counter used during compression, which was also called next_code.
-    uint16_t curr_code = 0;
-    uint16_t next_code = START_CODE;
-
-    // 6. Use read_pair() in a loop to read all the pairs from infile. We will refer to the code and symbol from each
-    // read pair as curr_code and curr_sym, respectively. The bit-length of the code to read is the bit-length of
-    // next_code. The loop breaks when the code read is STOP_CODE. For each read pair, perform the following:
-    //     (a) As seen in the decompression example, we will need to append the read symbol with the word de-
-    //     noted by the read code and add the result to table at the index next_code. The word denoted by the
-    //     read code is stored in table[curr_code]. We will append table[curr_code] and curr_sym using
-    //     word_append_sym().
-    //     (b) Write the word that we just constructed and added to the table with write_word(). This word should
-    //     have been stored in table[next_code].
-    //     (c) Increment next_code and check if it equals MAX_CODE. If it has, reset the table using wt_reset() and
-    // set next_code to be START_CODE. This mimics the resetting of the trie during compression.
-
-    uint8_t curr_sym = 0;
-    while (read_pair(infile_descriptor, &curr_code, &curr_sym, bit_len(next_code))) {
-        table[next_code] = word_append_sym(table[curr_code], curr_sym);
-        write_word(outfile_descriptor, table[next_code]);
-        next_code += 1;
-        if (next_code == MAX_CODE) {
-            wt_reset(table);
-            next_code = START_CODE;
-        }
+    // A filtered stream decodes to the filtered symbols, which are unfiltered a block at a time on their way out.
+    FilterOutput unfilter;
+    if (decoder->filter != FILTER_NONE) {
+        filter_output_start(&unfilter, outfile_descriptor, decoder->filter);
     }
 
-    // 7. Flush any buffered words using flush_words(). Like with write_pair(), write_word() buffers words
-    // under the hood, so we have to remember to flush the contents of our buffer.
-    flush_words(outfile_descriptor);
+    // 4. - 7. Decode the pairs with the decoder's word table, then flush any buffered words. With more than one
+    // thread, streams that can be split at their dictionary resets are decoded an epoch per thread. Otherwise
+    // with -p, streams without checksums or duplicates are decoded on a pipeline of threads.
+    bool decoded = false;
+    if (threads > 1) {
+        decoded = decode_parallel(decoder, infile_descriptor, outfile_descriptor, dict, threads);
+    }
+    if (!decoded && decoder->error[0] == '\0' && pipelined) {
+        decoded = decode_pipelined(decoder, infile_descriptor, outfile_descriptor, dict);
+    }
+    if (!decoded && decoder->error[0] == '\0') {
+        decoded = decode_stream(decoder, infile_descriptor, outfile_descriptor, dict);
+    }
+    if (!decoded) {
+        fprintf(stderr, "Error: %s\n", decoder->error);
+        exit(1);
+    }
+    if (decoder->filter != FILTER_NONE) {
+        filter_output_finish(&unfilter);
+    }
 
     if (verbose) {
         // Compressed file size: 25 bytes
@@ -144,7 +238,8 @@ int main(int argc, char **argv) {
     }
 
     // 8. Close infile and outfile with close().
-    wt_delete(table);
+    decoder_delete(decoder);
+    dict_close(dict);
     close(infile_descriptor);
     close(outfile_descriptor);
 }
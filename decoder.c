@@ -0,0 +1,520 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "code.h"
+#include "decoder.h"
+#include "dict.h"
+#include "filter.h"
+#include "io.h"
+#include "word.h"
+
+// what ended decoding, in *ctrl, if it wasn't STOP_CODE
+#define END_TRUNCATED -1 // The input ran out.
+#define END_CORRUPT -2 // A code that isn't in the table yet.
+
+// Decode pairs from br until next_code reaches the first code that needs more than bitlen bits to
+// be read, STOP_CODE is read or the input runs out. Every pair of the phase is read with the same
+// bitlen, which is a compile-time constant in each of the decode_phase_N instances below. Returns
+// false once decoding is done, with *ctrl set to 0 at STOP_CODE, or to END_TRUNCATED or END_CORRUPT.
+// A control pair also ends the phase, with its symbol left in *ctrl.
+static inline __attribute__((always_inline)) bool decode_phase(
+    BitReader *br, int outfile, WordTable *table, uint16_t *next, int *ctrl, int bitlen) {
+    uint16_t next_code = *next;
+    uint16_t phase_end = bitlen == 16 ? MAX_CODE : (uint16_t) (1 << bitlen);
+    uint64_t pairs = 0;
+    bool more = true;
+
+    uint16_t curr_code = 0;
+    uint8_t curr_sym = 0;
+    while (next_code != phase_end) {
+        if (!br_pair(br, &curr_code, &curr_sym, bitlen)) {
+            *ctrl = END_TRUNCATED;
+            more = false;
+            break;
+        }
+        pairs += 1;
+        if (curr_code == STOP_CODE) {
+            *ctrl = curr_sym;
+            more = curr_sym != 0;
+            break;
+        }
+        if (curr_code >= next_code) {
+            *ctrl = END_CORRUPT;
+            more = false;
+            break;
+        }
+        table[next_code] = word_append_sym(table[curr_code], curr_sym);
+        write_word(outfile, table[next_code]);
+        next_code += 1;
+    }
+
+    total_bits += pairs * (bitlen + 8);
+    *next = next_code;
+    return more;
+}
+
+#define DECODE_PHASE(N)                                                                            \
+    static bool decode_phase_##N(                                                                  \
+        BitReader *br, int outfile, WordTable *table, uint16_t *next, int *ctrl) {             \
+        return decode_phase(br, outfile, table, next, ctrl, N);                                    \
+    }
+DECODE_PHASE(2)
+DECODE_PHASE(3)
+DECODE_PHASE(4)
+DECODE_PHASE(5)
+DECODE_PHASE(6)
+DECODE_PHASE(7)
+DECODE_PHASE(8)
+DECODE_PHASE(9)
+DECODE_PHASE(10)
+DECODE_PHASE(11)
+DECODE_PHASE(12)
+DECODE_PHASE(13)
+DECODE_PHASE(14)
+DECODE_PHASE(15)
+DECODE_PHASE(16)
+
+// decode_phases[n] decodes the phase whose codes are n bits long
+static bool (*const decode_phases[])(BitReader *, int, WordTable *, uint16_t *, int *) = {
+    NULL,
+    NULL,
+    decode_phase_2,
+    decode_phase_3,
+    decode_phase_4,
+    decode_phase_5,
+    decode_phase_6,
+    decode_phase_7,
+    decode_phase_8,
+    decode_phase_9,
+    decode_phase_10,
+    decode_phase_11,
+    decode_phase_12,
+    decode_phase_13,
+    decode_phase_14,
+    decode_phase_15,
+    decode_phase_16,
+};
+
+// Decode the block introduced by the control pair with symbol ctrl. Returns false if the block is
+// cut short, or with d->error set if ctrl is unknown.
+static bool decode_control(
+    Decoder *d, BitReader *br, int outfile, int ctrl, const Dict *dict, uint16_t *next_code) {
+    WordTable *table = d->table;
+    uint32_t sym = 0;
+    uint32_t count = 0;
+    uint32_t syms_crc = 0;
+    uint32_t pairs_crc = 0;
+    uint32_t offset_lo = 0;
+    uint32_t offset_hi = 0;
+    uint64_t end = 0;
+    switch (ctrl) {
+    case CTRL_RUN:
+        if (!br_bits(br, &sym, 8) || !br_bits(br, &count, 32)) {
+            return false;
+        }
+        total_bits += 8 + 32;
+        write_run(outfile, (uint8_t) sym, count);
+        return true;
+    case CTRL_RESET:
+        wt_reset(table);
+        *next_code = START_CODE;
+        if (dict != NULL) {
+            dict_load_words(dict, table);
+            *next_code = dict_next_code(dict);
+        }
+        return true;
+    case CTRL_SYNC:
+        // Release everything decoded so far. The encoder padded the stream to a byte boundary.
+        br_align(br);
+        flush_words(outfile);
+        return true;
+    case CTRL_CHECK:
+        // The checksums cover everything up to the padding after this pair, and the decoded symbols.
+        if (!br->check) {
+            snprintf(d->error, sizeof(d->error), "unexpected checksum block");
+            return false;
+        }
+        pairs_crc = br_check(br);
+        end = sizeof(FileHeader) + (d->flags & FLAG_DICT ? sizeof(uint32_t) : 0)
+              + (d->flags & FLAG_FILTER ? sizeof(uint32_t) : 0) + total_bits / 8;
+        if (!br_bits(br, &syms_crc, 32) || !br_bits(br, &count, 32)) {
+            return false;
+        }
+        total_bits += 32 + 32;
+        if (count != pairs_crc) {
+            snprintf(d->error, sizeof(d->error), "checksum mismatch in the input before byte %lu", end);
+            return false;
+        }
+        if (syms_crc != syms_check()) {
+            snprintf(d->error, sizeof(d->error), "checksum mismatch in the output before byte %lu", total_syms);
+            return false;
+        }
+        return true;
+    case CTRL_DUP:
+        // A chunk seen before is copied from the output, without touching the word table.
+        if (!br_bits(br, &offset_lo, 32) || !br_bits(br, &offset_hi, 32) || !br_bits(br, &count, 32)) {
+            return false;
+        }
+        total_bits += 32 + 32 + 32;
+        if (!copy_words(outfile, (uint64_t) offset_hi << 32 | offset_lo, count)) {
+            snprintf(d->error, sizeof(d->error), "corrupt input -- duplicate out of range");
+            return false;
+        }
+        return true;
+    default: snprintf(d->error, sizeof(d->error), "unknown control pair -- %u", ctrl); return false;
+    }
+}
+
+Decoder *decoder_create(void) {
+    Decoder *d = (Decoder *) malloc(sizeof(Decoder));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->table = wt_create();
+    d->error[0] = '\0';
+    d->sparse = false;
+    return d;
+}
+
+void decoder_delete(Decoder *d) {
+    if (d == NULL) {
+        return;
+    }
+    wt_delete(d->table);
+    free(d);
+}
+
+bool decode_header(Decoder *d, int infile, FileHeader *header, const Dict *dict) {
+    d->error[0] = '\0';
+    d->flags = 0;
+    d->filter = FILTER_NONE;
+    if (!read_header(infile, header)) {
+        snprintf(d->error, sizeof(d->error), "not a compressed stream -- bad magic number");
+        return false;
+    }
+    if (header->flags & ~FLAGS_KNOWN) {
+        snprintf(d->error, sizeof(d->error), "unsupported stream flags -- 0x%04x", header->flags);
+        return false;
+    }
+
+    // A stream encoded with a dictionary names it by ID right after the header.
+    if (header->flags & FLAG_DICT) {
+        uint32_t dict_id = 0;
+        read_u32(infile, &dict_id);
+        if (dict == NULL) {
+            snprintf(d->error, sizeof(d->error), "input needs dictionary %08x -- use -D", dict_id);
+            return false;
+        }
+        if (dict->id != dict_id) {
+            snprintf(d->error, sizeof(d->error), "input needs dictionary %08x, not %08x", dict_id, dict->id);
+            return false;
+        }
+    }
+    if (header->flags & FLAG_FILTER) {
+        read_u32(infile, &d->filter);
+        if (d->filter == FILTER_NONE || filter_name(d->filter) == NULL) {
+            snprintf(d->error, sizeof(d->error), "unsupported filter -- 0x%08x", d->filter);
+            return false;
+        }
+    }
+    d->flags = header->flags;
+    return true;
+}
+
+// Decodes the pairs br reads to outfile, from the top of the dictionary, until STOP_CODE or, at the end of
+// a width phase, once at least until symbols have been decoded.
+static bool decode_pairs(Decoder *d, BitReader *br, int outfile, const Dict *dict, uint64_t until) {
+    d->error[0] = '\0';
+    reset_syms();
+    WordTable *table = d->table;
+    uint64_t start_syms = total_syms;
+
+    // Start from the dictionary, if the stream has one.
+    uint16_t next_code = START_CODE;
+    if (dict != NULL) {
+        dict_load_words(dict, table);
+        next_code = dict_next_code(dict);
+    }
+
+    // Read all the pairs from infile, one width phase at a time. The bit-length of the codes to read is the
+    // bit-length of next_code, which only changes when next_code crosses a power of two. The loop ends when the
+    // code read is STOP_CODE. When next_code reaches MAX_CODE the table is reset, mimicking the resetting of the
+    // trie during compression. With FLAG_CHECK set every block is checked as soon as it has been decoded.
+    br->check = (d->flags & FLAG_CHECK) != 0;
+    if (br->check) {
+        check_syms();
+    }
+    if (d->flags & FLAG_DEDUP) {
+        keep_words(outfile);
+    }
+    if (d->sparse) {
+        sparse_words(outfile);
+    }
+    int ctrl = 0;
+    while (total_syms - start_syms < until && decode_phases[bit_len(next_code)](br, outfile, table, &next_code, &ctrl)) {
+        if (ctrl != 0) {
+            if (!decode_control(d, br, outfile, ctrl, dict, &next_code)) {
+                ctrl = d->error[0] == '\0' ? END_TRUNCATED : END_CORRUPT;
+                break;
+            }
+            ctrl = 0;
+        }
+        if (next_code == MAX_CODE) {
+            wt_reset(table);
+            next_code = START_CODE;
+            if (dict != NULL) {
+                dict_load_words(dict, table);
+                next_code = dict_next_code(dict);
+            }
+        }
+    }
+
+    // A corrupt code is never decoded. A stream with checksums must also end with STOP_CODE, so that nothing
+    // can go missing after the last checksum.
+    if (ctrl == END_CORRUPT && d->error[0] == '\0') {
+        snprintf(d->error, sizeof(d->error), "corrupt input -- code out of range");
+    }
+    if (ctrl == END_TRUNCATED && br->check) {
+        snprintf(d->error, sizeof(d->error), "input is truncated");
+    }
+    bool ok = d->error[0] == '\0';
+
+    // Flush any buffered words. write_word() buffers words under the hood.
+    flush_words(outfile);
+    end_sparse_words(outfile);
+
+    // Leave just the empty word for the next stream, and drop any output kept for CTRL_DUP blocks.
+    wt_reset(table);
+    reset_syms();
+    return ok;
+}
+
+bool decode_stream(Decoder *d, int infile, int outfile, const Dict *dict) {
+    BitReader br;
+    br_init(&br, infile);
+    return decode_pairs(d, &br, outfile, dict, UINT64_MAX);
+}
+
+// the symbols decode_range keeps: skip of them are dropped, then len are written to outfile
+typedef struct RangeTap {
+    int outfile;
+    uint64_t skip;
+    uint64_t len;
+} RangeTap;
+
+// word tap: writes out the symbols in the range
+static void range_tap(void *arg, const uint8_t *syms, int n) {
+    RangeTap *r = (RangeTap *) arg;
+    if (r->skip >= (uint64_t) n) {
+        r->skip -= n;
+        return;
+    }
+    syms += r->skip;
+    n -= (int) r->skip;
+    r->skip = 0;
+    if ((uint64_t) n > r->len) {
+        n = (int) r->len;
+    }
+    write_bytes(r->outfile, (uint8_t *) syms, n);
+    r->len -= n;
+}
+
+bool decode_range(Decoder *d, int infile, int64_t bit, uint64_t skip, uint64_t len, int outfile, const Dict *dict) {
+    d->error[0] = '\0';
+    // Checksums and copies of earlier chunks cover what comes before bit.
+    if (d->flags & (FLAG_CHECK | FLAG_DEDUP | FLAG_FILTER)) {
+        snprintf(d->error, sizeof(d->error), "streams with checksums, duplicates or a filter can't be decoded in part");
+        return false;
+    }
+    RangeTap r = { .outfile = outfile, .skip = skip, .len = len };
+    BitReader br;
+    br_init(&br, infile);
+    br_seek(&br, bit);
+    tap_words(range_tap, &r);
+    bool ok = decode_pairs(d, &br, outfile, dict, skip + len);
+    tap_words(NULL, NULL);
+    if (ok && r.len > 0) {
+        snprintf(d->error, sizeof(d->error), "input is truncated");
+        ok = false;
+    }
+    return ok;
+}
+
+// one dictionary epoch of a stream decoded by decode_parallel: the pairs from one reset to the next
+typedef struct Epoch {
+    int64_t bit; // Where its first pair starts in the input.
+    uint64_t bits; // Bits of its pairs, up to STOP_CODE if it has it.
+    uint64_t syms; // Symbols its pairs decode to.
+    int64_t out; // Where its symbols go in the output: the sum of syms over the epochs before it.
+    int end; // 0 if it runs up to MAX_CODE, else 1 at STOP_CODE, END_TRUNCATED or END_CORRUPT.
+} Epoch;
+
+// the epochs of a stream, taken one at a time by the threads of decode_parallel
+typedef struct EpochJob {
+    int infile;
+    int outfile;
+    const Dict *dict;
+    Epoch *epochs;
+    uint32_t count;
+    bool write; // Decode the epochs. Otherwise only count their symbols.
+    _Atomic uint32_t next;
+} EpochJob;
+
+// Reads the pairs of epoch e, only keeping the length of every word, to find how many symbols it
+// decodes to. lens holds the lengths of the empty word and the dictionary.
+static void count_epoch(const EpochJob *job, Epoch *e, uint32_t *lens) {
+    BitReader br;
+    br_init(&br, job->infile);
+    br_seek(&br, e->bit);
+    uint16_t next_code = job->dict != NULL ? dict_next_code(job->dict) : START_CODE;
+    uint16_t code = 0;
+    uint8_t sym = 0;
+    while (next_code != MAX_CODE) {
+        int bitlen = bit_len(next_code);
+        if (!br_pair(&br, &code, &sym, bitlen)) {
+            e->end = END_TRUNCATED;
+            return;
+        }
+        e->bits += bitlen + 8;
+        if (code == STOP_CODE) {
+            // Streams with control pairs are never split into epochs.
+            e->end = sym == 0 ? 1 : END_CORRUPT;
+            return;
+        }
+        if (code >= next_code) {
+            e->end = END_CORRUPT;
+            return;
+        }
+        lens[next_code] = lens[code] + 1;
+        e->syms += lens[next_code];
+        next_code += 1;
+    }
+}
+
+// Decodes the pairs of epoch e to its place in the output, with a word table of its own.
+static void decode_epoch(const EpochJob *job, Epoch *e, WordTable *table) {
+    reset_syms();
+    write_words_at(e->out);
+    uint16_t next_code = START_CODE;
+    if (job->dict != NULL) {
+        dict_load_words(job->dict, table);
+        next_code = dict_next_code(job->dict);
+    }
+    BitReader br;
+    br_init(&br, job->infile);
+    br_seek(&br, e->bit);
+    int ctrl = 0;
+    while (next_code != MAX_CODE && decode_phases[bit_len(next_code)](&br, job->outfile, table, &next_code, &ctrl)) {
+    }
+    flush_words(job->outfile);
+    wt_reset(table);
+}
+
+// decode_parallel thread: counts or decodes epochs until there are none left
+static void *epoch_worker(void *arg) {
+    EpochJob *job = (EpochJob *) arg;
+    WordTable *table = wt_create();
+    uint32_t *lens = (uint32_t *) calloc(MAX_CODE, sizeof(uint32_t));
+    if (job->dict != NULL) {
+        dict_load_words(job->dict, table);
+        for (uint16_t c = START_CODE; c < dict_next_code(job->dict); c++) {
+            lens[c] = table[c]->len;
+        }
+        wt_reset(table);
+    }
+    uint32_t k;
+    while ((k = atomic_fetch_add(&job->next, 1)) < job->count) {
+        if (job->write) {
+            decode_epoch(job, &job->epochs[k], table);
+        } else {
+            count_epoch(job, &job->epochs[k], lens);
+        }
+    }
+    free(lens);
+    wt_delete(table);
+    return NULL;
+}
+
+// Runs job on threads threads, the calling thread being one of them.
+static void run_epochs(EpochJob *job, int threads) {
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    atomic_store(&job->next, 0);
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&workers[i], NULL, epoch_worker, job);
+    }
+    epoch_worker(job);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
+
+bool decode_parallel(Decoder *d, int infile, int outfile, const Dict *dict, int threads) {
+    d->error[0] = '\0';
+    // Without control pairs, every epoch has the same number of pairs, of the same lengths.
+    if (d->flags & ~FLAG_DICT) {
+        return false;
+    }
+    struct stat in_info;
+    struct stat out_info;
+    int64_t in_base = lseek(infile, 0, SEEK_CUR);
+    int64_t out_base = lseek(outfile, 0, SEEK_CUR);
+    if (in_base < 0 || out_base < 0 || fstat(infile, &in_info) != 0 || fstat(outfile, &out_info) != 0
+        || !S_ISREG(in_info.st_mode) || !S_ISREG(out_info.st_mode) || (fcntl(outfile, F_GETFL) & O_APPEND)) {
+        return false;
+    }
+
+    uint16_t first_code = dict != NULL ? dict_next_code(dict) : START_CODE;
+    int64_t epoch_bits = 0;
+    for (uint32_t c = first_code; c < MAX_CODE; c++) {
+        epoch_bits += bit_len((uint16_t) c) + 8;
+    }
+    int64_t stream_bits = 8 * (in_info.st_size - in_base);
+    uint32_t count = stream_bits > 0 ? (uint32_t) ((stream_bits + epoch_bits - 1) / epoch_bits) : 1;
+
+    EpochJob job = { .infile = infile, .outfile = outfile, .dict = dict, .count = count, .write = false };
+    job.epochs = (Epoch *) calloc(count, sizeof(Epoch));
+    for (uint32_t k = 0; k < count; k++) {
+        job.epochs[k].bit = 8 * in_base + k * epoch_bits;
+    }
+    run_epochs(&job, threads);
+
+    // The stream ends with the first epoch that doesn't run up to MAX_CODE. Each epoch's output starts
+    // where the output of the epochs before it ends.
+    uint32_t last = 0;
+    int64_t out = out_base;
+    uint64_t bits = 0;
+    for (;;) {
+        Epoch *e = &job.epochs[last];
+        e->out = out;
+        out += e->syms;
+        bits += e->bits;
+        if (e->end == END_CORRUPT) {
+            snprintf(d->error, sizeof(d->error), "corrupt input -- code out of range");
+            free(job.epochs);
+            return false;
+        }
+        if (e->end != 0 || last + 1 == count) {
+            break;
+        }
+        last += 1;
+    }
+    job.count = last + 1;
+    job.write = true;
+    uint64_t syms_before = total_syms;
+    uint64_t bits_before = total_bits;
+    run_epochs(&job, threads);
+
+    // The calling thread's counts only include the epochs it decoded.
+    total_syms = syms_before + (out - out_base);
+    total_bits = bits_before + bits;
+    lseek(outfile, out, SEEK_SET);
+    free(job.epochs);
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include <stdbool.h>
+
+#include "dict.h"
+#include "io.h"
+#include "word.h"
+
+//
+// A serial decoder. Its word table only holds the empty word between streams, so one decoder can
+// decode any number of streams, one at a time, on the thread that uses it.
+//
+typedef struct Decoder {
+    WordTable *table;
+    uint16_t flags; // Of the stream whose header was read last...
+    uint32_t filter; // ...and the filter its symbols were encoded with, which decode_stream leaves on them.
+    char error[128]; // Why the last call failed.
+    bool sparse; // Leave holes in outfile for blocks of zeros, if it is a regular file written at its end.
+} Decoder;
+
+Decoder *decoder_create(void);
+
+void decoder_delete(Decoder *d);
+
+// Reads the file header into *header and the fields following it, and checks that the stream can be
+// decoded with dict, which may be NULL. Returns false, with d->error set, if it can't.
+bool decode_header(Decoder *d, int infile, FileHeader *header, const Dict *dict);
+
+// Decodes the pairs in infile, after the header read by decode_header, to outfile. dict is the
+// dictionary the header names, or NULL. Returns false, with d->error set, if the stream is corrupt.
+// A stream with checksums is checked as it is decoded, stopping at the first block that doesn't match.
+bool decode_stream(Decoder *d, int infile, int outfile, const Dict *dict);
+
+// Decodes len symbols of the stream, after skipping skip of them, starting from a dictionary reset whose
+// first pair is at offset bit of infile, in bits. Decoding stops at the end of the width phase in which
+// the last of them is decoded. Streams with checksums, duplicates or a filter can't be decoded from a
+// reset: returns false, with d->error set, for them or if the stream is corrupt or ends too soon.
+bool decode_range(Decoder *d, int infile, int64_t bit, uint64_t skip, uint64_t len, int outfile, const Dict *dict);
+
+// Decodes the stream like decode_stream, with every dictionary epoch -- the pairs from one reset to
+// the next, which always take the same number of bits -- decoded on one of threads threads. Only
+// streams without control pairs, read from and written to regular files, can be split up like this.
+// Returns false with d->error empty if the stream can't be, before reading any of it.
+bool decode_parallel(Decoder *d, int infile, int outfile, const Dict *dict, int threads);
+
+#endif
@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "code.h"
+#include "dict.h"
+#include "word.h"
+
+// reads the little-endian 32-bit number at p
+static uint32_t load32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/*
+ * Constructor: Maps the dictionary file at path read-only
+ * Checks its header and that every parent comes before its child
+ * Returns NULL if it can't be opened or isn't a valid dictionary
+ */
+Dict *dict_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(DictHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const uint8_t *bytes = (const uint8_t *) map;
+    Dict *d = (Dict *) malloc(sizeof(Dict));
+    if (d == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    d->map = map;
+    d->size = st.st_size;
+    d->id = load32(bytes + 4);
+    d->count = load32(bytes + 8);
+    d->entries = bytes + sizeof(DictHeader);
+
+    // The header must match the file, and every entry must extend an earlier phrase.
+    bool valid = load32(bytes) == DICT_MAGIC && d->count <= DICT_MAX
+                 && d->size == sizeof(DictHeader) + (size_t) d->count * DICT_ENTRY;
+    for (uint32_t i = 0; valid && i < d->count; i++) {
+        uint16_t parent = dict_parent(d, i);
+        valid = parent >= EMPTY_CODE && parent < START_CODE + i;
+    }
+    if (!valid) {
+        dict_close(d);
+        return NULL;
+    }
+    return d;
+}
+
+/*
+ * Destructor: Unmaps the dictionary file and frees d
+ */
+void dict_close(Dict *d) {
+    if (d == NULL) {
+        return;
+    }
+    munmap(d->map, d->size);
+    free(d);
+}
+
+/*
+ * Returns the parent code and symbol of entry i of d
+ */
+uint16_t dict_parent(const Dict *d, uint32_t i) {
+    const uint8_t *e = d->entries + (size_t) i * DICT_ENTRY;
+    return (uint16_t) (e[0] | e[1] << 8);
+}
+
+uint8_t dict_sym(const Dict *d, uint32_t i) {
+    return d->entries[(size_t) i * DICT_ENTRY + 2];
+}
+
+/*
+ * Returns the first code after the phrases of d, where next_code starts
+ */
+uint16_t dict_next_code(const Dict *d) {
+    return (uint16_t) (START_CODE + d->count);
+}
+
+/*
+ * Adds every phrase of d below root, which must have no children yet
+ * The phrases two levels below root are also recorded in jump
+ */
+void dict_load_trie(const Dict *d, TrieNode *root, TrieJump *jump) {
+    // nodes[code] is the node of the phrase with that code
+    TrieNode **nodes = (TrieNode **) malloc((START_CODE + d->count) * sizeof(TrieNode *));
+    nodes[EMPTY_CODE] = root;
+    for (uint32_t i = 0; i < d->count; i++) {
+        uint16_t parent = dict_parent(d, i);
+        uint8_t sym = dict_sym(d, i);
+        TrieNode *node = trie_node_create((uint16_t) (START_CODE + i));
+        nodes[parent]->children[sym] = node;
+        nodes[START_CODE + i] = node;
+        if (parent != EMPTY_CODE && dict_parent(d, parent - START_CODE) == EMPTY_CODE) {
+            jump[dict_sym(d, parent - START_CODE) << 8 | sym] = node;
+        }
+    }
+    free(nodes);
+}
+
+/*
+ * Adds every phrase of d to t, which must only hold the root
+ */
+void dict_load_chains(const Dict *d, ChainTrie *t) {
+    // Every phrase comes after its parent, so those loaded before running out of memory still make a trie.
+    for (uint32_t i = 0; i < d->count; i++) {
+        if (!chain_trie_insert(t, dict_parent(d, i), dict_sym(d, i), (uint16_t) (START_CODE + i))) {
+            return;
+        }
+    }
+}
+
+/*
+ * Adds every phrase of d to wt, which must only hold the empty word
+ */
+void dict_load_words(const Dict *d, WordTable *wt) {
+    for (uint32_t i = 0; i < d->count; i++) {
+        wt[START_CODE + i] = word_append_sym(wt[dict_parent(d, i)], dict_sym(d, i));
+    }
+}
+
+/*
+ * Returns the ID of a dictionary with the count entries stored in entries
+ * The ID is the 32-bit FNV-1a hash of the entries
+ */
+uint32_t dict_id(const uint8_t *entries, uint32_t count) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < (size_t) count * DICT_ENTRY; i++) {
+        hash = (hash ^ entries[i]) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,85 @@
+#ifndef __DICT_H__
+#define __DICT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chain.h"
+#include "trie.h"
+#include "word.h"
+
+#define DICT_MAGIC 0xBAADD1C7 // Magic number of trained dictionary files.
+#define DICT_MAX   32768 // Most phrases a dictionary may hold.
+
+//
+// A trained dictionary file is a DictHeader followed by count entries of 4 bytes, all little-endian.
+// Entry i is the phrase with code START_CODE + i: the phrase with code parent, followed by sym.
+// Parents always come before their children, so the entries can be loaded in order.
+//
+// +-------+----+-------+--------+-----+----------+--------+-----+----------+-----
+// | magic | id | count | parent | sym | reserved | parent | sym | reserved | ...
+// +-------+----+-------+--------+-----+----------+--------+-----+----------+-----
+//    32     32    32       16      8       8
+//
+typedef struct DictHeader {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t count;
+} DictHeader;
+
+#define DICT_ENTRY 4 // Bytes per entry.
+
+typedef struct Dict {
+    uint32_t id;
+    uint32_t count;
+    const uint8_t *entries;
+    void *map; // The mmap()ed file, shared with every other process using it.
+    size_t size;
+} Dict;
+
+/*
+ * Constructor: Maps the dictionary file at path read-only
+ * Checks its header and that every parent comes before its child
+ * Returns NULL if it can't be opened or isn't a valid dictionary
+ */
+Dict *dict_open(const char *path);
+
+/*
+ * Destructor: Unmaps the dictionary file and frees d
+ */
+void dict_close(Dict *d);
+
+/*
+ * Returns the parent code and symbol of entry i of d
+ */
+uint16_t dict_parent(const Dict *d, uint32_t i);
+uint8_t dict_sym(const Dict *d, uint32_t i);
+
+/*
+ * Returns the first code after the phrases of d, where next_code starts
+ */
+uint16_t dict_next_code(const Dict *d);
+
+/*
+ * Adds every phrase of d below root, which must have no children yet
+ * The phrases two levels below root are also recorded in jump
+ */
+void dict_load_trie(const Dict *d, TrieNode *root, TrieJump *jump);
+
+/*
+ * Adds every phrase of d to t, which must only hold the root
+ */
+void dict_load_chains(const Dict *d, ChainTrie *t);
+
+/*
+ * Adds every phrase of d to wt, which must only hold the empty word
+ */
+void dict_load_words(const Dict *d, WordTable *wt);
+
+/*
+ * Returns the ID of a dictionary with the count entries stored in entries
+ * The ID is the 32-bit FNV-1a hash of the entries
+ */
+uint32_t dict_id(const uint8_t *entries, uint32_t count);
+
+#endif
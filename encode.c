@@ -1,24 +1,50 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h> //atof
+#include <string.h> // strcmp
+#include <getopt.h> // getopt_long().
 #include <unistd.h> //getopt().
 #include <fcntl.h> // read open
 #include <sys/stat.h>
 
+#include "checkpoint.h"
 #include "code.h"
+#include "dict.h"
+#include "encoder.h"
+#include "filter.h"
 #include "endian.h"
 #include "io.h"
+#include "lanes.h"
+#include "pipeline.h"
+#include "solid.h"
 #include "trie.h"
+#include "verify.h"
 
-#define OPTIONS "i:o:vh"
+#define OPTIONS "i:o:D:m:L:t:vzpc9h"
 
-// this function takes a uint16 and returns its bit length
-int bit_len(uint16_t n) {
-    int count = 0;
-    while (n != 0) {
-        count += 1;
-        n = n >> 1;
+static const struct option long_options[] = {
+    { "mem-limit", required_argument, NULL, 'm' },
+    { "flush-ms", required_argument, NULL, 'F' },
+    { "flush-bytes", required_argument, NULL, 'B' },
+    { "verify", no_argument, NULL, 'V' },
+    { "append", no_argument, NULL, 'A' },
+    { "dedup", no_argument, NULL, 'U' },
+    { "filter", required_argument, NULL, 'P' },
+    { "solid", no_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 },
+};
+
+// Parses a size in bytes with an optional K, M or G suffix. Returns 0 if it isn't one.
+static uint64_t parse_size(const char *arg) {
+    char *end;
+    uint64_t size = strtoull(arg, &end, 10);
+    switch (*end) {
+    case 'G': size <<= 10; // fall through
+    case 'M': size <<= 10; // fall through
+    case 'K': size <<= 10; end += 1; break;
+    default: break;
     }
-    return count;
+    return *end == '\0' ? size : 0;
 }
 
 int main(int argc, char **argv) {
@@ -27,6 +53,38 @@ int main(int argc, char **argv) {
     // disable verbose by default
     int verbose = 0;
 
+    // how to encode the input
+    EncodeOptions opts = { .dict = NULL,
+        .runs = false,
+        .mem_limit = 0,
+        .flush_ms = 0,
+        .flush_bytes = 0,
+        .check = false,
+        .flexible = false,
+        .verify = NULL,
+        .dedup = false,
+        .checkpoint = NULL,
+        .filter = FILTER_NONE,
+        .lanes = 0 };
+
+    // choose the filter from the start of the input
+    bool auto_filter = false;
+
+    // threads to encode lanes of chunks on, 0 unless given
+    int threads = 0;
+
+    // read, walk the trie and pack on separate threads
+    bool pipelined = false;
+
+    // decode the output as it is written, and check it against the input
+    bool verify = false;
+
+    // carry on the stream in the output file from its checkpoint
+    bool append = false;
+
+    // encode the files named after the options as one solid archive
+    bool solid = false;
+
     // file descriptors
     int infile_descriptor = STDIN_FILENO;
     int outfile_descriptor = STDOUT_FILENO;
@@ -34,6 +92,7 @@ int main(int argc, char **argv) {
     // default names for files
     char *infile_name = NULL;
     char *outfile_name = NULL;
+    char *dict_name = NULL;
 
     // help_message
     const char *help_message
@@ -41,23 +100,111 @@ int main(int argc, char **argv) {
           "   Compresses files using the LZ78 compression algorithm.\n"
           "   Compressed files are decompressed with the corresponding decoder.\n\n"
           "USAG\n"
-          "   ./encode [-vh] [-i input] [-o output]\n\n"
+          "   ./encode [-vzpc9h] [-i input] [-o output] [-D dict] [-L lanes] [-t threads] [--mem-limit bytes]\n"
+          "            [--flush-ms ms] [--flush-bytes bytes] [--verify] [--append] [--dedup]\n"
+          "            [--filter name]\n"
+          "   ./encode --solid [-vz9h] [-o output] [-D dict] [--mem-limit bytes] [--verify] file...\n\n"
           "OPTIONS\n"
           "   -v          Display compression statistics\n"
+          "   -z          Encode long runs of one byte as run blocks (sparse input)\n"
+          "   -D dict     Start from a dictionary trained with ./train\n"
+          "   -p          Read, encode and write on separate threads\n"
+          "   -c          Add checksums, so that decode stops at the first corrupt block\n"
+          "   -9          Compress harder: choose each phrase looking one phrase ahead (slower)\n"
+          "   -L lanes    Encode 1MB chunks from a reset dictionary, this many at a time in lockstep on\n"
+          "               each thread so that their trie lookups overlap (1 to 16)\n"
+          "   -t threads  Encode the chunks of -L on this many threads (1 lane each without -L)\n"
+          "   --mem-limit bytes\n"
+          "               Reset the dictionary once its trie takes this much memory (K, M, G suffixes)\n"
+          "   --flush-ms ms\n"
+          "               Stream: write out input at most ms milliseconds after it arrives\n"
+          "   --flush-bytes bytes\n"
+          "               Stream: write out input whenever this much has arrived (K, M, G suffixes)\n"
+          "   --verify    Decode the output while encoding and fail unless it matches the input\n"
+          "   --append    Add the input to the end of the output's stream, from the checkpoint\n"
+          "               kept next to it in output.ckpt (which the first --append creates)\n"
+          "   --dedup     Cut the input into chunks and store each repeated chunk as a reference\n"
+          "               to its first copy (redundant input such as backups)\n"
+          "   --filter name\n"
+          "               Filter the input before encoding, undone by decode: delta2, delta4 or delta8\n"
+          "               (word differences), xor2, xor4 or xor8, planes2, planes4 or planes8 (byte\n"
+          "               planes of records), x86 (branch targets), none, or auto to pick from the first\n"
+          "               64KB of input\n"
+          "   --solid     Encode the files as one archive sharing a growing dictionary, with a table\n"
+          "               of them after the stream so that decode can list and extract each one\n"
           "   -i input    Specify input to compress (stdin by default)\n"
           "   -o output   Specify output of compressed input (stdout by default)\n"
           "   -h          Display program help and usage\n";
 
     // 1. Parse command-line options using getopt() and handle them accordingly.
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'i': infile_name = optarg; break;
         case 'o': outfile_name = optarg; break;
         case 'v': verbose = 1; break;
+        case 'z': opts.runs = true; break;
+        case 'm':
+            opts.mem_limit = parse_size(optarg);
+            if (opts.mem_limit == 0) {
+                fprintf(stderr, "Error: invalid memory limit -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'F':
+            opts.flush_ms = atoi(optarg);
+            if (opts.flush_ms <= 0) {
+                fprintf(stderr, "Error: invalid flush interval -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'B':
+            opts.flush_bytes = parse_size(optarg);
+            if (opts.flush_bytes == 0) {
+                fprintf(stderr, "Error: invalid flush size -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'V': verify = true; break;
+        case 'A': append = true; break;
+        case 'S': solid = true; break;
+        case 'U': opts.dedup = true; break;
+        case 'P':
+            auto_filter = strcmp(optarg, "auto") == 0;
+            if (!auto_filter && !filter_parse(optarg, &opts.filter)) {
+                fprintf(stderr, "Error: unknown filter -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p': pipelined = true; break;
+        case 'c': opts.check = true; break;
+        case '9': opts.flexible = true; break;
+        case 'D': dict_name = optarg; break;
+        case 'L':
+            opts.lanes = atoi(optarg);
+            if (opts.lanes < 1 || opts.lanes > LANES_MAX) {
+                fprintf(stderr, "Error: invalid number of lanes -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                fprintf(stderr, "Error: invalid number of threads -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
         case 'h': printf("%s", help_message); return 1;
-        default: fprintf(stderr, "Usage: %s [-i input] [-o output] [-v] [-h]\n", argv[0]); exit(1);
+        default: fprintf(stderr, "Usage: %s [-i input] [-o output] [-D dict] [-L lanes] [-t threads] [-v] [-z] [-p] [-c] [-9] [--mem-limit bytes] [--flush-ms ms] [--flush-bytes bytes] [--verify] [--append] [--dedup] [--filter name] [--solid file...] [-h]\n", argv[0]); exit(1);
         }
     }
+    if (optind < argc && !solid) {
+        fprintf(stderr, "Error: input files can only be given with --solid\n");
+        exit(1);
+    }
+    if (solid && (optind == argc || infile_name != NULL)) {
+        fprintf(stderr, "Error: --solid takes the files to encode as arguments, not -i\n");
+        exit(1);
+    }
 
     // 1. Open infile with open(). If an error occurs, print a helpful message and exit with a status code indicating
     // that an error occurred. infile should be stdin if an input file wasn’t specified.
@@ -69,113 +216,277 @@ int main(int argc, char **argv) {
         }
     }
 
-    // 2. The first thing in outfile must be the file header, as defined in the file io.h. The magic number in the
-    // header must be 0xBAADBAAC. The file size and the protection bit mask you will obtain using fstat(). See
-    // the man page on it for details.
-    FileHeader infile_header;
-    infile_header.magic = 0;
-    infile_header.protection = 0;
+    Dict *dict = NULL;
+    if (dict_name != NULL) {
+        dict = dict_open(dict_name);
+        if (dict == NULL) {
+            fprintf(stderr, "Error: unable to load dictionary -- '%s'\n", dict_name);
+            exit(1);
+        }
+    }
+    opts.dict = dict;
+    if (threads && !opts.lanes) {
+        opts.lanes = 1;
+    }
+
+    // --append carries on with the options the stream was started with.
+    Checkpoint *checkpoint = NULL;
+    char checkpoint_name[4096];
+    if (append) {
+        if (outfile_name == NULL) {
+            fprintf(stderr, "Error: --append needs an output file\n");
+            exit(1);
+        }
+        snprintf(checkpoint_name, sizeof(checkpoint_name), "%s.ckpt", outfile_name);
+        checkpoint = checkpoint_create();
+        if (access(checkpoint_name, F_OK) == 0) {
+            if (!checkpoint_read(checkpoint, checkpoint_name)) {
+                fprintf(stderr, "Error: invalid checkpoint -- '%s'\n", checkpoint_name);
+                exit(1);
+            }
+            uint16_t flags = checkpoint->header.flags;
+            if ((flags & FLAG_DICT) && dict == NULL) {
+                fprintf(stderr, "Error: the stream needs its dictionary to append to it -- use -D\n");
+                exit(1);
+            }
+            opts.runs = opts.runs || (flags & FLAG_RUNS);
+            opts.check = opts.check || (flags & FLAG_CHECK);
+            if ((flags & FLAG_RESETS) && opts.mem_limit == 0) {
+                opts.mem_limit = checkpoint->header.mem_limit;
+            }
+            // Streaming is up to each run, if the stream may have syncs at all.
+            uint16_t append_flags = encode_flags(&opts);
+            if ((append_flags & ~FLAG_SYNC) != (flags & ~FLAG_SYNC) || (append_flags & ~flags & FLAG_SYNC)) {
+                fprintf(stderr, "Error: options don't match the stream being appended to\n");
+                exit(1);
+            }
+        }
+        opts.checkpoint = checkpoint;
+    }
+
+    if (pipelined && (opts.flush_ms || opts.flush_bytes)) {
+        fprintf(stderr, "Error: --flush-ms and --flush-bytes can't be used with -p\n");
+        exit(1);
+    }
+    if (pipelined && opts.check) {
+        fprintf(stderr, "Error: -c can't be used with -p\n");
+        exit(1);
+    }
+    if (pipelined && append) {
+        fprintf(stderr, "Error: --append can't be used with -p\n");
+        exit(1);
+    }
+    if (verify && append) {
+        fprintf(stderr, "Error: --verify can't be used with --append\n");
+        exit(1);
+    }
+    if (pipelined && verify) {
+        fprintf(stderr, "Error: --verify can't be used with -p\n");
+        exit(1);
+    }
+    if (pipelined && opts.flexible) {
+        fprintf(stderr, "Error: -9 can't be used with -p\n");
+        exit(1);
+    }
+    if (opts.flexible && (opts.flush_ms || opts.flush_bytes)) {
+        fprintf(stderr, "Error: --flush-ms and --flush-bytes can't be used with -9\n");
+        exit(1);
+    }
+    if (opts.dedup && (pipelined || opts.flexible)) {
+        fprintf(stderr, "Error: --dedup can't be used with -p or -9\n");
+        exit(1);
+    }
+    if (opts.dedup && (opts.flush_ms || opts.flush_bytes)) {
+        fprintf(stderr, "Error: --flush-ms and --flush-bytes can't be used with --dedup\n");
+        exit(1);
+    }
+    if (opts.dedup && append) {
+        fprintf(stderr, "Error: --dedup can't be used with --append\n");
+        exit(1);
+    }
+
+    if (opts.lanes && (pipelined || opts.check || opts.flexible || opts.dedup || verify || append)) {
+        fprintf(stderr, "Error: -L and -t can't be used with -p, -c, -9, --dedup, --verify or --append\n");
+        exit(1);
+    }
+    if (opts.lanes && (opts.mem_limit || opts.flush_ms || opts.flush_bytes)) {
+        fprintf(stderr, "Error: --mem-limit, --flush-ms and --flush-bytes can't be used with -L or -t\n");
+        exit(1);
+    }
+
+    if ((opts.filter || auto_filter) && (append || opts.flush_ms || opts.flush_bytes)) {
+        fprintf(stderr, "Error: --filter can't be used with --append, --flush-ms or --flush-bytes\n");
+        exit(1);
+    }
+
+    if (solid && (pipelined || opts.lanes || opts.check || opts.dedup || opts.filter || auto_filter || append)) {
+        fprintf(stderr, "Error: --solid can't be used with -p, -L, -t, -c, --dedup, --filter or --append\n");
+        exit(1);
+    }
+    if (solid && (opts.flush_ms || opts.flush_bytes)) {
+        fprintf(stderr, "Error: --flush-ms and --flush-bytes can't be used with --solid\n");
+        exit(1);
+    }
+
+    // The root, the dictionary and at least one new phrase have to fit in the memory limit.
+    uint64_t min_limit = (uint64_t) (dict != NULL ? dict->count + 2 : 2) * sizeof(TrieNode);
+    if (opts.mem_limit && opts.mem_limit < min_limit) {
+        fprintf(stderr, "Error: memory limit must be at least %lu bytes\n", min_limit);
+        exit(1);
+    }
 
-    infile_header.magic = MAGIC;
+    // 2. The first thing in outfile must be the file header, as defined in the file io.h. The protection bit mask
+    // you will obtain using fstat(). See the man page on it for details.
     struct stat protection_bits;
     fstat(infile_descriptor, &protection_bits);
-    infile_header.protection = protection_bits.st_mode;
 
     // write_header(infile_descriptor, infile_header);
 
+    // A solid archive reads its files one after the other through a thread, and logs the resets of the
+    // dictionary for its file table. The archive itself is readable by everyone and writable by its owner.
+    SolidInput solid_input;
+    SolidTable *solid_table = NULL;
+    if (solid) {
+        solid_table = solid_table_create();
+        for (int k = optind; k < argc; k++) {
+            struct stat file_info;
+            if (stat(argv[k], &file_info) != 0 || !S_ISREG(file_info.st_mode)) {
+                fprintf(stderr, "Error: unable to open input file -- '%s'\n", argv[k]);
+                exit(1);
+            }
+            if (!solid_table_add(solid_table, argv[k], file_info.st_mode)) {
+                fprintf(stderr, "Error: archived files must be relative paths without '..' -- '%s'\n", argv[k]);
+                exit(1);
+            }
+        }
+        opts.resets = &solid_table->resets;
+        protection_bits.st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+        infile_descriptor = solid_input_start(&solid_input, solid_table);
+        if (infile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to start reading the input files\n");
+            exit(1);
+        }
+    }
+
+    // The encoder reads the input through a thread filtering it a block at a time. The first block is
+    // read here, to choose the filter from.
+    FilterInput filter_input;
+    bool filtered = opts.filter != FILTER_NONE || auto_filter;
+    if (filtered) {
+        uint8_t *head = (uint8_t *) malloc(FILTER_BLOCK);
+        int len = read_bytes(infile_descriptor, head, FILTER_BLOCK);
+        if (auto_filter) {
+            opts.filter = filter_choose(head, len, &opts);
+        }
+        infile_descriptor = filter_input_start(&filter_input, infile_descriptor, opts.filter, head, len);
+        free(head);
+        if (infile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to start filtering the input\n");
+            exit(1);
+        }
+    }
+
     // 3. Open outfile using open(). The permissions for outfile should match the protection bits as set in your
     // file header. Any errors with opening outfile should be handled like with infile. outfile should be
     // stdout if an output file wasn’t specified.
-    if (outfile_name != NULL) {
+    if (append) {
+        outfile_descriptor = open(outfile_name, O_RDWR | O_CREAT, 0600);
+        if (outfile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to open output file -- '%s'\n", outfile_name);
+            exit(1);
+        }
+    } else if (outfile_name != NULL) {
         outfile_descriptor = open(outfile_name, O_WRONLY | O_CREAT);
         if (outfile_descriptor == -1) {
             fprintf(stderr, "Error: unable to open output file -- '%s'\n", outfile_name);
             exit(1);
         }
     }
-    fchmod(outfile_descriptor, infile_header.protection);
 
     // struct stat infile_info;
     // fstat(infile_descriptor, &infile_info);
 
     // struct stat outfile_info;
     // fstat(outfile_descriptor, &outfile_info);
-    // 4. Write the filled out file header to outfile using write_header(). This means writing out the struct itself
-    // to the file, as described in the comment block of the function.
-    write_header(outfile_descriptor, &infile_header);
-
-    // 5. Create a trie. The trie initially has no children and consists solely of the root. The code stored by this root trie
-    // node should be EMPTY_CODE to denote the empty word. You will need to make a copy of the root node and
-    // use the copy to step through the trie to check for existing prefixes. This root node copy will be referred to as
-    // curr_node. The reason a copy is needed is that you will eventually need to reset whatever trie node you’ve
-    // stepped to back to the top of the trie, so using a copy lets you use the root node as a base to return to.
-    TrieNode *root = trie_create();
-    root->code = EMPTY_CODE;
-    TrieNode *curr_node;
-    curr_node = root;
-
-    // 6. You will need a monotonic counter to keep track of the next available code. This counter should start at
-    // START_CODE, as defined in the supplied code.h file. The counter should be a uint16_t since the codes
-    // used are unsigned 16-bit integers. This will be referred to as next_code.
-    uint16_t next_code = START_CODE;
-
-    // 7. You will also need two variables to keep track of the previous trie node and previously read symbol. We will
-    // refer to these as prev_node and prev_sym, respectively.
-    TrieNode *prev_node = NULL;
-    uint8_t prev_sym = 0;
-
-    // 8. Use read_sym() in a loop to read in all the symbols from infile. Your loop should break when read_sym()
-    // returns false. For each symbol read in, call it curr_sym, perform the following:
-    uint8_t curr_sym = 0;
-    while (read_sym(infile_descriptor, &curr_sym)) {
-        // (a) Set next_node to be trie_step(curr_node, curr_sym), stepping down from the current node to
-        // the currently read symbol.
-        TrieNode *next_node = trie_step(curr_node, curr_sym);
-
-        // (b) If next_node is not NULL, that means we have seen the current prefix. Set prev_node to be curr_node
-        // and then curr_node to be next_node.
-        if (next_node != NULL) {
-            prev_node = curr_node;
-            curr_node = next_node;
-        } else {
-            // (c) Else, since next_node is NULL, we know we have not encountered the current prefix. We write the pair
-            // (curr_node->code, curr_sym), where the bit-length of the written code is the bit-length of next_code.
-            write_pair(outfile_descriptor, curr_node->code, curr_sym, bit_len(next_code));
-            // We now add the current prefix to the trie. Let curr_node->children[curr_sym] be a new trie node
-            // whose code is next_code.
-            curr_node->children[curr_sym] = trie_node_create(next_code);
-            // Reset curr_node to point at the root of the trie and increment the value of next_code.
-            curr_node = root;
-            next_code++;
-
-            // (d) Check if next_code is equal to MAX_CODE. If it is, use trie_reset() to reset the trie to just having the
-            // root node. This reset is necessary since we have a finite number of codes.
-            if (next_code == MAX_CODE) {
-                trie_reset(root);
-                curr_node = root;
-                next_code = START_CODE;
-            }
+    // 4. Write the filled out file header to outfile with encode_header(). This means writing out the struct itself
+    // to the file, as described in the comment block of write_header(), and the fields following it.
+    // A stream being appended to already has its header, and is cut back to right before its STOP_CODE.
+    if (checkpoint != NULL && checkpoint->header.next_code != 0) {
+        FileHeader header;
+        uint32_t dict_id = 0;
+        struct stat outfile_info;
+        uint64_t stop_end = checkpoint->header.stop_bit + bit_len(checkpoint->header.next_code) + 8;
+        bool valid = read_header(outfile_descriptor, &header) && header.flags == checkpoint->header.flags
+                     && (!(header.flags & FLAG_DICT) || (read_u32(outfile_descriptor, &dict_id) && dict_id == dict->id))
+                     && fstat(outfile_descriptor, &outfile_info) == 0
+                     && (uint64_t) outfile_info.st_size == (stop_end + 7) / 8;
+        if (!valid) {
+            fprintf(stderr, "Error: checkpoint doesn't match the output file -- '%s'\n", checkpoint_name);
+            exit(1);
+        }
+        if (ftruncate(outfile_descriptor, checkpoint->header.stop_bit / 8) != 0) {
+            fprintf(stderr, "Error: unable to truncate output file -- '%s'\n", outfile_name);
+            exit(1);
+        }
+        lseek(outfile_descriptor, 0, SEEK_END);
+    } else {
+        if (checkpoint != NULL && lseek(outfile_descriptor, 0, SEEK_END) != 0) {
+            fprintf(stderr, "Error: no checkpoint to append to -- '%s'\n", checkpoint_name);
+            exit(1);
+        }
+        fchmod(outfile_descriptor, protection_bits.st_mode);
+        encode_header(outfile_descriptor, &opts, protection_bits.st_mode);
+        if (checkpoint != NULL) {
+            checkpoint->header.flags = encode_flags(&opts);
+            checkpoint->header.mem_limit = opts.mem_limit;
+            checkpoint->header.stop_bit = (uint64_t) lseek(outfile_descriptor, 0, SEEK_CUR) * 8;
         }
-
-        // (e) Update prev_sym to be curr_sym.
-        prev_sym = curr_sym;
     }
-    // 9. After processing all the characters in infile, check if curr_node points to the root trie node. If it does not,
-    // it means we were still matching a prefix. Write the pair (prev_node->code, prev_sym). The bit-length of the
-    // code written should be the bit-length of next_code. Make sure to increment next_code and that it stays
-    // within the limit of MAX_CODE. Hint: use the modulo operator.
-    if (curr_node != root) {
-        write_pair(outfile_descriptor, prev_node->code, prev_sym, bit_len(next_code));
-        next_code = (next_code + 1) % MAX_CODE;
+    if (verify) {
+        opts.verify = verifier_create(&opts);
+        if (opts.verify == NULL) {
+            fprintf(stderr, "Error: unable to start verifying\n");
+            exit(1);
+        }
     }
 
-    // 10. Write the pair (STOP_CODE, 0) to signal the end of compressed output. Again, the bit-length of code written
-    // should be the bit-length of next_code.
-    write_pair(outfile_descriptor, STOP_CODE, 0, bit_len(next_code));
-
-    // 11. Make sure to use flush_pairs() to flush any unwritten, buffered pairs. Remember, calls to write_pair()
-    // end up buffering them under the hood. So, we have to remember to flush the contents of our buffer.
-    flush_pairs(outfile_descriptor);
+    // 5. - 11. Encode the input, serially, in lanes of chunks, or with the reader, trie walk and packing on their
+    // own threads.
+    if (opts.lanes) {
+        encode_lanes(infile_descriptor, outfile_descriptor, &opts, threads ? threads : 1);
+    } else if (pipelined) {
+        encode_pipelined(infile_descriptor, outfile_descriptor, &opts);
+    } else {
+        Encoder *encoder = encoder_create();
+        encode_stream(encoder, infile_descriptor, outfile_descriptor, &opts);
+        encoder_delete(encoder);
+    }
+    if (filtered) {
+        filter_input_finish(&filter_input);
+    }
+    // The file table goes right after the stream, which ends in a whole byte.
+    if (solid) {
+        if (!solid_input_finish(&solid_input)) {
+            fprintf(stderr, "Error: unable to read input file -- '%s'\n", solid_input.failed);
+            exit(1);
+        }
+        uint64_t offset = solid_stream_start(encode_flags(&opts)) + (total_bits + 7) / 8;
+        solid_write_table(outfile_descriptor, solid_table, offset);
+    }
+    if (checkpoint != NULL) {
+        if (!checkpoint_write(checkpoint, checkpoint_name)) {
+            fprintf(stderr, "Error: unable to write checkpoint -- '%s'\n", checkpoint_name);
+            exit(1);
+        }
+        checkpoint_delete(checkpoint);
+    }
+    if (verify) {
+        char error[256];
+        if (!verifier_finish(opts.verify, error, sizeof(error))) {
+            fprintf(stderr, "Error: verification failed -- %s\n", error);
+            exit(1);
+        }
+    }
 
     if (verbose) {
         // Compressed file size: 25 bytes
@@ -191,10 +502,17 @@ int main(int argc, char **argv) {
                   - ((double) (total_bits / 8 + (total_bits % 8 ? 1 : 0) + sizeof(FileHeader))
                       / (double) total_syms));
         printf("Space saving: %.2f%%\n", compression_percentage);
+        if (opts.filter != FILTER_NONE) {
+            printf("Filter: %s\n", filter_name(opts.filter));
+        }
+        if (solid) {
+            printf("Files: %u, dictionary resets: %u\n", solid_table->count, solid_table->resets.count);
+        }
     }
 
     // 12. Use close() to close infile and outfile.
-    trie_delete(root);
+    solid_table_delete(solid_table);
+    dict_close(dict);
     close(infile_descriptor);
     close(outfile_descriptor);
     // return 0;
@@ -0,0 +1,1024 @@
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chain.h"
+#include "checkpoint.h"
+#include "chunk.h"
+#include "code.h"
+#include "crc.h"
+#include "dict.h"
+#include "encoder.h"
+#include "io.h"
+#include "run.h"
+#include "trie.h"
+#include "verify.h"
+
+#define FLEX_SEGMENT (1 << 23) // Most input encode_flexible parses both ways before choosing one.
+#define FLEX_AHEAD  (1 << 18) // Input kept ahead of the parse: two phrases of up to MAX_CODE symbols and then some.
+#define FLEX_WINDOW (FLEX_SEGMENT + FLEX_AHEAD) // Input held in memory by encode_flexible.
+#define FLEX_SPLITS 4 // How much shorter than the longest match the prefixes tried by encode_flexible get.
+#define DUP_MIN 64 // Shortest chunk encoded as a CTRL_DUP block: shorter ones cost less as pairs.
+
+// the trie walk state carried from one width phase to the next
+typedef struct EncodeState {
+    int infile;
+    BitWriter *bw;
+    TrieNode *root;
+    TrieJump *jump; // The nodes two levels below root, kept up to date as the trie grows.
+    Dict *dict;
+    TrieNode *curr_node;
+    TrieNode *prev_node;
+    uint8_t prev_sym;
+    // The trie as chains, walked instead of root when not NULL. The walk is then at node depth of chain.
+    ChainTrie *chains;
+    uint32_t chain;
+    uint32_t depth;
+    uint16_t next_code;
+    bool runs; // Encode runs of one symbol as CTRL_RUN blocks.
+    uint64_t mem_limit; // Reset once trie_bytes reaches this, if not 0.
+
+    // streaming: sync whenever the input goes quiet or a flush limit is reached
+    bool stream;
+    int flush_ms;
+    uint64_t flush_bytes;
+    uint64_t synced_syms; // total_syms at the last sync.
+    int64_t pending_since; // When input first arrived after the last sync, in milliseconds.
+
+    uint64_t check_at; // total_syms once the next CTRL_CHECK block is due. UINT64_MAX without checks.
+    Verifier *verify; // Handed every symbol consumed. NULL without --verify.
+
+    // deduplication: the input is cut into chunks, and only the ones not seen before are walked
+    ChunkIndex *chunks; // NULL without dedup.
+    uint64_t start_syms; // total_syms at the start of the stream, which CTRL_DUP offsets count from.
+    uint64_t chunk_end; // total_syms at the end of the chunk being walked. UINT64_MAX without dedup.
+
+    ResetLog *resets; // NULL if resets aren't logged.
+    uint64_t start_bits; // total_bits at the first pair of the stream, which reset offsets count from.
+} EncodeState;
+
+// Returns true between phrases, when the walk is at the root.
+static inline bool encode_at_root(const EncodeState *s) {
+    return s->chains != NULL ? s->chain == 0 : s->curr_node == s->root;
+}
+
+// Like peek_syms, but ends the symbols at the end of the chunk being walked.
+static inline int encode_peek(EncodeState *s, uint8_t **syms) {
+    int n = peek_syms(s->infile, syms);
+    if (total_syms + (uint64_t) n > s->chunk_end) {
+        n = (int) (s->chunk_end - total_syms);
+    }
+    return n;
+}
+
+// Returns true if the first RUN_MIN of the n symbols of syms are all the same. Only buffered symbols
+// are passed in, so that it never waits for input.
+static inline bool run_ahead(const uint8_t *syms, int n) {
+    return n >= RUN_MIN && syms[0] == syms[1] && syms[0] == syms[RUN_MIN - 1]
+           && run_length(syms, RUN_MIN) == RUN_MIN;
+}
+
+// Writes a run of count copies of sym as CTRL_RUN blocks.
+static void encode_run_blocks(EncodeState *s, uint8_t sym, uint64_t count) {
+    int bitlen = bit_len(s->next_code);
+    while (count > 0) {
+        uint32_t len = count > UINT32_MAX ? UINT32_MAX : (uint32_t) count;
+        bw_pair(s->bw, STOP_CODE, CTRL_RUN, bitlen);
+        bw_bits(s->bw, sym, 8);
+        bw_bits(s->bw, len, 32);
+        total_bits += bitlen + 8 + 8 + 32;
+        count -= len;
+    }
+}
+
+// If a run of at least RUN_MIN copies of one symbol is next in s->infile, consume all of it and
+// write it out as CTRL_RUN blocks. Must only be called between phrases, when the walk is at the
+// root. The trie and next_code are left untouched. A run of zeros takes in the holes of the input it
+// reaches without reading them, unless every symbol has to be checksummed, verified or chunked.
+static void encode_run(EncodeState *s) {
+    if (!encode_at_root(s) || buffered_syms() < RUN_MIN) {
+        return;
+    }
+    uint8_t *syms;
+    int n = encode_peek(s, &syms);
+    if (!run_ahead(syms, n)) {
+        return;
+    }
+    uint8_t sym = syms[0];
+    uint64_t count = 0;
+    bool holes = sym == 0 && s->check_at == UINT64_MAX && s->verify == NULL && s->chunks == NULL;
+    // the run may carry on past the buffered symbols
+    while (n > 0 && syms[0] == sym) {
+        uint32_t len = run_length(syms, n);
+        if (s->verify != NULL) {
+            verify_input(s->verify, syms, len);
+        }
+        skip_syms(len);
+        count += len;
+        // while streaming, don't wait for the rest of the run
+        if (len < (uint32_t) n || s->stream) {
+            break;
+        }
+        if (holes) {
+            count += skip_hole(s->infile);
+        }
+        n = encode_peek(s, &syms);
+    }
+    encode_run_blocks(s, sym, count);
+}
+
+// Encode symbols from s->infile until next_code reaches the first code that needs more than bitlen
+// bits, or the input runs out. Every pair of the phase is written with the same bitlen, which is a
+// compile-time constant in each of the encode_phase_N instances below. Returns false at the end of
+// the input. With s->runs set the phase also ends, between phrases, when a run is next in the input,
+// and with s->mem_limit set when the trie has grown to the limit, or between phrases once a CTRL_CHECK
+// block is due. With s->stream set it also ends
+// whenever the buffered input runs out, so that encode_wait can sync before waiting for more, and with
+// dedup at the end of the chunk, even in the middle of a phrase.
+static inline __attribute__((always_inline)) bool encode_phase(EncodeState *s, int bitlen) {
+    TrieNode *root = s->root;
+    TrieNode *curr_node = s->curr_node;
+    TrieNode *prev_node = s->prev_node;
+    uint8_t prev_sym = s->prev_sym;
+    uint16_t next_code = s->next_code;
+    uint16_t phase_end = bitlen == 16 ? MAX_CODE : (uint16_t) (1 << bitlen);
+    uint64_t pairs = 0;
+    bool more = true;
+
+    // Walk the buffered input a span at a time: syms[i] is the next symbol and syms[n] the end of the
+    // span. The symbols walked are only handed back to the buffer with skip_syms, which also counts
+    // them, once the span runs out or the phase ends.
+    uint8_t *syms = NULL;
+    int n = s->stream && buffered_syms() == 0 ? 0 : encode_peek(s, &syms);
+    int i = 0;
+
+    // For each symbol read in, call it curr_sym, perform the following:
+    uint8_t curr_sym = 0;
+    while (next_code != phase_end) {
+        if (i == n) {
+            if (s->verify != NULL) {
+                verify_input(s->verify, syms, i);
+            }
+            skip_syms(i);
+            i = 0;
+            if (s->stream) {
+                n = 0;
+                break;
+            }
+            n = encode_peek(s, &syms);
+            if (n == 0) {
+                more = total_syms == s->chunk_end;
+                break;
+            }
+        }
+        curr_sym = syms[i];
+        i += 1;
+        // (a) Set next_node to be trie_step(curr_node, curr_sym), stepping down from the current node to
+        // the currently read symbol.
+        TrieNode *next_node = curr_node->children[curr_sym];
+
+        // (b) If next_node is not NULL, that means we have seen the current prefix. Set prev_node to be curr_node
+        // and then curr_node to be next_node.
+        if (next_node != NULL) {
+            prev_node = curr_node;
+            curr_node = next_node;
+        } else {
+            // (c) Else, since next_node is NULL, we know we have not encountered the current prefix. We write the pair
+            // (curr_node->code, curr_sym), where the bit-length of the written code is the bit-length of next_code.
+            bw_pair(s->bw, curr_node->code, curr_sym, bitlen);
+            pairs += 1;
+            // We now add the current prefix to the trie. Let curr_node->children[curr_sym] be a new trie node
+            // whose code is next_code. A node two levels below the root also goes into the jump table.
+            TrieNode *child = trie_node_create(next_code);
+            curr_node->children[curr_sym] = child;
+            if (prev_node == root && curr_node != root) {
+                s->jump[prev_sym << 8 | curr_sym] = child;
+            }
+            // Reset curr_node to point at the root of the trie and increment the value of next_code.
+            curr_node = root;
+            next_code++;
+            if (next_code != phase_end) {
+                if (s->mem_limit && trie_bytes >= s->mem_limit) {
+                    prev_sym = curr_sym;
+                    break;
+                }
+                if (total_syms + (uint64_t) i >= s->check_at) {
+                    prev_sym = curr_sym;
+                    break;
+                }
+                if (s->runs && run_ahead(syms + i, n - i)) {
+                    prev_sym = curr_sym;
+                    break;
+                }
+                // Start the next phrase with a single lookup in the jump table when its first two
+                // symbols are already known to the trie.
+                if (n - i >= 2) {
+                    TrieNode *node = s->jump[syms[i] << 8 | syms[i + 1]];
+                    if (node != NULL) {
+                        prev_node = root->children[syms[i]];
+                        curr_node = node;
+                        prev_sym = syms[i + 1];
+                        i += 2;
+                        continue;
+                    }
+                }
+            }
+        }
+
+        // (e) Update prev_sym to be curr_sym.
+        prev_sym = curr_sym;
+    }
+    if (s->verify != NULL) {
+        verify_input(s->verify, syms, i);
+    }
+    skip_syms(i);
+
+    total_bits += pairs * (bitlen + 8);
+    s->curr_node = curr_node;
+    s->prev_node = prev_node;
+    s->prev_sym = prev_sym;
+    s->next_code = next_code;
+    return more;
+}
+
+// The same as encode_phase, writing the same pairs, but walking s->chains. Along a chain the input is
+// compared against the symbols of its nodes as many at a time as the span has, and only at the end of
+// a chain is the next node looked up.
+static inline __attribute__((always_inline)) bool encode_chain_phase(EncodeState *s, int bitlen) {
+    ChainTrie *t = s->chains;
+    uint32_t chain = s->chain;
+    uint32_t depth = s->depth;
+    uint16_t next_code = s->next_code;
+    uint16_t phase_end = bitlen == 16 ? MAX_CODE : (uint16_t) (1 << bitlen);
+    uint64_t pairs = 0;
+    bool more = true;
+
+    uint8_t *syms = NULL;
+    int n = s->stream && buffered_syms() == 0 ? 0 : encode_peek(s, &syms);
+    int i = 0;
+
+    while (next_code != phase_end) {
+        if (i == n) {
+            if (s->verify != NULL) {
+                verify_input(s->verify, syms, i);
+            }
+            skip_syms(i);
+            i = 0;
+            if (s->stream) {
+                n = 0;
+                break;
+            }
+            n = encode_peek(s, &syms);
+            if (n == 0) {
+                more = total_syms == s->chunk_end;
+                break;
+            }
+        }
+        Chain *ch = &t->chains[chain];
+        uint32_t below = ch->len - 1 - depth; // nodes of the chain after the current one
+        if (below > 0) {
+            uint32_t span = (uint32_t) (n - i) < below ? (uint32_t) (n - i) : below;
+            uint32_t len = common_prefix(syms + i, ch->syms + depth + 1, span);
+            i += len;
+            depth += len;
+            if (len == span) {
+                continue;
+            }
+        } else if (ch->forks) {
+            uint32_t next = chain_trie_child(t, ch->codes[depth], syms[i]);
+            if (next != 0) {
+                chain = next;
+                depth = 0;
+                i += 1;
+                continue;
+            }
+        }
+
+        // The current node has no child for syms[i]: write the pair and add the child.
+        uint8_t curr_sym = syms[i];
+        i += 1;
+        bw_pair(s->bw, ch->codes[depth], curr_sym, bitlen);
+        pairs += 1;
+        chain_trie_add(t, chain, depth, curr_sym, next_code);
+        chain = 0;
+        depth = 0;
+        next_code++;
+        if (next_code != phase_end) {
+            if (total_syms + (uint64_t) i >= s->check_at) {
+                break;
+            }
+            if (s->runs && run_ahead(syms + i, n - i)) {
+                break;
+            }
+        }
+    }
+    if (s->verify != NULL) {
+        verify_input(s->verify, syms, i);
+    }
+    skip_syms(i);
+
+    total_bits += pairs * (bitlen + 8);
+    s->chain = chain;
+    s->depth = depth;
+    s->next_code = next_code;
+    return more;
+}
+
+#define ENCODE_PHASE(N)                                                                            \
+    static bool encode_phase_##N(EncodeState *s) {                                                 \
+        return encode_phase(s, N);                                                                 \
+    }                                                                                              \
+    static bool encode_chain_phase_##N(EncodeState *s) {                                           \
+        return encode_chain_phase(s, N);                                                           \
+    }
+ENCODE_PHASE(2)
+ENCODE_PHASE(3)
+ENCODE_PHASE(4)
+ENCODE_PHASE(5)
+ENCODE_PHASE(6)
+ENCODE_PHASE(7)
+ENCODE_PHASE(8)
+ENCODE_PHASE(9)
+ENCODE_PHASE(10)
+ENCODE_PHASE(11)
+ENCODE_PHASE(12)
+ENCODE_PHASE(13)
+ENCODE_PHASE(14)
+ENCODE_PHASE(15)
+ENCODE_PHASE(16)
+
+// encode_phases[n] encodes the phase whose codes are n bits long
+static bool (*const encode_phases[])(EncodeState *) = {
+    NULL,
+    NULL,
+    encode_phase_2,
+    encode_phase_3,
+    encode_phase_4,
+    encode_phase_5,
+    encode_phase_6,
+    encode_phase_7,
+    encode_phase_8,
+    encode_phase_9,
+    encode_phase_10,
+    encode_phase_11,
+    encode_phase_12,
+    encode_phase_13,
+    encode_phase_14,
+    encode_phase_15,
+    encode_phase_16,
+};
+
+// encode_chain_phases[n] does the same walking the chains
+static bool (*const encode_chain_phases[])(EncodeState *) = {
+    NULL,
+    NULL,
+    encode_chain_phase_2,
+    encode_chain_phase_3,
+    encode_chain_phase_4,
+    encode_chain_phase_5,
+    encode_chain_phase_6,
+    encode_chain_phase_7,
+    encode_chain_phase_8,
+    encode_chain_phase_9,
+    encode_chain_phase_10,
+    encode_chain_phase_11,
+    encode_chain_phase_12,
+    encode_chain_phase_13,
+    encode_chain_phase_14,
+    encode_chain_phase_15,
+    encode_chain_phase_16,
+};
+
+// Empty the trie and go back to the first code, reloading the dictionary if there is one.
+static void encode_reset(EncodeState *s) {
+    if (s->chains != NULL) {
+        chain_trie_reset(s->chains);
+        s->chain = 0;
+        s->depth = 0;
+    } else {
+        trie_reset(s->root);
+        trie_jump_reset(s->jump);
+        s->curr_node = s->root;
+    }
+    s->next_code = START_CODE;
+    if (s->dict != NULL) {
+        if (s->chains != NULL) {
+            dict_load_chains(s->dict, s->chains);
+        } else {
+            dict_load_trie(s->dict, s->root, s->jump);
+        }
+        s->next_code = dict_next_code(s->dict);
+    }
+    if (s->resets != NULL) {
+        ResetLog *log = s->resets;
+        if (log->count == log->cap) {
+            log->cap = log->cap ? 2 * log->cap : 16;
+            log->resets = (Reset *) realloc(log->resets, log->cap * sizeof(Reset));
+        }
+        log->resets[log->count++] = (Reset) { .bit = total_bits - s->start_bits, .sym = total_syms - s->start_syms };
+    }
+}
+
+// Write a phrase that is still being matched as a pair of its own, like at the end of the input. The
+// decoder adds that pair to its table under next_code, which the encoder just skips since the phrase
+// already has a code in the trie.
+static void encode_pending(EncodeState *s) {
+    if (!encode_at_root(s)) {
+        uint16_t code = 0;
+        uint8_t sym = 0;
+        if (s->chains != NULL) {
+            chain_trie_pair(s->chains, s->chain, s->depth, &code, &sym);
+        } else {
+            code = s->prev_node->code;
+            sym = s->prev_sym;
+        }
+        bw_pair(s->bw, code, sym, bit_len(s->next_code));
+        total_bits += bit_len(s->next_code) + 8;
+        s->curr_node = s->root;
+        s->chain = 0;
+        s->depth = 0;
+        s->next_code += 1;
+        if (s->next_code == MAX_CODE) {
+            encode_reset(s);
+        }
+    }
+}
+
+// Write out everything encoded so far, ending with a CTRL_SYNC pair padded to a byte boundary, after
+// any phrase still being matched.
+static void encode_sync(EncodeState *s) {
+    encode_pending(s);
+    bw_pair(s->bw, STOP_CODE, CTRL_SYNC, bit_len(s->next_code));
+    total_bits += bit_len(s->next_code) + 8;
+    total_bits += (8 - total_bits % 8) % 8;
+    bw_flush(s->bw);
+    s->synced_syms = total_syms;
+}
+
+// Write a CTRL_CHECK block with the checksums of the symbols read and the bytes written since the last
+// one, syms_crc being the checksum of the symbols. Only called between phrases, so that the decoder has
+// written the same symbols when it reads it.
+static void encode_check(EncodeState *s, uint32_t syms_crc) {
+    bw_pair(s->bw, STOP_CODE, CTRL_CHECK, bit_len(s->next_code));
+    total_bits += bit_len(s->next_code) + 8;
+    total_bits += (8 - total_bits % 8) % 8;
+    uint32_t pairs_crc = bw_check(s->bw);
+    bw_bits(s->bw, syms_crc, 32);
+    bw_bits(s->bw, pairs_crc, 32);
+    total_bits += 32 + 32;
+    s->check_at = total_syms + CHECK_BLOCK;
+}
+
+// Cut the next chunk off the input. Chunks seen before are written as CTRL_DUP blocks and skipped,
+// until one that is new comes up, which is left for the trie walk to encode, up to s->chunk_end.
+// Returns false at the end of the input.
+static bool encode_chunk(EncodeState *s) {
+    for (;;) {
+        uint8_t *syms;
+        int n = peek_ahead(s->infile, &syms, CHUNK_MAX);
+        if (n == 0) {
+            return false;
+        }
+        uint32_t len = chunk_length(syms, n);
+        uint64_t offset = total_syms - s->start_syms;
+        const ChunkEntry *seen = NULL;
+        if (len >= DUP_MIN) {
+            seen = chunk_index_find(s->chunks, chunk_fingerprint(syms, len), len, offset);
+        }
+        if (seen == NULL) {
+            s->chunk_end = total_syms + len;
+            return true;
+        }
+
+        // The copy has to start between phrases.
+        encode_pending(s);
+        int bitlen = bit_len(s->next_code);
+        bw_pair(s->bw, STOP_CODE, CTRL_DUP, bitlen);
+        bw_bits(s->bw, (uint32_t) seen->offset, 32);
+        bw_bits(s->bw, (uint32_t) (seen->offset >> 32), 32);
+        bw_bits(s->bw, len, 32);
+        total_bits += bitlen + 8 + 32 + 32 + 32;
+        if (s->verify != NULL) {
+            verify_input(s->verify, syms, len);
+        }
+        skip_syms(len);
+        if (total_syms >= s->check_at) {
+            encode_check(s, syms_check());
+        }
+    }
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Called while streaming whenever the buffered input runs out. Syncs if a flush limit has been
+// reached, or if the input stays quiet past the flush deadline, then waits for more input. Returns
+// false at the end of the input.
+static bool encode_wait(EncodeState *s) {
+    if (total_syms > s->synced_syms) {
+        bool due = s->flush_bytes && total_syms - s->synced_syms >= s->flush_bytes;
+        int timeout = -1;
+        if (s->flush_ms) {
+            int64_t left = s->pending_since + s->flush_ms - now_ms();
+            timeout = left > 0 ? (int) left : 0;
+        }
+        if (!due) {
+            struct pollfd pfd = { .fd = s->infile, .events = POLLIN, .revents = 0 };
+            due = poll(&pfd, 1, timeout) == 0;
+        }
+        if (due) {
+            encode_sync(s);
+        }
+    }
+    uint8_t *syms;
+    if (peek_syms(s->infile, &syms) == 0) {
+        return false;
+    }
+    if (total_syms == s->synced_syms) {
+        s->pending_since = now_ms();
+    }
+    return true;
+}
+
+// Returns how many of the n symbols of syms the trie matches from root.
+static inline int match_length(TrieNode *root, const uint8_t *syms, int n) {
+    TrieNode *node = root;
+    int len = 0;
+    while (len < n && (node = node->children[syms[len]]) != NULL) {
+        len += 1;
+    }
+    return len;
+}
+
+// a step of a parse by flex_parse: a pair, or a run of len copies of sym
+typedef struct FlexItem {
+    uint32_t len; // Symbols it covers.
+    uint16_t code;
+    uint8_t sym;
+    bool run;
+} FlexItem;
+
+// a trie node added by flex_parse, for flex_undo to take out again
+typedef struct FlexNode {
+    TrieNode *parent;
+    uint8_t sym;
+    int32_t jump; // Its index in the jump table, or -1 if it isn't in it.
+} FlexNode;
+
+// the parse of a segment of the input, and what it changed in the trie
+typedef struct FlexParse {
+    FlexItem *items;
+    uint32_t count;
+    FlexNode *nodes;
+    uint32_t added;
+    uint32_t *words; // Words whose bit in declined the parse set.
+    uint32_t declines;
+    TrieNode **spare; // Nodes flex_undo took out, for the next parse to reuse rather than allocate.
+    uint32_t spares;
+    uint64_t bits; // Bits the items take, without CTRL_CHECK blocks.
+} FlexParse;
+
+// Returns a new node with code, reusing a spare one if there is one.
+static TrieNode *flex_node(FlexParse *f, uint16_t code) {
+    if (f->spares == 0) {
+        return trie_node_create(code);
+    }
+    TrieNode *n = f->spare[--f->spares];
+    memset(n->children, 0, sizeof(n->children));
+    n->code = code;
+    trie_bytes += sizeof(TrieNode);
+    return n;
+}
+
+// Parses syms from pos, growing the trie as it goes, until the parse passes limit, next_code reaches
+// MAX_CODE or the trie reaches the memory limit, and returns where it stopped. Only the n symbols up to
+// len are matched against. Nothing is written: the items of the parse are left in f.
+//
+// Without flexible every pair takes the longest match, as the greedy walk does. With it a pair may
+// instead take a shorter prefix of it, whichever lets the pair and the longest match after it cover
+// the most input, but only once for each word the greedy pair would have added, as marked in declined:
+// taken every time the same input comes round, the dictionary would never learn the word. Such a pair
+// adds a word the dictionary already has, so its code is spent without adding a trie node, just as
+// the decoder's table gets a second copy of the word.
+static int flex_parse(EncodeState *s, FlexParse *f, TrieNode **path, uint8_t *declined, const uint8_t *syms,
+    int pos, int limit, int len, bool flexible) {
+    uint16_t next_code = s->next_code;
+    f->count = 0;
+    f->added = 0;
+    f->declines = 0;
+    f->bits = 0;
+    while (pos < limit) {
+        FlexItem *item = &f->items[f->count++];
+        // The longest match, and the longest prefix of it that leaves a symbol to end the pair.
+        int m = 0;
+        path[0] = s->root;
+        while (pos + m < len && path[m]->children[syms[pos + m]] != NULL) {
+            path[m + 1] = path[m]->children[syms[pos + m]];
+            m += 1;
+        }
+        int last = pos + m < len ? m : m - 1;
+
+        // A run the greedy pair covers all of is cheaper as that pair than as a CTRL_RUN block.
+        if (s->runs && run_ahead(syms + pos, len - pos)) {
+            uint32_t count = run_length(syms + pos, len - pos);
+            if (count > (uint32_t) last + 1) {
+                *item = (FlexItem) { .len = count, .code = STOP_CODE, .sym = syms[pos], .run = true };
+                f->bits += bit_len(next_code) + 8 + 8 + 32;
+                pos += count;
+                continue;
+            }
+        }
+        int best = last;
+        uint32_t word = last == m ? (uint32_t) path[m]->code << 8 | syms[pos + m] : 0;
+        if (flexible && last == m && !(declined[word >> 3] & (1 << (word & 7)))) {
+            int next = pos + last + 1;
+            int best_reach = last + 1 + match_length(s->root, syms + next, len - next);
+            for (int l = last - 1; l >= 0 && l >= last - FLEX_SPLITS; l--) {
+                next = pos + l + 1;
+                int reach = l + 1 + match_length(s->root, syms + next, len - next);
+                if (reach > best_reach) {
+                    best = l;
+                    best_reach = reach;
+                }
+            }
+            if (best != last) {
+                declined[word >> 3] |= 1 << (word & 7);
+                f->words[f->declines++] = word;
+            }
+        }
+
+        uint8_t sym = syms[pos + best];
+        *item = (FlexItem) { .len = (uint32_t) best + 1, .code = path[best]->code, .sym = sym, .run = false };
+        f->bits += bit_len(next_code) + 8;
+        if (best == m) {
+            TrieNode *child = flex_node(f, next_code);
+            path[m]->children[sym] = child;
+            int32_t jump = -1;
+            if (m == 1) {
+                jump = syms[pos] << 8 | sym;
+                s->jump[jump] = child;
+            }
+            f->nodes[f->added++] = (FlexNode) { .parent = path[m], .sym = sym, .jump = jump };
+        }
+        next_code += 1;
+        pos += best + 1;
+        if (next_code == MAX_CODE || (s->mem_limit && trie_bytes >= s->mem_limit)) {
+            break;
+        }
+    }
+    return pos;
+}
+
+// Takes the trie and declined back to how they were before the parse in f, keeping its nodes as spares.
+static void flex_undo(EncodeState *s, FlexParse *f, uint8_t *declined) {
+    for (uint32_t k = f->added; k-- > 0;) {
+        const FlexNode *n = &f->nodes[k];
+        TrieNode *child = n->parent->children[n->sym];
+        n->parent->children[n->sym] = NULL;
+        if (n->jump >= 0) {
+            s->jump[n->jump] = NULL;
+        }
+        trie_bytes -= sizeof(TrieNode);
+        f->spare[f->spares++] = child;
+    }
+    for (uint32_t k = 0; k < f->declines; k++) {
+        declined[f->words[k] >> 3] &= ~(1 << (f->words[k] & 7));
+    }
+}
+
+// Encode all of s->infile with flexible parsing, for encode -9. Flexible parsing isn't always smaller
+// than the greedy walk, which teaches the dictionary longer words, so the input is cut into segments,
+// each a dictionary's worth of codes unless FLEX_SEGMENT symbols come first. Every segment is parsed
+// both ways from the same trie, and the one with fewer bits for each symbol it covers is written out.
+// The output is a plain pair stream either way.
+//
+// The input is read into a window that keeps FLEX_AHEAD symbols past the segment, enough for the two
+// phrases compared at its end, rather than through the symbol buffer.
+static void encode_flexible(EncodeState *s) {
+    uint8_t *syms = (uint8_t *) malloc(FLEX_WINDOW);
+    TrieNode **path = (TrieNode **) malloc((MAX_CODE + 1) * sizeof(TrieNode *)); // path[l] matches l symbols.
+    // bit (code << 8 | sym) set once a shorter pair was taken instead of adding that word
+    uint8_t *declined = (uint8_t *) calloc(MAX_CODE * ALPHABET / 8, 1);
+    // A segment has at most a pair for each code and a run for every RUN_MIN symbols.
+    FlexParse f = {
+        .items = (FlexItem *) malloc((MAX_CODE + FLEX_SEGMENT / RUN_MIN + 1) * sizeof(FlexItem)),
+        .nodes = (FlexNode *) malloc(MAX_CODE * sizeof(FlexNode)),
+        .words = (uint32_t *) malloc(MAX_CODE * sizeof(uint32_t)),
+        .spare = (TrieNode **) malloc(MAX_CODE * sizeof(TrieNode *)),
+        .spares = 0,
+    };
+    int len = 0;
+    int pos = 0;
+    bool eof = false;
+    bool check = s->check_at != UINT64_MAX;
+    uint32_t crc = 0; // Of the symbols encoded before syms[checked] since the last CTRL_CHECK block.
+    int checked = 0;
+
+    for (;;) {
+        if (!eof) {
+            if (check) {
+                crc = crc32c(crc, syms + checked, pos - checked);
+                checked = 0;
+            }
+            memmove(syms, syms + pos, len - pos);
+            len -= pos;
+            pos = 0;
+            int got = read_bytes(s->infile, syms + len, FLEX_WINDOW - len);
+            eof = got < FLEX_WINDOW - len;
+            len += got;
+        }
+        if (pos == len) {
+            break;
+        }
+
+        // Parse the segment greedily, then flexibly, and go back to the greedy parse unless the flexible
+        // one takes fewer bits for each symbol.
+        int limit = eof ? len : len - FLEX_AHEAD;
+        int greedy_end = flex_parse(s, &f, path, declined, syms, pos, limit, len, false);
+        uint64_t greedy_bits = f.bits;
+        flex_undo(s, &f, declined);
+        int end = flex_parse(s, &f, path, declined, syms, pos, limit, len, true);
+        if (f.bits * (uint64_t) (greedy_end - pos) >= greedy_bits * (uint64_t) (end - pos)) {
+            flex_undo(s, &f, declined);
+            flex_parse(s, &f, path, declined, syms, pos, limit, len, false);
+        }
+
+        for (uint32_t k = 0; k < f.count; k++) {
+            const FlexItem *item = &f.items[k];
+            if (item->run) {
+                encode_run_blocks(s, item->sym, item->len);
+            } else {
+                bw_pair(s->bw, item->code, item->sym, bit_len(s->next_code));
+                total_bits += bit_len(s->next_code) + 8;
+                s->next_code += 1;
+            }
+            if (s->verify != NULL) {
+                verify_input(s->verify, syms + pos, item->len);
+            }
+            pos += item->len;
+            total_syms += item->len;
+            if (total_syms >= s->check_at) {
+                crc = crc32c(crc, syms + checked, pos - checked);
+                checked = pos;
+                encode_check(s, crc);
+                crc = 0;
+            }
+        }
+
+        bool full = s->mem_limit && trie_bytes >= s->mem_limit;
+        if (full && s->next_code != MAX_CODE) {
+            bw_pair(s->bw, STOP_CODE, CTRL_RESET, bit_len(s->next_code));
+            total_bits += bit_len(s->next_code) + 8;
+        }
+        if (s->next_code == MAX_CODE || full) {
+            encode_reset(s);
+            memset(declined, 0, MAX_CODE * ALPHABET / 8);
+        }
+    }
+
+    // The last CTRL_CHECK block covers everything up to STOP_CODE.
+    if (check) {
+        encode_check(s, crc32c(crc, syms + checked, pos - checked));
+    }
+    while (f.spares > 0) {
+        free(f.spare[--f.spares]);
+    }
+    free(f.spare);
+    free(f.words);
+    free(f.nodes);
+    free(f.items);
+    free(declined);
+    free(path);
+    free(syms);
+}
+
+Encoder *encoder_create(void) {
+    Encoder *e = (Encoder *) malloc(sizeof(Encoder));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->root = trie_create();
+    e->jump = trie_jump_create();
+    e->chains = chain_trie_create();
+    return e;
+}
+
+void encoder_delete(Encoder *e) {
+    if (e == NULL) {
+        return;
+    }
+    chain_trie_delete(e->chains);
+    trie_jump_delete(e->jump);
+    trie_delete(e->root);
+    free(e);
+}
+
+uint16_t encode_flags(const EncodeOptions *opts) {
+    uint16_t flags = 0;
+    if (opts->runs) {
+        flags |= FLAG_RUNS;
+    }
+    if (opts->mem_limit || opts->lanes) {
+        flags |= FLAG_RESETS;
+    }
+    if (opts->flush_ms || opts->flush_bytes) {
+        flags |= FLAG_SYNC;
+    }
+    if (opts->dict != NULL) {
+        flags |= FLAG_DICT;
+    }
+    if (opts->check) {
+        flags |= FLAG_CHECK;
+    }
+    if (opts->dedup) {
+        flags |= FLAG_DEDUP;
+    }
+    if (opts->filter) {
+        flags |= FLAG_FILTER;
+    }
+    if (opts->resets != NULL) {
+        flags |= FLAG_SOLID;
+    }
+    return flags;
+}
+
+void encode_header(int outfile, const EncodeOptions *opts, uint16_t protection) {
+    // The first thing in outfile must be the file header, as defined in the file io.h. Streams using any
+    // extension get the MAGIC_EXT magic number and flag it in the header.
+    FileHeader header;
+    header.protection = protection;
+    header.flags = encode_flags(opts);
+    header.magic = header.flags ? MAGIC_EXT : MAGIC;
+    write_header(outfile, &header);
+    if (opts->dict != NULL) {
+        write_u32(outfile, opts->dict->id);
+    }
+    if (opts->filter) {
+        write_u32(outfile, opts->filter);
+    }
+}
+
+void encode_stream(Encoder *e, int infile, int outfile, const EncodeOptions *opts) {
+    Dict *dict = opts->dict;
+    reset_syms();
+    // 5. Start from the encoder's empty trie. The code stored by the root trie node is EMPTY_CODE to denote the
+    // empty word. curr_node is used to step through the trie to check for existing prefixes, so that the root
+    // stays a base to return to.
+    TrieNode *root = e->root;
+    TrieNode *curr_node;
+    curr_node = root;
+    TrieJump *jump = e->jump;
+    Checkpoint *cp = opts->checkpoint;
+    bool resume = cp != NULL && cp->header.next_code != 0;
+    // The trie is walked as chains, but where its nodes are needed as nodes: a checkpoint saves them,
+    // the memory limit counts them, and flexible parsing walks them its own way.
+    ChainTrie *chains = cp == NULL && !opts->mem_limit && !opts->flexible ? e->chains : NULL;
+    if (resume) {
+        checkpoint_load_trie(cp, root, jump);
+    } else if (dict != NULL && chains != NULL) {
+        dict_load_chains(dict, chains);
+    } else if (dict != NULL) {
+        dict_load_trie(dict, root, jump);
+    }
+
+    // 6. You will need a monotonic counter to keep track of the next available code. This counter should start at
+    // START_CODE, as defined in the supplied code.h file. The counter should be a uint16_t since the codes
+    // used are unsigned 16-bit integers. This will be referred to as next_code.
+    uint16_t next_code = START_CODE;
+    if (resume) {
+        next_code = cp->header.next_code;
+    } else if (dict != NULL) {
+        next_code = dict_next_code(dict);
+    }
+
+    // 7. You will also need two variables to keep track of the previous trie node and previously read symbol. We will
+    // refer to these as prev_node and prev_sym, respectively.
+    TrieNode *prev_node = NULL;
+    uint8_t prev_sym = 0;
+
+    // 8. Encode the input one width phase at a time. The bit-length of next_code only changes when next_code
+    // crosses a power of two, so each phase runs a loop specialized for its bit-length.
+    BitWriter bw;
+    bw_init(&bw, outfile);
+    bw.check = opts->check;
+    if (opts->verify != NULL) {
+        bw.tee = verifier_pipe(opts->verify);
+    }
+    if (opts->check) {
+        check_syms();
+    }
+    // A stream carried on from a checkpoint starts with the bits before STOP_CODE in its last byte, which
+    // outfile was truncated to, and the checksum of the bytes since its last CTRL_CHECK block.
+    if (resume) {
+        bw.crc = cp->header.crc;
+        bw.acc = cp->header.tail;
+        bw.nbits = cp->header.stop_bit % 8;
+        total_bits += bw.nbits;
+    }
+    uint64_t start_bits = total_bits;
+    EncodeState state = {
+        .infile = infile,
+        .bw = &bw,
+        .root = root,
+        .jump = jump,
+        .dict = dict,
+        .curr_node = curr_node,
+        .prev_node = prev_node,
+        .prev_sym = prev_sym,
+        .chains = chains,
+        .chain = 0,
+        .depth = 0,
+        .next_code = next_code,
+        .runs = opts->runs,
+        .mem_limit = opts->mem_limit,
+        .stream = opts->flush_ms || opts->flush_bytes,
+        .flush_ms = opts->flush_ms,
+        .flush_bytes = opts->flush_bytes,
+        .synced_syms = 0,
+        .pending_since = 0,
+        .check_at = opts->check ? total_syms + CHECK_BLOCK : UINT64_MAX,
+        .verify = opts->verify,
+        .chunks = opts->dedup ? chunk_index_create() : NULL,
+        .start_syms = total_syms,
+        .chunk_end = opts->dedup ? total_syms : UINT64_MAX,
+        .resets = opts->resets,
+        .start_bits = start_bits,
+    };
+    while (!opts->flexible) {
+        if (state.stream && buffered_syms() == 0 && !encode_wait(&state)) {
+            break;
+        }
+        if (total_syms == state.chunk_end && !encode_chunk(&state)) {
+            break;
+        }
+        if (state.runs) {
+            encode_run(&state);
+        }
+        bool (*const *phases)(EncodeState *) = chains != NULL ? encode_chain_phases : encode_phases;
+        if (!phases[bit_len(state.next_code)](&state)) {
+            break;
+        }
+        if (total_syms >= state.check_at && encode_at_root(&state)) {
+            encode_check(&state, syms_check());
+        }
+        // (d) Check if next_code is equal to MAX_CODE. If it is, use trie_reset() to reset the trie to just having the
+        // root node. This reset is necessary since we have a finite number of codes. The trie is also reset, with
+        // a CTRL_RESET pair to tell the decoder, once it reaches the memory limit.
+        bool full = state.mem_limit && trie_bytes >= state.mem_limit;
+        if (full && state.next_code != MAX_CODE) {
+            bw_pair(&bw, STOP_CODE, CTRL_RESET, bit_len(state.next_code));
+            total_bits += bit_len(state.next_code) + 8;
+        }
+        if (state.next_code == MAX_CODE || full) {
+            encode_reset(&state);
+        }
+    }
+    if (opts->flexible) {
+        encode_flexible(&state);
+    }
+    chunk_index_delete(state.chunks);
+
+    // 9. After processing all the characters in infile, check if curr_node points to the root trie node. If it does not,
+    // it means we were still matching a prefix. Write the pair (prev_node->code, prev_sym). The bit-length of the
+    // code written should be the bit-length of next_code. Make sure to increment next_code and that it stays
+    // within the limit of MAX_CODE: the decoder goes back to the first code once next_code reaches MAX_CODE.
+    encode_pending(&state);
+    next_code = state.next_code;
+
+    // The last CTRL_CHECK block covers everything up to STOP_CODE.
+    if (opts->check && !opts->flexible) {
+        state.next_code = next_code;
+        encode_check(&state, syms_check());
+    }
+
+    // Keep the state right before STOP_CODE for the next run to carry on from.
+    if (cp != NULL) {
+        checkpoint_save_trie(cp, root);
+        cp->header.next_code = next_code;
+        cp->header.stop_bit += total_bits - start_bits;
+        cp->header.crc = bw_crc(&bw);
+        cp->header.tail = (uint8_t) (bw.acc >> (bw.nbits / 8 * 8)) & ((1 << bw.nbits % 8) - 1);
+    }
+
+    // 10. Write the pair (STOP_CODE, 0) to signal the end of compressed output. Again, the bit-length of code written
+    // should be the bit-length of next_code.
+    bw_pair(&bw, STOP_CODE, 0, bit_len(next_code));
+    total_bits += bit_len(next_code) + 8;
+
+    // 11. Make sure to use flush_pairs() to flush any unwritten, buffered pairs. Remember, calls to write_pair()
+    // end up buffering them under the hood. So, we have to remember to flush the contents of our buffer.
+    bw_flush(&bw);
+
+    // Leave the trie empty for the next stream.
+    trie_reset(root);
+    trie_jump_reset(jump);
+    if (chains != NULL) {
+        chain_trie_reset(chains);
+    }
+}
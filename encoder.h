@@ -0,0 +1,70 @@
+#ifndef __ENCODER_H__
+#define __ENCODER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chain.h"
+#include "checkpoint.h"
+#include "dict.h"
+#include "trie.h"
+
+#define CHECK_BLOCK 65536 // Input bytes between CTRL_CHECK blocks, at least.
+
+// where the dictionary was reset in a stream, for decode_range to start from
+typedef struct Reset {
+    uint64_t bit; // Of the first pair after the reset, counting from the first pair of the stream.
+    uint64_t sym; // Symbols encoded before it.
+} Reset;
+
+// the resets of a stream, in order, appended to as it's encoded
+typedef struct ResetLog {
+    Reset *resets;
+    uint32_t count;
+    uint32_t cap;
+} ResetLog;
+
+//
+// How the input is encoded. Every mode of encode takes the same options, and they decide the flags
+// of the file header.
+//
+typedef struct EncodeOptions {
+    Dict *dict; // Start from this trained dictionary. NULL for an empty one.
+    bool runs; // Encode runs of one symbol as CTRL_RUN blocks.
+    uint64_t mem_limit; // Reset the dictionary once its trie nodes take this many bytes. 0 for no limit.
+    int flush_ms; // Sync at most this long after input arrives. 0 for no time limit.
+    uint64_t flush_bytes; // Sync once this much input arrived since the last sync. 0 for no size limit.
+    bool check; // Add a CTRL_CHECK block of checksums every CHECK_BLOCK input bytes and at the end.
+    bool flexible; // Choose each phrase looking one phrase ahead, for a smaller output. Not for streaming.
+    struct Verifier *verify; // Hand the stream and the input to this verifier as they're encoded. NULL for none.
+    bool dedup; // Encode chunks of the input seen before as CTRL_DUP blocks. Not for streaming.
+    Checkpoint *checkpoint; // Carry on its stream, if it has one, and leave the state at STOP_CODE in it. NULL for none.
+    uint32_t filter; // The input was filtered with this filter on its way in, to be taken off after decoding. 0 for none.
+    int lanes; // Encode this many chunks at a time, each from a reset dictionary, with encode_lanes. 0 for none.
+    ResetLog *resets; // Log every reset of the dictionary here, for the file table of a solid archive. NULL for none.
+} EncodeOptions;
+
+//
+// A serial encoder. Its trie and jump table are empty between streams, so one encoder can encode any
+// number of streams, one at a time, on the thread that uses it.
+//
+typedef struct Encoder {
+    TrieNode *root;
+    TrieJump *jump;
+    ChainTrie *chains; // The same trie as chains, which most streams are encoded with instead.
+} Encoder;
+
+Encoder *encoder_create(void);
+
+void encoder_delete(Encoder *e);
+
+// Returns the flags of the file header for a stream encoded with opts.
+uint16_t encode_flags(const EncodeOptions *opts);
+
+// Writes the file header for a stream encoded with opts, and the fields following it.
+void encode_header(int outfile, const EncodeOptions *opts, uint16_t protection);
+
+// Encodes everything in infile to outfile, after the header, on the calling thread.
+void encode_stream(Encoder *e, int infile, int outfile, const EncodeOptions *opts);
+
+#endif
@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "filter.h"
+#include "io.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_SSE2
+#endif
+
+#define OP_SUB 0
+#define OP_ADD 1
+#define OP_XOR 2
+
+static const struct {
+    const char *name;
+    uint32_t filter;
+} filters[] = {
+    { "none", FILTER_NONE },
+    { "delta2", FILTER_DELTA | 2 << 8 },
+    { "delta4", FILTER_DELTA | 4 << 8 },
+    { "delta8", FILTER_DELTA | 8 << 8 },
+    { "xor2", FILTER_XOR | 2 << 8 },
+    { "xor4", FILTER_XOR | 4 << 8 },
+    { "xor8", FILTER_XOR | 8 << 8 },
+    { "planes2", FILTER_PLANES | 2 << 8 },
+    { "planes4", FILTER_PLANES | 4 << 8 },
+    { "planes8", FILTER_PLANES | 8 << 8 },
+    { "x86", FILTER_X86 },
+};
+
+#define FILTERS_COUNT (sizeof(filters) / sizeof(filters[0]))
+
+bool filter_parse(const char *name, uint32_t *filter) {
+    for (size_t k = 0; k < FILTERS_COUNT; k++) {
+        if (strcmp(filters[k].name, name) == 0) {
+            *filter = filters[k].filter;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *filter_name(uint32_t filter) {
+    for (size_t k = 0; k < FILTERS_COUNT; k++) {
+        if (filters[k].filter == filter) {
+            return filters[k].name;
+        }
+    }
+    return NULL;
+}
+
+// Applies op to the little-endian words of stride bytes at a and at b, leaving the result at a.
+static inline void word_op(uint8_t *a, const uint8_t *b, int stride, int op) {
+    int carry = 0;
+    for (int k = 0; k < stride; k++) {
+        if (op == OP_XOR) {
+            a[k] ^= b[k];
+        } else if (op == OP_ADD) {
+            carry += a[k] + b[k];
+            a[k] = (uint8_t) carry;
+            carry >>= 8;
+        } else {
+            carry = a[k] - b[k] - carry;
+            a[k] = (uint8_t) carry;
+            carry = carry < 0;
+        }
+    }
+}
+
+#ifdef FILTER_SSE2
+__attribute__((target("sse2"))) static inline __m128i vec_op(__m128i a, __m128i b, int stride, int op) {
+    if (op == OP_XOR) {
+        return _mm_xor_si128(a, b);
+    }
+    if (op == OP_ADD) {
+        return stride == 2 ? _mm_add_epi16(a, b) : stride == 4 ? _mm_add_epi32(a, b) : _mm_add_epi64(a, b);
+    }
+    return stride == 2 ? _mm_sub_epi16(a, b) : stride == 4 ? _mm_sub_epi32(a, b) : _mm_sub_epi64(a, b);
+}
+
+// Returns v with its first word of stride bytes in every word, or its last one if last.
+__attribute__((target("sse2"))) static inline __m128i vec_broadcast(__m128i v, int stride, bool last) {
+    switch (stride) {
+    case 2:
+        v = last ? _mm_shufflehi_epi16(v, 0xFF) : _mm_shufflelo_epi16(v, 0x00);
+        return last ? _mm_unpackhi_epi64(v, v) : _mm_unpacklo_epi64(v, v);
+    case 4: return last ? _mm_shuffle_epi32(v, 0xFF) : _mm_shuffle_epi32(v, 0x00);
+    default: return last ? _mm_unpackhi_epi64(v, v) : _mm_unpacklo_epi64(v, v);
+    }
+}
+
+// Takes the word before each word of the first n bytes of b off it, 16 bytes at a time from the
+// end, so that every word is taken off before it changes. Returns where the words left start.
+__attribute__((target("sse2"))) static int stride_forward_sse2(uint8_t *b, int n, int stride, int op) {
+    int i = n;
+    while (i - 16 >= stride) {
+        i -= 16;
+        __m128i v = _mm_loadu_si128((const __m128i *) (b + i));
+        __m128i before = _mm_loadu_si128((const __m128i *) (b + i - stride));
+        _mm_storeu_si128((__m128i *) (b + i), vec_op(v, before, stride, op));
+    }
+    return i;
+}
+
+// Adds the word before each word of the first n bytes of b back on, 16 bytes at a time: the words of
+// a vector are summed in log steps, then the last word of the vector before is added to all of them.
+// Returns where the words left start.
+__attribute__((target("sse2"))) static int stride_inverse_sse2(uint8_t *b, int n, int stride, int op) {
+    int i = stride;
+    if (i + 16 > n) {
+        return i;
+    }
+    __m128i carry = vec_broadcast(_mm_loadu_si128((const __m128i *) b), stride, false);
+    while (i + 16 <= n) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (b + i));
+        switch (stride) {
+        case 2: v = vec_op(v, _mm_slli_si128(v, 2), stride, op); // fall through
+        case 4: v = vec_op(v, _mm_slli_si128(v, 4), stride, op); // fall through
+        default: v = vec_op(v, _mm_slli_si128(v, 8), stride, op); break;
+        }
+        v = vec_op(v, carry, stride, op);
+        _mm_storeu_si128((__m128i *) (b + i), v);
+        carry = vec_broadcast(v, stride, true);
+        i += 16;
+    }
+    return i;
+}
+#endif
+
+// Replaces every word of stride bytes in the first n bytes of b, but the first, by op of it and the
+// word before it. n is a multiple of stride.
+static void stride_forward(uint8_t *b, int n, int stride, int op) {
+    int i = n;
+#ifdef FILTER_SSE2
+    if (__builtin_cpu_supports("sse2")) {
+        i = stride_forward_sse2(b, n, stride, op);
+    }
+#endif
+    for (i -= stride; i >= stride; i -= stride) {
+        word_op(b + i, b + i - stride, stride, op);
+    }
+}
+
+// Undoes stride_forward, with op its inverse.
+static void stride_inverse(uint8_t *b, int n, int stride, int op) {
+    int i = stride;
+#ifdef FILTER_SSE2
+    if (__builtin_cpu_supports("sse2")) {
+        i = stride_inverse_sse2(b, n, stride, op);
+    }
+#endif
+    for (; i + stride <= n; i += stride) {
+        word_op(b + i, b + i - stride, stride, op);
+    }
+}
+
+// Splits the n bytes at in into the bytes at even offsets, at even, and those at odd ones, at odd.
+static void split2(const uint8_t *in, int n, uint8_t *even, uint8_t *odd) {
+    int i = 0;
+#ifdef FILTER_SSE2
+    if (__builtin_cpu_supports("sse2")) {
+        __m128i low = _mm_set1_epi16(0x00FF);
+        for (; i + 32 <= n; i += 32) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (in + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (in + i + 16));
+            __m128i evens = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+            __m128i odds = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128((__m128i *) (even + i / 2), evens);
+            _mm_storeu_si128((__m128i *) (odd + i / 2), odds);
+        }
+    }
+#endif
+    for (; i < n; i += 2) {
+        even[i / 2] = in[i];
+        odd[i / 2] = in[i + 1];
+    }
+}
+
+// Interleaves the half bytes at even and at odd into out, undoing split2.
+static void merge2(const uint8_t *even, const uint8_t *odd, int half, uint8_t *out) {
+    int i = 0;
+#ifdef FILTER_SSE2
+    if (__builtin_cpu_supports("sse2")) {
+        for (; i + 16 <= half; i += 16) {
+            __m128i e = _mm_loadu_si128((const __m128i *) (even + i));
+            __m128i o = _mm_loadu_si128((const __m128i *) (odd + i));
+            _mm_storeu_si128((__m128i *) (out + 2 * i), _mm_unpacklo_epi8(e, o));
+            _mm_storeu_si128((__m128i *) (out + 2 * i + 16), _mm_unpackhi_epi8(e, o));
+        }
+    }
+#endif
+    for (; i < half; i++) {
+        out[2 * i] = even[i];
+        out[2 * i + 1] = odd[i];
+    }
+}
+
+// Splits the n bytes at in, records of stride bytes, into planes of m bytes in out: byte j of every
+// record goes to plane first + j * step. The records are split into their even and odd bytes, which
+// are records half as wide, until they are one byte wide. tmp needs room for n + n / 2 bytes.
+static void split_planes(const uint8_t *in, int n, int stride, uint8_t *out, int m, int first, int step, uint8_t *tmp) {
+    if (stride == 2) {
+        split2(in, n, out + first * m, out + (first + step) * m);
+        return;
+    }
+    split2(in, n, tmp, tmp + n / 2);
+    split_planes(tmp, n / 2, stride / 2, out, m, first, 2 * step, tmp + n);
+    split_planes(tmp + n / 2, n / 2, stride / 2, out, m, first + step, 2 * step, tmp + n);
+}
+
+// Undoes split_planes, putting the n bytes back together at out.
+static void merge_planes(const uint8_t *in, int m, int stride, uint8_t *out, int n, int first, int step, uint8_t *tmp) {
+    if (stride == 2) {
+        merge2(in + first * m, in + (first + step) * m, n / 2, out);
+        return;
+    }
+    merge_planes(in, m, stride / 2, tmp, n / 2, first, 2 * step, tmp + n);
+    merge_planes(in, m, stride / 2, tmp + n / 2, n / 2, first + step, 2 * step, tmp + n);
+    merge2(tmp, tmp + n / 2, n / 2, out);
+}
+
+// Returns the first offset from i on, before end, of an x86 CALL (E8) or JMP (E9) opcode in b, or end.
+static int next_branch(const uint8_t *b, int i, int end) {
+#ifdef FILTER_SSE2
+    if (__builtin_cpu_supports("sse2")) {
+        __m128i call = _mm_set1_epi8((char) 0xE8);
+        __m128i jmp = _mm_set1_epi8((char) 0xE9);
+        for (; i + 16 <= end; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (b + i));
+            uint32_t hits = (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, call), _mm_cmpeq_epi8(v, jmp)));
+            if (hits) {
+                return i + __builtin_ctz(hits);
+            }
+        }
+    }
+#endif
+    while (i < end && (b[i] & 0xFE) != 0xE8) {
+        i += 1;
+    }
+    return i < end ? i : end;
+}
+
+// Turns the displacement after every CALL and JMP opcode of the len bytes of b, which start at pos in
+// the stream, into the target it jumps to, or back again. The 4 bytes of a displacement are never
+// taken for an opcode, so that both ways find the same opcodes.
+static void x86_branches(uint8_t *b, int len, uint64_t pos, bool forward) {
+    int end = len - 4;
+    int i = 0;
+    while ((i = next_branch(b, i, end)) < end) {
+        uint32_t at = (uint32_t) (pos + i + 5);
+        uint32_t value = (uint32_t) b[i + 1] | (uint32_t) b[i + 2] << 8 | (uint32_t) b[i + 3] << 16 | (uint32_t) b[i + 4] << 24;
+        value = forward ? value + at : value - at;
+        for (int k = 0; k < 4; k++) {
+            b[i + 1 + k] = (uint8_t) (value >> 8 * k);
+        }
+        i += 5;
+    }
+}
+
+void filter_block(uint32_t filter, uint8_t *block, int len, uint64_t pos, uint8_t *tmp) {
+    int stride = filter_stride(filter);
+    int n = stride ? len / stride * stride : len;
+    switch (filter_kind(filter)) {
+    case FILTER_DELTA: stride_forward(block, n, stride, OP_SUB); break;
+    case FILTER_XOR: stride_forward(block, n, stride, OP_XOR); break;
+    case FILTER_PLANES:
+        split_planes(block, n, stride, tmp, n / stride, 0, 1, tmp + n);
+        memcpy(block, tmp, n);
+        break;
+    case FILTER_X86: x86_branches(block, len, pos, true); break;
+    default: break;
+    }
+}
+
+void unfilter_block(uint32_t filter, uint8_t *block, int len, uint64_t pos, uint8_t *tmp) {
+    int stride = filter_stride(filter);
+    int n = stride ? len / stride * stride : len;
+    switch (filter_kind(filter)) {
+    case FILTER_DELTA: stride_inverse(block, n, stride, OP_ADD); break;
+    case FILTER_XOR: stride_inverse(block, n, stride, OP_XOR); break;
+    case FILTER_PLANES:
+        merge_planes(block, n / stride, stride, tmp, n, 0, 1, tmp + n);
+        memcpy(block, tmp, n);
+        break;
+    case FILTER_X86: x86_branches(block, len, pos, false); break;
+    default: break;
+    }
+}
+
+uint32_t filter_choose(const uint8_t *sample, int len, const EncodeOptions *opts) {
+    // The sample is encoded in memory as a stream of its own, unfiltered and with every filter.
+    EncodeOptions sample_opts;
+    memset(&sample_opts, 0, sizeof(sample_opts));
+    sample_opts.dict = opts->dict;
+    sample_opts.runs = opts->runs;
+    BatchEncoder *b = batch_encoder_create(&sample_opts, 0);
+    uint8_t *copy = (uint8_t *) malloc(len + 1);
+    uint8_t *tmp = (uint8_t *) malloc(3 * FILTER_BLOCK);
+    uint32_t best = FILTER_NONE;
+    if (len > 0 && b != NULL && copy != NULL && tmp != NULL) {
+        Message in = { .data = sample, .len = (size_t) len };
+        Message out;
+        batch_encode(b, &in, &out, 1);
+        size_t best_len = out.len - out.len / 32;
+        for (size_t k = 1; k < FILTERS_COUNT; k++) {
+            memcpy(copy, sample, len);
+            filter_block(filters[k].filter, copy, len, 0, tmp);
+            in.data = copy;
+            if (batch_encode(b, &in, &out, 1) && out.len < best_len) {
+                best_len = out.len;
+                best = filters[k].filter;
+            }
+        }
+    }
+    batch_encoder_delete(b);
+    free(copy);
+    free(tmp);
+    return best;
+}
+
+// filter thread: filters the input a block at a time into the pipe, until the input runs out
+static void *filter_input_thread(void *arg) {
+    FilterInput *f = (FilterInput *) arg;
+    uint64_t pos = 0;
+    int len = f->len;
+    while (len > 0) {
+        filter_block(f->filter, f->block, len, pos, f->tmp);
+        if (write_bytes(f->pipe[1], f->block, len) != len || len < FILTER_BLOCK) {
+            break;
+        }
+        pos += len;
+        len = read_bytes(f->infile, f->block, FILTER_BLOCK);
+    }
+    close(f->pipe[1]);
+    return NULL;
+}
+
+int filter_input_start(FilterInput *f, int infile, uint32_t filter, const uint8_t *head, int len) {
+    f->infile = infile;
+    f->filter = filter;
+    f->block = (uint8_t *) malloc(FILTER_BLOCK);
+    f->tmp = (uint8_t *) malloc(3 * FILTER_BLOCK);
+    f->len = len;
+    if (f->block == NULL || f->tmp == NULL || pipe(f->pipe) != 0) {
+        free(f->block);
+        free(f->tmp);
+        return -1;
+    }
+    memcpy(f->block, head, len);
+    if (pthread_create(&f->thread, NULL, filter_input_thread, f) != 0) {
+        close(f->pipe[0]);
+        close(f->pipe[1]);
+        free(f->block);
+        free(f->tmp);
+        return -1;
+    }
+    return f->pipe[0];
+}
+
+void filter_input_finish(FilterInput *f) {
+    pthread_join(f->thread, NULL);
+    close(f->infile);
+    free(f->block);
+    free(f->tmp);
+}
+
+// Takes the filter off the bytes in the block of f, and writes them out.
+static void filter_output_flush(FilterOutput *f) {
+    unfilter_block(f->filter, f->block, f->len, f->pos, f->tmp);
+    write_bytes(f->outfile, f->block, f->len);
+    f->pos += f->len;
+    f->len = 0;
+}
+
+// word tap: gathers the symbols written into blocks
+static void filter_output_tap(void *arg, const uint8_t *syms, int n) {
+    FilterOutput *f = (FilterOutput *) arg;
+    while (n > 0) {
+        int k = FILTER_BLOCK - f->len < n ? FILTER_BLOCK - f->len : n;
+        memcpy(f->block + f->len, syms, k);
+        f->len += k;
+        syms += k;
+        n -= k;
+        if (f->len == FILTER_BLOCK) {
+            filter_output_flush(f);
+        }
+    }
+}
+
+void filter_output_start(FilterOutput *f, int outfile, uint32_t filter) {
+    f->outfile = outfile;
+    f->filter = filter;
+    f->pos = 0;
+    f->len = 0;
+    f->block = (uint8_t *) malloc(FILTER_BLOCK);
+    f->tmp = (uint8_t *) malloc(3 * FILTER_BLOCK);
+    tap_words(filter_output_tap, f);
+}
+
+void filter_output_finish(FilterOutput *f) {
+    if (f->len > 0) {
+        filter_output_flush(f);
+    }
+    tap_words(NULL, NULL);
+    free(f->block);
+    free(f->tmp);
+}
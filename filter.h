@@ -0,0 +1,103 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "encoder.h"
+
+#define FILTER_BLOCK (1 << 16) // Bytes filtered at a time. Each block of the input is filtered on its own.
+
+// The filter of a stream is its kind in the low byte and its stride in the next one.
+#define FILTER_NONE 0
+#define FILTER_DELTA 1 // Each little-endian word of stride bytes less the word before it.
+#define FILTER_XOR 2 // Each byte xored with the byte stride bytes before it.
+#define FILTER_PLANES 3 // Records of stride bytes split into stride planes: all first bytes, then all second...
+#define FILTER_X86 4 // The 32-bit displacement after every x86 CALL or JMP opcode made an absolute target.
+
+static inline uint32_t filter_kind(uint32_t filter) {
+    return filter & 0xFF;
+}
+
+static inline int filter_stride(uint32_t filter) {
+    return (int) (filter >> 8 & 0xFF);
+}
+
+//
+// Filters the input of the encoder on a thread of its own: it reads the input a block at a time,
+// filters each block and writes it to a pipe, which the encoder reads instead of the input.
+//
+typedef struct FilterInput {
+    int infile;
+    int pipe[2];
+    uint32_t filter;
+    uint8_t *block;
+    int len; // Bytes already read into block, for the first one.
+    uint8_t *tmp;
+    pthread_t thread;
+} FilterInput;
+
+//
+// Takes the filter off the symbols decode_stream writes, in blocks of FILTER_BLOCK, by tapping them
+// with tap_words on the calling thread.
+//
+typedef struct FilterOutput {
+    int outfile;
+    uint32_t filter;
+    uint64_t pos; // Where block starts in the output.
+    int len; // Bytes in block.
+    uint8_t *block;
+    uint8_t *tmp;
+} FilterOutput;
+
+/*
+ * Sets *filter to the filter called name: none, delta2, delta4, delta8, xor2, xor4, xor8, planes2,
+ * planes4, planes8 or x86. Returns false if there is no such filter
+ */
+bool filter_parse(const char *name, uint32_t *filter);
+
+/*
+ * Returns the name of filter, or NULL if it isn't valid
+ */
+const char *filter_name(uint32_t filter);
+
+/*
+ * Filters the len bytes of block, which start at pos in the input, in place
+ * tmp is scratch space of 3 * FILTER_BLOCK bytes
+ */
+void filter_block(uint32_t filter, uint8_t *block, int len, uint64_t pos, uint8_t *tmp);
+
+/*
+ * Takes the filter off the len bytes of block, which start at pos in the output, in place
+ */
+void unfilter_block(uint32_t filter, uint8_t *block, int len, uint64_t pos, uint8_t *tmp);
+
+/*
+ * Returns the filter the len bytes of sample, the start of the input, compress best with when encoded
+ * with opts, or FILTER_NONE if none of them saves at least 1/32 of its size
+ */
+uint32_t filter_choose(const uint8_t *sample, int len, const EncodeOptions *opts);
+
+/*
+ * Starts filtering infile, the first len bytes of which were already read into head
+ * Returns the file descriptor to read the filtered input from, or -1 if the thread can't be started
+ */
+int filter_input_start(FilterInput *f, int infile, uint32_t filter, const uint8_t *head, int len);
+
+/*
+ * Waits for the thread filtering the input to finish, once all of its output has been read
+ */
+void filter_input_finish(FilterInput *f);
+
+/*
+ * Starts taking filter off the symbols written to outfile on the calling thread
+ */
+void filter_output_start(FilterOutput *f, int outfile, uint32_t filter);
+
+/*
+ * Writes out the last block and stops tapping the symbols written
+ */
+void filter_output_finish(FilterOutput *f);
+
+#endif
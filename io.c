@@ -1,24 +1,74 @@
+#define _GNU_SOURCE // SEEK_DATA and SEEK_HOLE.
 #include "word.h"
 #include <stdint.h>
 #include <stdbool.h>
-#include <unistd.h> //read write
+#include <errno.h>
+#include <stdlib.h> // realloc free
+#include <unistd.h> //read write lseek
 #include <string.h> // memset
+#include <sys/stat.h> // fstat
 
 #include "endian.h"
 #include "io.h"
 #include "code.h"
-
-uint64_t total_syms = 0;
-uint64_t total_bits = 0;
-
-uint8_t sym_buffer[BLOCK];
-
-uint8_t pair_buffer[BLOCK];
-
-static int read_pair_buffer_index = 0;
-static int write_pair_buffer_index = 0;
-static int sym_buffer_index = 0;
-static int sym_buffer_index_end = 0;
+#include "crc.h"
+
+// All of the io state is per thread, so that threads can each encode or decode their own stream.
+_Thread_local uint64_t total_syms = 0;
+_Thread_local uint64_t total_bits = 0;
+
+// Symbols are written out a BLOCK at a time, and read in a BLOCK at a time unless peek_ahead needs more.
+// write_word may fill it up to a whole word and WORD_SLACK past BLOCK before writing it out.
+static _Thread_local uint8_t sym_buffer[SYM_AHEAD];
+_Static_assert(SYM_AHEAD >= BLOCK + MAX_CODE + WORD_SLACK, "sym_buffer must fit the longest word after a BLOCK");
+
+// pair buffers behind write_pair, flush_pairs and read_pair
+static _Thread_local BitWriter pair_writer = { .outfile = -1 };
+static _Thread_local BitReader pair_reader = { .infile = -1 };
+
+static _Thread_local int sym_buffer_index = 0;
+static _Thread_local int sym_buffer_index_end = 0;
+
+// where write_word writes its symbols with pwrite(), or -1 to write() them
+static _Thread_local int64_t sym_write_at = -1;
+
+// where the symbols written go instead of outfile, for tap_words
+static _Thread_local void (*word_tap)(void *arg, const uint8_t *syms, int n) = NULL;
+static _Thread_local void *word_tap_arg = NULL;
+
+// where copy_words reads back the symbols written since total_syms was sym_kept_from: outfile at
+// sym_kept_at, or sym_kept if sym_kept_at is -1: a ring of the last DUP_WINDOW of the sym_kept_len
+// symbols written, growing up to that
+static _Thread_local bool sym_keep = false;
+static _Thread_local uint64_t sym_kept_from = 0;
+static _Thread_local int64_t sym_kept_at = -1;
+static _Thread_local uint8_t *sym_kept = NULL;
+static _Thread_local uint64_t sym_kept_len = 0;
+static _Thread_local size_t sym_kept_cap = 0;
+
+// whether write_sym_buffer seeks over whole blocks of zeros instead of writing them, for sparse_words,
+// and whether the last thing written was seeked over, so that flush_words has to end the file there
+static _Thread_local bool sym_sparse = false;
+static _Thread_local bool sym_sparse_tail = false;
+
+// the hole of hole_file skip_hole looked up last: its bytes from hole_from up to hole_to, both INT64_MAX
+// if there are no more holes
+static _Thread_local int hole_file = -1;
+static _Thread_local int64_t hole_from = 0;
+static _Thread_local int64_t hole_to = 0;
+
+// the CRC32C of the symbols before sym_buffer[sym_crc_index], for syms_check
+static _Thread_local bool sym_check = false;
+static _Thread_local uint32_t sym_crc = 0;
+static _Thread_local int sym_crc_index = 0;
+
+// Checksums the symbols of sym_buffer up to end, before they are replaced.
+static void sym_buffer_check(int end) {
+    if (sym_check) {
+        sym_crc = crc32c(sym_crc, sym_buffer + sym_crc_index, end - sym_crc_index);
+        sym_crc_index = 0;
+    }
+}
 
 // #define BLOCK 4096 // 4KB blocks.
 // #define MAGIC 0xBAADBAAC // Unique encoder/decoder magic number.
@@ -55,8 +105,9 @@ int read_bytes(int infile, uint8_t *buf, int to_read) {
     //     total bytes_read so far += current
     //     break once reaach to_read amouts of bytes
     // }
-    while ((current = read(infile, buf, to_read - bytes_read))) {
-        if (current == 0) {
+    while ((current = read(infile, buf + bytes_read, to_read - bytes_read))) {
+        // stop at the end of the file or on an error
+        if (current <= 0) {
             break;
         }
 
@@ -70,6 +121,21 @@ int read_bytes(int infile, uint8_t *buf, int to_read) {
     return bytes_read;
 }
 
+//
+// Read whatever is available from infile, up to to_read bytes, into buf with a single read(). Return
+// the number of bytes read, 0 at the end of the file or on an error.
+//
+// Unlike read_bytes this only waits for input if none is available yet, so data arriving slowly
+// through a pipe is passed on as soon as it arrives.
+//
+int read_some(int infile, uint8_t *buf, int to_read) {
+    int current;
+    do {
+        current = read(infile, buf, to_read);
+    } while (current < 0 && errno == EINTR);
+    return current > 0 ? current : 0;
+}
+
 //
 // Write up to to_write bytes from buf into outfile. Return the number of bytes actually written.
 //
@@ -91,7 +157,10 @@ int write_bytes(int outfile, uint8_t *buf, int to_write) {
     //     total bytes_wrote so far += current
     //     break once reaach to_write amouts of bytes
     // }
-    while ((current = write(outfile, buf, to_write - bytes_wrote))) {
+    while ((current = write(outfile, buf + bytes_wrote, to_write - bytes_wrote))) {
+        if (current < 0) {
+            break;
+        }
         bytes_wrote += current;
         if (bytes_wrote == to_write) {
             break;
@@ -122,26 +191,28 @@ int write_bytes(int outfile, uint8_t *buf, int to_write) {
 // not what we want, so you would have to change the order of those bytes in memory. A little-endian
 // computer will interpret that as 0xBAADBAAC.
 //
-// This function should also make sure the magic number is correct. Since it has no return value you
-// may call assert() to do that, or print out an error message and exit the program, or use some
-// other way to report the error.
+// This function should also make sure the magic number is correct. Returns false if it isn't, or if
+// infile ends before the header does.
 //
-void read_header(int infile, FileHeader *header) {
+bool read_header(int infile, FileHeader *header) {
     // This reads in sizeof(FileHeader) bytes from the input file.
     // These bytes are read into the supplied header.
     int bytes_read = read_bytes(infile, (uint8_t *) header, sizeof(FileHeader));
     if (bytes_read != sizeof(FileHeader)) {
-        return;
+        return false;
     }
     // Endianness is swapped if byte order isn’t little endian.
     if (big_endian()) {
         header->magic = swap32(header->magic);
         header->protection = swap16(header->protection);
+        header->flags = swap16(header->flags);
     }
-    // Along with reading the header, it must verify the magic number.
-    if (header->magic != MAGIC) {
-        return;
+    // The flags are padding, and may hold anything, in a MAGIC header.
+    if (header->magic == MAGIC) {
+        header->flags = 0;
     }
+    // Along with reading the header, it must verify the magic number.
+    return header->magic == MAGIC || header->magic == MAGIC_EXT;
 }
 
 //
@@ -153,6 +224,7 @@ void write_header(int outfile, FileHeader *header) {
     if (big_endian()) {
         header->magic = swap32(header->magic);
         header->protection = swap16(header->protection);
+        header->flags = swap16(header->flags);
     }
     // Writes sizeof(FileHeader) bytes to the output file.
     // These bytes are from the supplied header.
@@ -162,6 +234,23 @@ void write_header(int outfile, FileHeader *header) {
     }
 }
 
+void write_u32(int outfile, uint32_t value) {
+    if (big_endian()) {
+        value = swap32(value);
+    }
+    write_bytes(outfile, (uint8_t *) &value, sizeof(value));
+}
+
+bool read_u32(int infile, uint32_t *value) {
+    if (read_bytes(infile, (uint8_t *) value, sizeof(*value)) != sizeof(*value)) {
+        return false;
+    }
+    if (big_endian()) {
+        *value = swap32(*value);
+    }
+    return true;
+}
+
 //
 // Read one symbol from infile into *sym. Return true if a symbol was successfully read, false
 // otherwise.
@@ -181,14 +270,15 @@ bool read_sym(int infile, uint8_t *sym) {
 
     // if no more bytes in the buffer
     if (sym_buffer_index >= sym_buffer_index_end) {
-        // call read_bytes to refill the buffer with fresh data
-        int bytes_read = read_bytes(infile, sym_buffer, BLOCK);
+        // call read_some to refill the buffer with fresh data
+        sym_buffer_check(sym_buffer_index_end);
+        int bytes_read = read_some(infile, sym_buffer, BLOCK);
+        sym_buffer_index = 0;
+        sym_buffer_index_end = bytes_read;
         // If this call fails then you cannot read a symbol and should return false.
         if (bytes_read == 0) {
             return false;
         }
-        sym_buffer_index = 0;
-        sym_buffer_index_end = bytes_read;
     }
     // Read one symbol from infile into *sym.
     *sym = sym_buffer[sym_buffer_index];
@@ -199,6 +289,119 @@ bool read_sym(int infile, uint8_t *sym) {
     return true;
 }
 
+int peek_syms(int infile, uint8_t **syms) {
+    if (sym_buffer_index >= sym_buffer_index_end) {
+        sym_buffer_check(sym_buffer_index_end);
+        int bytes_read = read_some(infile, sym_buffer, BLOCK);
+        sym_buffer_index = 0;
+        sym_buffer_index_end = bytes_read;
+        if (bytes_read == 0) {
+            return 0;
+        }
+    }
+    *syms = sym_buffer + sym_buffer_index;
+    return sym_buffer_index_end - sym_buffer_index;
+}
+
+int peek_ahead(int infile, uint8_t **syms, int want) {
+    if (sym_buffer_index_end - sym_buffer_index < want) {
+        // Move the symbols left to the front, checksumming the ones consumed before they go.
+        sym_buffer_check(sym_buffer_index);
+        sym_buffer_index_end -= sym_buffer_index;
+        memmove(sym_buffer, sym_buffer + sym_buffer_index, sym_buffer_index_end);
+        sym_buffer_index = 0;
+        while (sym_buffer_index_end < want) {
+            int bytes_read = read_some(infile, sym_buffer + sym_buffer_index_end, SYM_AHEAD - sym_buffer_index_end);
+            if (bytes_read == 0) {
+                break;
+            }
+            sym_buffer_index_end += bytes_read;
+        }
+    }
+    *syms = sym_buffer + sym_buffer_index;
+    return sym_buffer_index_end - sym_buffer_index;
+}
+
+int buffered_syms(void) {
+    return sym_buffer_index_end - sym_buffer_index;
+}
+
+void reset_syms(void) {
+    sym_buffer_index = 0;
+    sym_buffer_index_end = 0;
+    sym_check = false;
+    sym_write_at = -1;
+    sym_keep = false;
+    free(sym_kept);
+    sym_kept = NULL;
+    sym_kept_len = 0;
+    sym_kept_cap = 0;
+    sym_sparse = false;
+    sym_sparse_tail = false;
+    hole_file = -1;
+}
+
+void write_words_at(int64_t offset) {
+    sym_write_at = offset;
+}
+
+void tap_words(void (*fn)(void *arg, const uint8_t *syms, int n), void *arg) {
+    word_tap = fn;
+    word_tap_arg = arg;
+}
+
+void check_syms(void) {
+    sym_check = true;
+    sym_crc = 0;
+    sym_crc_index = sym_buffer_index;
+}
+
+uint32_t syms_check(void) {
+    sym_buffer_check(sym_buffer_index);
+    sym_crc_index = sym_buffer_index;
+    uint32_t crc = sym_crc;
+    sym_crc = 0;
+    return crc;
+}
+
+void skip_syms(int n) {
+    sym_buffer_index += n;
+    total_syms += n;
+}
+
+uint64_t skip_hole(int infile) {
+    if (sym_buffer_index < sym_buffer_index_end) {
+        return 0;
+    }
+    off_t pos = lseek(infile, 0, SEEK_CUR);
+    if (pos < 0) {
+        return 0;
+    }
+    // Look up the next hole once the last one is behind. The end of the file is a hole of no bytes to
+    // SEEK_HOLE, and a hole running to the end of the file has no data after it for SEEK_DATA.
+    if (infile != hole_file || pos >= hole_to) {
+        struct stat info;
+        hole_file = infile;
+        hole_from = INT64_MAX;
+        hole_to = INT64_MAX;
+        if (fstat(infile, &info) == 0 && S_ISREG(info.st_mode)) {
+            off_t from = lseek(infile, pos, SEEK_HOLE);
+            if (from >= 0 && from < info.st_size) {
+                off_t to = lseek(infile, from, SEEK_DATA);
+                hole_from = from;
+                hole_to = to >= 0 ? to : info.st_size;
+            }
+            lseek(infile, pos, SEEK_SET);
+        }
+    }
+    if (pos < hole_from) {
+        return 0;
+    }
+    lseek(infile, hole_to, SEEK_SET);
+    total_syms += hole_to - pos;
+    return hole_to - pos;
+}
+
 //
 // Write a pair -- bitlen bits of code, followed by all 8 bits of sym -- to outfile.
 //
@@ -214,54 +417,16 @@ bool read_sym(int infile, uint8_t *sym) {
 // reaches the end of the buffer it needs to write out the contents of the buffer to outfile; you
 // may use flush_pairs to do this.
 // ######################################################
-// pair_buffer for read_pair, write_pair, and flush_pairs
+// pair_writer and pair_reader for write_pair, flush_pairs and read_pair
 void write_pair(int outfile, uint16_t code, uint8_t sym, int bitlen) {
-    // uint8_t pair_buffer[BLOCK];
-    // pair_buffer_index = 0;
-    // “Writes” a pair to outfile. In reality, the pair is buffered.
+    // “Writes” a pair to outfile. In reality, the pair is buffered in pair_writer.
     // A pair is comprised of a code and a symbol.
-
-    // The bits of the code are buffered first, starting from the LSB.
-    for (int i = 0; i < bitlen; i++) {
-        // checks if a pair_buffer is full
-        if (write_pair_buffer_index == 8 * BLOCK) {
-            // write the pair_buffer to oufile
-            write_bytes(outfile, pair_buffer, BLOCK);
-            memset(pair_buffer, 0, BLOCK); //  Set buffer to all zeros. Varun
-            // reset index to 0
-            write_pair_buffer_index = 0;
-        }
-        // checks if the current bit of code is set
-        if (code & (1 << i)) {
-            // set the corresponding bit in the buffer
-            // write_pair_buffer_index / 8 calcuates buffer index
-            // write_pair_buffer_index % 8 calcuates the amount to set for specific bit
-            pair_buffer[write_pair_buffer_index / 8] |= (1 << write_pair_buffer_index % 8);
-        }
-        // add 1 to index
-        write_pair_buffer_index += 1;
-    }
-    // The bits of the symbol are buffered next, also starting from the LSB.
-    for (int i = 0; i < 8; i++) {
-        // checks if a pair_buffer is full
-        if (write_pair_buffer_index == 8 * BLOCK) {
-            // write the pair_buffer to oufile
-            write_bytes(outfile, pair_buffer, BLOCK);
-            memset(pair_buffer, 0, BLOCK); //  Set buffer to all zeros. Varun
-            // reset index to 0
-            write_pair_buffer_index = 0;
-        }
-        // checks if the current bit of sym is set
-        if (sym & (1 << i)) {
-            // set the corresponding bit in the buffer
-            // write_pair_buffer_index / 8 calcuates buffer index
-            // write_pair_buffer_index % 8 calcuates the amount to set for specific bit
-            pair_buffer[write_pair_buffer_index / 8] |= (1 << write_pair_buffer_index % 8);
-        }
-        // add 1 to index
-        write_pair_buffer_index += 1;
+    if (pair_writer.outfile != outfile) {
+        bw_init(&pair_writer, outfile);
     }
-    // The code buffered has a bit-length of bitlen. The buffer is written out whenever it is filled.
+    // The bits of the code are buffered first, starting from the LSB, then the bits of the symbol.
+    // The buffer is written out whenever it is filled.
+    bw_pair(&pair_writer, code, sym, bitlen);
     total_bits += bitlen + 8;
 }
 
@@ -276,17 +441,13 @@ void write_pair(int outfile, uint16_t code, uint8_t sym, int bitlen) {
 // unwritten bits are set to zero. An easy way to do this is by zeroing the entire buffer after
 // flushing it every time.
 // ######################################################
-// pair_buffer for read_pair, write_pair, and flush_pairs
+// pair_writer and pair_reader for write_pair, flush_pairs and read_pair
 void flush_pairs(int outfile) {
-    // calculate number of bytes needed to write out remaining bits
-    int remaining_bytes = write_pair_buffer_index / 8 + (write_pair_buffer_index % 8 ? 1 : 0);
-
-    // write remaining bytes to outfile
-    write_bytes(outfile, pair_buffer, remaining_bytes);
-
-    // reset buffer and buffer index
-    memset(pair_buffer, 0, BLOCK);
-    write_pair_buffer_index = 0;
+    if (pair_writer.outfile != outfile) {
+        return;
+    }
+    // write remaining bytes to outfile, zero padding the last one
+    bw_flush(&pair_writer);
 }
 
 //
@@ -298,66 +459,87 @@ void flush_pairs(int outfile) {
 //
 // It may be useful to write a helper function that reads a single bit from a file using a buffer.
 // ######################################################
-// pair_buffer for read_pair, write_pair, and flush_pairs
+// pair_writer and pair_reader for write_pair, flush_pairs and read_pair
 bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
-    int bytes_read;
+    if (pair_reader.infile != infile) {
+        br_init(&pair_reader, infile);
+    }
+    // The bits of the code come first, starting from the LSB, then the bits of the symbol.
+    if (!br_pair(&pair_reader, code, sym, bitlen)) {
+        return false;
+    }
 
-    if (read_pair_buffer_index == 0) {
-        // reads BLOCK bytes from the input file
-        bytes_read = read_bytes(infile, pair_buffer, BLOCK);
-        // if no bytes were read
-        if (bytes_read == 0) {
-            return false;
+    // Update the bit counters
+    total_bits += bitlen + 8;
+
+    // Returns true if there are pairs left to read in the buffer, else false.
+    // There are pairs left to read if the read code is not STOP_CODE.
+    return (*code != STOP_CODE);
+}
+
+// Writes the n symbols of syms to outfile, seeking over the whole blocks of zeros among them.
+static void write_sparse(int outfile, const uint8_t *syms, int n) {
+    static const uint8_t zeros[BLOCK] = { 0 };
+    int start = 0; // The first symbol not written or seeked over yet.
+    for (int at = 0; at + BLOCK <= n; at += BLOCK) {
+        if (syms[at] == 0 && memcmp(syms + at, zeros, BLOCK) == 0) {
+            write_bytes(outfile, (uint8_t *) syms + start, at - start);
+            lseek(outfile, BLOCK, SEEK_CUR);
+            sym_sparse_tail = true;
+            start = at + BLOCK;
         }
     }
+    if (start < n) {
+        write_bytes(outfile, (uint8_t *) syms + start, n - start);
+        sym_sparse_tail = false;
+    }
+}
 
-    *code = 0;
-    // The bits of the code are buffered first, starting from the LSB.
-    for (int i = 0; i < bitlen; i++) {
-        // checks if a pair_buffer is full
-        if (read_pair_buffer_index == 8 * BLOCK) {
-            // read BLOCK bytes from infile to pair_buffer
-            bytes_read = read_bytes(infile, pair_buffer, BLOCK);
-            if (bytes_read == 0) {
-                return false;
+// Writes the first n symbols of sym_buffer to outfile, at sym_write_at if it is set, or hands them to
+// the word tap if there is one.
+static void write_sym_buffer(int outfile, int n) {
+    if (sym_keep && sym_kept_at < 0) {
+        while (sym_kept_len + n > sym_kept_cap && sym_kept_cap < DUP_WINDOW) {
+            size_t cap = sym_kept_cap ? 2 * sym_kept_cap : 1 << 20;
+            uint8_t *kept = (uint8_t *) realloc(sym_kept, cap);
+            if (kept == NULL) {
+                // Stop keeping them, so that copy_words fails instead of copying the wrong symbols.
+                sym_keep = false;
+                break;
             }
-            // reset index
-            read_pair_buffer_index = 0;
+            sym_kept = kept;
+            sym_kept_cap = cap;
         }
-        // return (x->v[k / BITS_PER_UNIT] >> k % BITS_PER_UNIT) & 0x1;
-        // extracts the value of the least significant bit of the shifted byte.
-        if (pair_buffer[read_pair_buffer_index / 8] >> (read_pair_buffer_index % 8) & (uint8_t) 1) {
-            // sets the ith bit of code to 1
-            *code |= (1 << i);
+        if (sym_keep) {
+            // Until it is DUP_WINDOW long, the ring never wraps.
+            size_t at = (size_t) (sym_kept_len % DUP_WINDOW);
+            size_t first = (size_t) n < DUP_WINDOW - at ? (size_t) n : DUP_WINDOW - at;
+            memcpy(sym_kept + at, sym_buffer, first);
+            memcpy(sym_kept, sym_buffer + first, n - first);
+            sym_kept_len += n;
         }
-        read_pair_buffer_index += 1;
     }
-
-    *sym = 0;
-    // The bits of the symbol are buffered next, also starting from the LSB.
-    for (int i = 0; i < 8; i++) {
-        if (read_pair_buffer_index == 8 * BLOCK) {
-            bytes_read = read_bytes(infile, pair_buffer, BLOCK);
-            if (bytes_read == 0) {
-                return false;
-            }
-            read_pair_buffer_index = 0;
-        }
-        // return (x->v[k / BITS_PER_UNIT] >> k % BITS_PER_UNIT) & 0x1;
-        // extracts the value of the least significant bit of the shifted byte.
-        if (pair_buffer[read_pair_buffer_index / 8] >> (read_pair_buffer_index % 8) & (uint8_t) 1) {
-            // sets the ith bit of sym to 1
-            *sym |= (1 << i);
+    if (word_tap != NULL) {
+        word_tap(word_tap_arg, sym_buffer, n);
+        return;
+    }
+    if (sym_write_at < 0 && sym_sparse) {
+        write_sparse(outfile, sym_buffer, n);
+        return;
+    }
+    if (sym_write_at < 0) {
+        write_bytes(outfile, sym_buffer, n);
+        return;
+    }
+    int written = 0;
+    while (written < n) {
+        ssize_t current = pwrite(outfile, sym_buffer + written, n - written, sym_write_at + written);
+        if (current <= 0) {
+            break;
         }
-        read_pair_buffer_index += 1;
+        written += current;
     }
-
-    // Update the bit counters
-    total_bits += bitlen + 8;
-
-    // Returns true if there are pairs left to read in the buffer, else false.
-    // There are pairs left to read if the read code is not STOP_CODE.
-    return (*code != STOP_CODE);
+    sym_write_at += n;
 }
 
 //
@@ -369,19 +551,122 @@ bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
 // ----------------------------------------------------
 // sym_buffer for read_sym, write_word, and flush_words
 void write_word(int outfile, Word *w) {
-    for (uint32_t i = 0; i < w->len; i++) {
-        // Each symbol of the Word is placed into a buffer.
-        sym_buffer[sym_buffer_index] = w->syms[i];
-        sym_buffer_index += 1;
-        // The buffer is written out when it is filled.
+    // The symbols are copied 16 at a time, which may run up to 15 bytes past the end of both the word,
+    // into its WORD_SLACK, and the buffer's BLOCK, which sym_buffer has plenty of room after. The buffer
+    // is only written out a BLOCK at a time, with whatever ran over moved back to its start.
+    uint8_t *out = sym_buffer + sym_buffer_index;
+    const uint8_t *syms = w->syms;
+    for (uint32_t i = 0; i < w->len; i += 16) {
+        memcpy(out + i, syms + i, 16);
+    }
+    sym_buffer_index += w->len;
+    total_syms += w->len;
+    if (sym_buffer_index >= BLOCK) {
+        int n = sym_buffer_index - sym_buffer_index % BLOCK;
+        sym_buffer_check(n);
+        write_sym_buffer(outfile, n);
+        sym_buffer_index -= n;
+        memmove(sym_buffer, sym_buffer + n, sym_buffer_index);
+    }
+}
+
+void write_run(int outfile, uint8_t sym, uint64_t count) {
+    total_syms += count;
+    // Whole blocks of a run of zeros are seeked over in a sparse output without filling the buffer, unless
+    // they have to be checksummed or kept in memory.
+    bool seek = sym == 0 && sym_sparse && !sym_check && word_tap == NULL && !(sym_keep && sym_kept_at < 0);
+    while (count > 0) {
+        if (seek && sym_buffer_index == 0 && count >= BLOCK) {
+            uint64_t skip = count - count % BLOCK;
+            lseek(outfile, (off_t) skip, SEEK_CUR);
+            sym_sparse_tail = true;
+            count -= skip;
+            continue;
+        }
+        int n = BLOCK - sym_buffer_index;
+        if ((uint64_t) n > count) {
+            n = (int) count;
+        }
+        memset(sym_buffer + sym_buffer_index, sym, n);
+        sym_buffer_index += n;
+        count -= n;
         if (sym_buffer_index == BLOCK) {
-            write_bytes(outfile, sym_buffer, BLOCK);
+            sym_buffer_check(BLOCK);
+            write_sym_buffer(outfile, BLOCK);
             sym_buffer_index = 0;
         }
-        total_syms += 1;
     }
 }
 
+void sparse_words(int outfile) {
+    struct stat info;
+    off_t pos = lseek(outfile, 0, SEEK_CUR);
+    sym_sparse = word_tap == NULL && sym_write_at < 0 && pos >= 0 && fstat(outfile, &info) == 0
+                 && S_ISREG(info.st_mode) && pos >= info.st_size;
+    sym_sparse_tail = false;
+}
+
+void end_sparse_words(int outfile) {
+    if (sym_sparse_tail) {
+        uint8_t zero = 0;
+        lseek(outfile, -1, SEEK_CUR);
+        write_bytes(outfile, &zero, 1);
+        sym_sparse_tail = false;
+    }
+}
+
+void keep_words(int outfile) {
+    uint8_t byte;
+    sym_keep = true;
+    sym_kept_from = total_syms;
+    // A read of no bytes fails unless outfile is a file opened for reading.
+    sym_kept_at = -1;
+    if (word_tap == NULL && pread(outfile, &byte, 0, 0) == 0) {
+        sym_kept_at = sym_write_at >= 0 ? sym_write_at : lseek(outfile, 0, SEEK_CUR);
+    }
+}
+
+bool copy_words(int outfile, uint64_t offset, uint32_t len) {
+    if (!sym_keep || offset + len > total_syms - sym_kept_from) {
+        return false;
+    }
+    // Write out the symbols buffered so far, so that all of the ones being copied can be read back.
+    flush_words(outfile);
+    if (sym_kept_at < 0 && (!sym_keep || offset + DUP_WINDOW < sym_kept_len)) {
+        return false;
+    }
+    total_syms += len;
+    while (len > 0) {
+        int n = BLOCK - sym_buffer_index;
+        if ((uint32_t) n > len) {
+            n = (int) len;
+        }
+        if (sym_kept_at < 0) {
+            // The symbols read come before the ones written, so the ring still has them all.
+            size_t at = (size_t) (offset % DUP_WINDOW);
+            size_t first = (size_t) n < DUP_WINDOW - at ? (size_t) n : DUP_WINDOW - at;
+            memcpy(sym_buffer + sym_buffer_index, sym_kept + at, first);
+            memcpy(sym_buffer + sym_buffer_index + first, sym_kept, n - first);
+        } else {
+            // Past the end of outfile are the zeros of the hole seeked over last, if it ends in one.
+            ssize_t got = pread(outfile, sym_buffer + sym_buffer_index, n, sym_kept_at + (int64_t) offset);
+            if (got < 0 || (got < n && !sym_sparse_tail)) {
+                return false;
+            }
+            memset(sym_buffer + sym_buffer_index + got, 0, n - got);
+        }
+        sym_buffer_index += n;
+        offset += n;
+        len -= n;
+        if (sym_buffer_index == BLOCK) {
+            sym_buffer_check(BLOCK);
+            write_sym_buffer(outfile, BLOCK);
+            sym_buffer_index = 0;
+        }
+    }
+    return true;
+}
+
 //
 // Write any unwritten word symbols from the buffer used by write_word to outfile.
 //
@@ -394,9 +679,146 @@ void flush_words(int outfile) {
     int remaining_bytes = sym_buffer_index;
 
     // write remaining bytes to outfile
-    write_bytes(outfile, sym_buffer, remaining_bytes);
+    sym_buffer_check(remaining_bytes);
+    write_sym_buffer(outfile, remaining_bytes);
 
     // reset buffer and buffer index
     memset(sym_buffer, 0, BLOCK);
     sym_buffer_index = 0;
 }
+
+void bw_init(BitWriter *bw, int outfile) {
+    bw->outfile = outfile;
+    bw->len = 0;
+    bw->nbits = 0;
+    bw->acc = 0;
+    bw->check = false;
+    bw->crc = 0;
+    bw->tee = -1;
+}
+
+void bw_write_block(BitWriter *bw) {
+    if (bw->check) {
+        bw->crc = crc32c(bw->crc, bw->buf, bw->len);
+    }
+    write_bytes(bw->outfile, bw->buf, bw->len);
+    if (bw->tee != -1) {
+        write_bytes(bw->tee, bw->buf, bw->len);
+    }
+    bw->len = 0;
+}
+
+void bw_flush(BitWriter *bw) {
+    // commit the pending bits a byte at a time, the last byte padded with zeros
+    while (bw->nbits > 0) {
+        bw->buf[bw->len] = (uint8_t) bw->acc;
+        bw->len += 1;
+        bw->acc >>= 8;
+        bw->nbits = bw->nbits > 8 ? bw->nbits - 8 : 0;
+    }
+    bw->acc = 0;
+    bw_write_block(bw);
+}
+
+void br_init(BitReader *br, int infile) {
+    br->infile = infile;
+    br->pos = 0;
+    br->len = 0;
+    br->nbits = 0;
+    br->acc = 0;
+    br->check = false;
+    br->crc = 0;
+    br->crc_pos = 0;
+    br->at = -1;
+}
+
+void br_seek(BitReader *br, int64_t bit) {
+    br->at = bit / 8;
+    br->pos = 0;
+    br->len = 0;
+    br->nbits = 0;
+    br->acc = 0;
+    br->crc_pos = 0;
+    uint32_t skipped;
+    br_bits(br, &skipped, (int) (bit % 8));
+}
+
+void br_refill(BitReader *br, int need) {
+    // fast path: load eight bytes at once and keep the ones that fit
+    if (br->len - br->pos >= 8) {
+        uint64_t bytes;
+        memcpy(&bytes, br->buf + br->pos, sizeof(bytes));
+        if (big_endian()) {
+            bytes = swap64(bytes);
+        }
+        int loaded = (63 - br->nbits) / 8;
+        br->acc |= bytes << br->nbits;
+        br->pos += loaded;
+        br->nbits += 8 * loaded;
+        return;
+    }
+    while (br->nbits <= 56) {
+        if (br->pos == br->len) {
+            // only wait for more input if the bits at hand are not enough
+            if (br->nbits >= need) {
+                return;
+            }
+            // The bytes still in acc stay at the front of buf, so that the bytes read so far always end
+            // within buf.
+            int keep = (br->nbits + 7) / 8;
+            if (br->check) {
+                br->crc = crc32c(br->crc, br->buf + br->crc_pos, br->len - keep - br->crc_pos);
+                br->crc_pos = 0;
+            }
+            memmove(br->buf, br->buf + br->len - keep, keep);
+            int bytes_read;
+            if (br->at < 0) {
+                bytes_read = read_some(br->infile, br->buf + keep, BLOCK - keep);
+            } else {
+                bytes_read = (int) pread(br->infile, br->buf + keep, BLOCK - keep, br->at);
+                bytes_read = bytes_read > 0 ? bytes_read : 0;
+                br->at += bytes_read;
+            }
+            br->pos = keep;
+            br->len = keep + bytes_read;
+            if (bytes_read == 0) {
+                return;
+            }
+        }
+        br->acc |= (uint64_t) br->buf[br->pos] << br->nbits;
+        br->pos += 1;
+        br->nbits += 8;
+    }
+}
+
+void br_align(BitReader *br) {
+    int pad = br->nbits % 8;
+    br->acc >>= pad;
+    br->nbits -= pad;
+    total_bits += pad;
+}
+
+uint32_t bw_check(BitWriter *bw) {
+    bw_flush(bw);
+    uint32_t crc = bw->crc;
+    bw->crc = 0;
+    return crc;
+}
+
+uint32_t bw_crc(const BitWriter *bw) {
+    uint8_t pending[8];
+    int n = bw->nbits / 8;
+    for (int i = 0; i < n; i++) {
+        pending[i] = (uint8_t) (bw->acc >> 8 * i);
+    }
+    return crc32c(crc32c(bw->crc, bw->buf, bw->len), pending, n);
+}
+
+uint32_t br_check(BitReader *br) {
+    br_align(br);
+    int end = br->pos - br->nbits / 8;
+    uint32_t crc = crc32c(br->crc, br->buf + br->crc_pos, end - br->crc_pos);
+    br->crc = 0;
+    br->crc_pos = end;
+    return crc;
+}
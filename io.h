@@ -4,18 +4,78 @@
 #include "word.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "endian.h"
 
 #define BLOCK 4096 // 4KB blocks.
+#define SYM_AHEAD (1 << 17) // Most symbols peek_ahead can buffer.
 #define MAGIC 0xBAADBAAC // Unique encoder/decoder magic number.
+#define MAGIC_EXT 0xBAADBAAD // Magic number of streams using the header flags below.
+
+#define FLAG_RUNS 0x0001 // The stream may contain CTRL_RUN blocks.
+#define FLAG_DICT 0x0002 // Codes start after a trained dictionary, whose 32-bit ID follows the header.
+#define FLAG_RESETS 0x0004 // The stream may contain CTRL_RESET pairs.
+#define FLAG_SYNC 0x0008 // The stream may contain CTRL_SYNC pairs.
+#define FLAG_CHECK 0x0010 // The stream has CTRL_CHECK blocks, the last one right before STOP_CODE.
+#define FLAG_DEDUP 0x0020 // The stream may contain CTRL_DUP blocks.
+#define FLAG_FILTER 0x0040 // The symbols are filtered (see filter.h), by the 32-bit filter after the dictionary ID.
+#define FLAG_SOLID 0x0080 // A solid archive: the file table (see solid.h) follows STOP_CODE.
+#define FLAGS_KNOWN \
+    (FLAG_RUNS | FLAG_DICT | FLAG_RESETS | FLAG_SYNC | FLAG_CHECK | FLAG_DEDUP | FLAG_FILTER | FLAG_SOLID)
 
-extern uint64_t total_syms; // To count the symbols processed.
-extern uint64_t total_bits; // To count the bits processed.
+extern _Thread_local uint64_t total_syms; // To count the symbols processed.
+extern _Thread_local uint64_t total_bits; // To count the bits processed.
 
 typedef struct FileHeader {
     uint32_t magic;
     uint16_t protection;
+    uint16_t flags; // Only used with MAGIC_EXT. Was padding in MAGIC headers.
 } FileHeader;
 
+//
+// A BitWriter packs pairs into buf starting with the least significant bit of the first byte, the
+// same layout write_pair produces. Pending bits are kept in a 64-bit accumulator and committed to
+// buf 32 bits at a time, and buf is written out to outfile whenever BLOCK bytes have been committed.
+//
+typedef struct BitWriter {
+    int outfile;
+    int len; // Bytes committed to buf.
+    int nbits; // Bits pending in acc.
+    uint64_t acc;
+    bool check; // Keep the CRC32C of the bytes written out, for bw_check.
+    uint32_t crc;
+    int tee; // Every block written to outfile is also written here, if not -1.
+    uint8_t buf[BLOCK];
+} BitWriter;
+
+//
+// A BitPacker packs bits into memory in the same layout as a BitWriter, for streams built in memory.
+// out must have room for every byte packed. Whole bytes are stored as soon as they are complete.
+//
+typedef struct BitPacker {
+    uint8_t *out; // Where the next byte goes.
+    uint64_t acc;
+    int nbits; // Bits pending in acc, fewer than 8 between calls.
+} BitPacker;
+
+//
+// A BitReader is the reverse of a BitWriter: whole bytes are loaded from buf into the accumulator
+// and pairs are taken from its low bits. buf is refilled from infile BLOCK bytes at a time.
+//
+typedef struct BitReader {
+    int infile;
+    int pos; // Next byte of buf to load into acc.
+    int len; // Bytes of buf holding data.
+    int nbits; // Bits available in acc.
+    uint64_t acc;
+    bool check; // Keep the CRC32C of the bytes read, for br_check.
+    uint32_t crc; // Of the bytes read before buf[crc_pos].
+    int crc_pos;
+    int64_t at; // Offset of infile to read next with pread(), or -1 to read() at the file offset.
+    uint8_t buf[BLOCK];
+} BitReader;
+
 //
 // Read up to to_read bytes from infile and store them in buf. Return the number of bytes actually
 // read.
@@ -27,6 +87,12 @@ typedef struct FileHeader {
 //
 int read_bytes(int infile, uint8_t *buf, int to_read);
 
+//
+// Read whatever is available from infile, up to to_read bytes, into buf with a single read(). Return
+// the number of bytes read, 0 at the end of the file or on an error.
+//
+int read_some(int infile, uint8_t *buf, int to_read);
+
 //
 // Write up to to_write bytes from buf into outfile. Return the number of bytes actually written.
 //
@@ -55,11 +121,10 @@ int write_bytes(int outfile, uint8_t *buf, int to_write);
 // not what we want, so you would have to change the order of those bytes in memory. A little-endian
 // computer will interpret that as 0xBAADBAAC.
 //
-// This function should also make sure the magic number is correct. Since it has no return value you
-// may call assert() to do that, or print out an error message and exit the program, or use some
-// other way to report the error.
+// This function should also make sure the magic number is correct. Returns false if it isn't, or if
+// infile ends before the header does.
 //
-void read_header(int infile, FileHeader *header);
+bool read_header(int infile, FileHeader *header);
 
 //
 // Write a file header from *header to outfile. Like above, this function should swap the byte order
@@ -67,6 +132,17 @@ void read_header(int infile, FileHeader *header);
 //
 void write_header(int outfile, FileHeader *header);
 
+//
+// Write value to outfile as 4 little-endian bytes. Used for the header fields that follow a
+// MAGIC_EXT header.
+//
+void write_u32(int outfile, uint32_t value);
+
+//
+// Read 4 little-endian bytes from infile into *value. Return true if all 4 were read.
+//
+bool read_u32(int infile, uint32_t *value);
+
 //
 // Read one symbol from infile into *sym. Return true if a symbol was successfully read, false
 // otherwise.
@@ -80,6 +156,52 @@ void write_header(int outfile, FileHeader *header);
 //
 bool read_sym(int infile, uint8_t *sym);
 
+//
+// Point *syms at the symbols read_sym has buffered but not returned yet and return how many there
+// are. The buffer is refilled first if it is empty, so 0 is only returned at the end of infile.
+//
+int peek_syms(int infile, uint8_t **syms);
+
+//
+// Like peek_syms, but read from infile until at least want symbols are buffered, or infile ends.
+// want is at most SYM_AHEAD.
+//
+int peek_ahead(int infile, uint8_t **syms, int want);
+
+//
+// Return how many symbols read_sym has buffered, without reading more.
+//
+int buffered_syms(void);
+
+//
+// Drop the symbols read_sym has buffered and any words write_word has buffered but not flushed, to start
+// on a new stream.
+//
+void reset_syms(void);
+
+//
+// Start keeping the CRC32C of the symbols read by read_sym and skip_syms, or written by write_word and
+// write_run, for syms_check. Checking stops at the next reset_syms.
+//
+void check_syms(void);
+
+//
+// Return the CRC32C of the symbols read or written since the last call, or since check_syms.
+//
+uint32_t syms_check(void);
+
+//
+// Consume n of the symbols returned by peek_syms, as if read_sym had been called n times.
+//
+void skip_syms(int n);
+
+//
+// If read_sym has no symbols buffered and the file offset of infile is in a hole, skip to the end of
+// the hole with lseek() rather than reading its zeros, and count them as symbols read. Return how many
+// were skipped: 0 if infile isn't in a hole, or isn't a file with holes.
+//
+uint64_t skip_hole(int infile);
+
 //
 // Write a pair -- bitlen bits of code, followed by all 8 bits of sym -- to outfile.
 //
@@ -130,6 +252,52 @@ bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen);
 //
 void write_word(int outfile, Word *w);
 
+//
+// Write the words of this thread at offset of outfile with pwrite() from now on, like a file of its
+// own. Words go back to being written at the file offset at the next reset_syms.
+//
+void write_words_at(int64_t offset);
+
+//
+// Hands the symbols written with write_word and write_run to fn, with arg, a buffer at a time, instead
+// of writing them to outfile. Called again with fn NULL to write them out again.
+//
+void tap_words(void (*fn)(void *arg, const uint8_t *syms, int n), void *arg);
+
+//
+// Write count copies of sym into outfile, through the same buffer as write_word.
+//
+void write_run(int outfile, uint8_t sym, uint64_t count);
+
+//
+// Seek over the whole blocks of zeros written with write_word, write_run and copy_words from now on,
+// leaving holes in outfile, if it is a regular file being written at its end. Stops at the next
+// reset_syms. Called at the start of a stream, with no words buffered.
+//
+void sparse_words(int outfile);
+
+//
+// Write the last zero of the hole outfile ends in, if the last block written since sparse_words was
+// seeked over, so that the file gets its whole size. Called once at the end of a stream, after
+// flush_words: a hole in the middle of the stream is filled in by whatever is written after it.
+//
+void end_sparse_words(int outfile);
+
+//
+// Let copy_words read back the symbols written with write_word, write_run and copy_words from now on:
+// from outfile, if it is a file that can be read, or else from a copy of the last DUP_WINDOW of them
+// kept in memory. Keeping them stops at the next reset_syms. Called at the start of a stream, with no
+// words buffered.
+//
+void keep_words(int outfile);
+
+//
+// Write the len symbols written offset symbols after keep_words again, through the same buffer as
+// write_word. Return false if they haven't all been written yet or can't be read back, as when they
+// are more than DUP_WINDOW symbols back and outfile can't be read.
+//
+bool copy_words(int outfile, uint64_t offset, uint32_t len);
+
 //
 // Write any unwritten word symbols from the buffer used by write_word to outfile.
 //
@@ -138,4 +306,147 @@ void write_word(int outfile, Word *w);
 //
 void flush_words(int outfile);
 
+//
+// Initialize bw to write pairs to outfile.
+//
+void bw_init(BitWriter *bw, int outfile);
+
+//
+// Write the BLOCK committed bytes of bw->buf to bw->outfile. Called by bw_pair when buf fills up.
+//
+void bw_write_block(BitWriter *bw);
+
+//
+// Write out every pair pending in bw, padding the last byte with zero bits. The writer is left
+// empty and can keep being used afterwards.
+//
+void bw_flush(BitWriter *bw);
+
+//
+// Initialize br to read pairs from infile.
+//
+void br_init(BitReader *br, int infile);
+
+//
+// Start reading br's infile at bit offset bit of the file with pread(), leaving the file offset alone.
+//
+void br_seek(BitReader *br, int64_t bit);
+
+//
+// Load as many bytes as fit into br's accumulator. If buf runs out before need bits are available,
+// wait for more input from infile. Fewer than need bits are left in br->nbits only at the end of the
+// input.
+//
+void br_refill(BitReader *br, int need);
+
+//
+// Skip the bits left before the next byte boundary of the stream, as written by bw_flush. The
+// skipped bits are added to total_bits.
+//
+void br_align(BitReader *br);
+
+//
+// Write out every pair pending in bw like bw_flush, and return the CRC32C of the bytes written since
+// the last call. bw->check must be set.
+//
+uint32_t bw_check(BitWriter *bw);
+
+//
+// Returns the CRC32C that bw_check would return for the whole bytes written to bw so far, without
+// writing anything out.
+//
+uint32_t bw_crc(const BitWriter *bw);
+
+//
+// Skip to the next byte boundary like br_align, and return the CRC32C of the bytes read since the
+// last call. br->check must be set.
+//
+uint32_t br_check(BitReader *br);
+
+//
+// Write the low nbits bits of value to bw, least significant bit first. nbits is at most 32.
+//
+static inline __attribute__((always_inline)) void bw_bits(BitWriter *bw, uint32_t value, int nbits) {
+    bw->acc |= (uint64_t) value << bw->nbits;
+    bw->nbits += nbits;
+    // At most 31 + 32 bits are ever pending, so a single commit is enough.
+    if (bw->nbits >= 32) {
+        uint32_t bits = (uint32_t) bw->acc;
+        if (big_endian()) {
+            bits = swap32(bits);
+        }
+        memcpy(bw->buf + bw->len, &bits, sizeof(bits));
+        bw->len += sizeof(bits);
+        bw->acc >>= 32;
+        bw->nbits -= 32;
+        if (bw->len == BLOCK) {
+            bw_write_block(bw);
+        }
+    }
+}
+
+//
+// Write a pair -- bitlen bits of code, followed by all 8 bits of sym -- to bw.
+//
+// This is the kernel behind write_pair. It is always inlined so that the width-specialized encode
+// loops, which pass bitlen as a constant, get constant shifts and no loop over the bits.
+//
+static inline __attribute__((always_inline)) void bw_pair(
+    BitWriter *bw, uint16_t code, uint8_t sym, int bitlen) {
+    bw_bits(bw, (uint32_t) code | (uint32_t) sym << bitlen, bitlen + 8);
+}
+
+//
+// Pack the low nbits bits of value into bp, least significant bit first. nbits is at most 32.
+//
+static inline __attribute__((always_inline)) void bp_bits(BitPacker *bp, uint32_t value, int nbits) {
+    bp->acc |= (uint64_t) value << bp->nbits;
+    bp->nbits += nbits;
+    while (bp->nbits >= 8) {
+        *bp->out++ = (uint8_t) bp->acc;
+        bp->acc >>= 8;
+        bp->nbits -= 8;
+    }
+}
+
+//
+// Pack a pair into bp, like bw_pair.
+//
+static inline __attribute__((always_inline)) void bp_pair(BitPacker *bp, uint16_t code, uint8_t sym, int bitlen) {
+    bp_bits(bp, (uint32_t) code | (uint32_t) sym << bitlen, bitlen + 8);
+}
+
+//
+// Read nbits bits, least significant bit first, from br into *value. nbits is at most 32. Return
+// true if all of them were read and false otherwise.
+//
+static inline __attribute__((always_inline)) bool br_bits(BitReader *br, uint32_t *value, int nbits) {
+    if (br->nbits < nbits) {
+        br_refill(br, nbits);
+        if (br->nbits < nbits) {
+            return false;
+        }
+    }
+    *value = (uint32_t) (br->acc & ((UINT64_C(1) << nbits) - 1));
+    br->acc >>= nbits;
+    br->nbits -= nbits;
+    return true;
+}
+
+//
+// Read bitlen bits of a code into *code, and then a full 8-bit symbol into *sym, from br.
+// Return true if the complete pair was read and false otherwise. Unlike read_pair, STOP_CODE is
+// returned to the caller like any other code.
+//
+static inline __attribute__((always_inline)) bool br_pair(
+    BitReader *br, uint16_t *code, uint8_t *sym, int bitlen) {
+    uint32_t bits;
+    if (!br_bits(br, &bits, bitlen + 8)) {
+        return false;
+    }
+    *code = (uint16_t) (bits & ((UINT32_C(1) << bitlen) - 1));
+    *sym = (uint8_t) (bits >> bitlen);
+    return true;
+}
+
 #endif
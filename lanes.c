@@ -0,0 +1,266 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "chain.h"
+#include "code.h"
+#include "dict.h"
+#include "io.h"
+#include "lanes.h"
+#include "run.h"
+
+// Most bytes the pairs of a chunk can take: every pair adds at least one symbol, and takes at most 24
+// bits, as do the pair of the last phrase and any run block.
+#define LANE_BOUND (3 * LANE_CHUNK + 8)
+
+// one chunk of the input, and where the walk over it is
+typedef struct Lane {
+    ChainTrie *chains; // With the dictionary loaded and saved, to be restored for each chunk.
+    const uint8_t *syms;
+    uint32_t len;
+    uint32_t i; // The next symbol to walk.
+    uint32_t chain; // Where the walk is in the trie.
+    uint32_t depth;
+    uint16_t next_code;
+    BitPacker bp;
+    uint8_t *out; // The pairs of the chunk are packed here...
+    uint64_t bits; // ...taking this many bits, once the chunk is done.
+} Lane;
+
+// the chunks of one round of encode_lanes, taken a group of lanes at a time by its threads
+typedef struct LaneJob {
+    Lane *lanes; // One for each chunk a round can have.
+    int width; // Lanes in a group.
+    uint32_t chunks; // Chunks in this round.
+    uint32_t groups;
+    bool runs;
+    uint16_t first_code;
+    _Atomic uint32_t next;
+} LaneJob;
+
+// Starts walking the len symbols of syms from the top of the dictionary.
+static void lane_start(Lane *l, const uint8_t *syms, uint32_t len, uint16_t first_code) {
+    chain_trie_restore(l->chains);
+    l->syms = syms;
+    l->len = len;
+    l->i = 0;
+    l->chain = 0;
+    l->depth = 0;
+    l->next_code = first_code;
+    l->bp = (BitPacker) { .out = l->out, .acc = 0, .nbits = 0 };
+}
+
+// Takes one step of the walk of lane l, then prefetches what the next step reads first. The steps
+// are the ones batch_walk takes, only cut at every comparison, lookup and pair.
+static inline __attribute__((always_inline)) void lane_step(const LaneJob *job, Lane *l) {
+    ChainTrie *t = l->chains;
+    const uint8_t *syms = l->syms;
+    uint32_t i = l->i;
+    if (l->chain == 0 && job->runs && l->len - i >= RUN_MIN && run_length(syms + i, RUN_MIN) == RUN_MIN) {
+        uint32_t count = run_length(syms + i, l->len - i);
+        int bitlen = bit_len(l->next_code);
+        bp_pair(&l->bp, STOP_CODE, CTRL_RUN, bitlen);
+        bp_bits(&l->bp, syms[i], 8);
+        bp_bits(&l->bp, count, 32);
+        l->i = i + count;
+        if (l->i < l->len) {
+            chain_trie_prefetch(t, EMPTY_CODE, syms[l->i]);
+        }
+        return;
+    }
+    Chain *ch = &t->chains[l->chain];
+    uint32_t below = ch->len - 1 - l->depth;
+    if (below > 0) {
+        uint32_t span = l->len - i < below ? l->len - i : below;
+        uint32_t same = common_prefix(syms + i, ch->syms + l->depth + 1, span);
+        l->i = i + same;
+        l->depth += same;
+        if (same == span) {
+            // At the end of the chain, the next step looks up the child of its last node.
+            if (same == below && ch->forks && l->i < l->len) {
+                chain_trie_prefetch(t, ch->codes[l->depth], syms[l->i]);
+            }
+            return;
+        }
+        i = l->i;
+    } else if (ch->forks) {
+        uint32_t next = chain_trie_child(t, ch->codes[l->depth], syms[i]);
+        if (next != 0) {
+            l->chain = next;
+            l->depth = 0;
+            l->i = i + 1;
+            __builtin_prefetch(&t->chains[next]);
+            return;
+        }
+    }
+    bp_pair(&l->bp, ch->codes[l->depth], syms[i], bit_len(l->next_code));
+    chain_trie_add(t, l->chain, l->depth, syms[i], l->next_code);
+    l->i = i + 1;
+    l->chain = 0;
+    l->depth = 0;
+    l->next_code += 1;
+    if (l->next_code == MAX_CODE) {
+        chain_trie_restore(t);
+        l->next_code = job->first_code;
+    }
+    if (l->i < l->len) {
+        chain_trie_prefetch(t, EMPTY_CODE, syms[l->i]);
+    }
+}
+
+// Packs the phrase lane l was still matching at the end of its chunk as a pair of its own, the way
+// encode_pending does, and the last bits of the chunk.
+static void lane_end(const LaneJob *job, Lane *l) {
+    if (l->chain != 0) {
+        uint16_t code = 0;
+        uint8_t sym = 0;
+        chain_trie_pair(l->chains, l->chain, l->depth, &code, &sym);
+        bp_pair(&l->bp, code, sym, bit_len(l->next_code));
+        l->next_code += 1;
+        if (l->next_code == MAX_CODE) {
+            l->next_code = job->first_code;
+        }
+    }
+    l->bits = 8 * (uint64_t) (l->bp.out - l->out) + l->bp.nbits;
+    *l->bp.out = (uint8_t) l->bp.acc;
+}
+
+// Walks the count lanes of a group in lockstep until all of their chunks are done.
+static void walk_lanes(const LaneJob *job, Lane *lanes, int count) {
+    // A lane of its own has no other lanes' misses to overlap with.
+    if (count == 1) {
+        while (lanes->i < lanes->len) {
+            lane_step(job, lanes);
+        }
+        lane_end(job, lanes);
+        return;
+    }
+    int live[LANES_MAX];
+    for (int k = 0; k < count; k++) {
+        live[k] = k;
+    }
+    while (count > 0) {
+        for (int k = 0; k < count;) {
+            Lane *l = &lanes[live[k]];
+            if (l->i == l->len) {
+                lane_end(job, l);
+                count -= 1;
+                live[k] = live[count];
+                continue;
+            }
+            lane_step(job, l);
+            k += 1;
+        }
+    }
+}
+
+// encode_lanes thread: walks groups of lanes until there are none left
+static void *lane_worker(void *arg) {
+    LaneJob *job = (LaneJob *) arg;
+    uint32_t g;
+    while ((g = atomic_fetch_add(&job->next, 1)) < job->groups) {
+        uint32_t first = g * job->width;
+        uint32_t count = job->chunks - first < (uint32_t) job->width ? job->chunks - first : (uint32_t) job->width;
+        walk_lanes(job, job->lanes + first, (int) count);
+    }
+    return NULL;
+}
+
+// Runs job on up to threads threads, the calling thread being one of them.
+static void run_lanes(LaneJob *job, int threads) {
+    int workers_count = (uint32_t) threads < job->groups ? threads : (int) job->groups;
+    pthread_t *workers = (pthread_t *) malloc(workers_count * sizeof(pthread_t));
+    atomic_store(&job->next, 0);
+    for (int i = 1; i < workers_count; i++) {
+        pthread_create(&workers[i], NULL, lane_worker, job);
+    }
+    lane_worker(job);
+    for (int i = 1; i < workers_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
+
+// Writes the nbits bits packed at bytes to bw, as if they had been written to it pair by pair.
+static void write_packed(BitWriter *bw, const uint8_t *bytes, uint64_t nbits) {
+    for (; nbits >= 32; nbits -= 32, bytes += 4) {
+        bw_bits(bw, (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24,
+            32);
+    }
+    for (; nbits > 0; bytes += 1) {
+        int n = nbits < 8 ? (int) nbits : 8;
+        bw_bits(bw, bytes[0] & ((1u << n) - 1), n);
+        nbits -= n;
+    }
+}
+
+void encode_lanes(int infile, int outfile, const EncodeOptions *opts, int threads) {
+    uint32_t room = (uint32_t) threads * opts->lanes;
+    LaneJob job = { .width = opts->lanes, .runs = opts->runs, .first_code = START_CODE };
+    if (opts->dict != NULL) {
+        job.first_code = dict_next_code(opts->dict);
+    }
+    job.lanes = (Lane *) calloc(room, sizeof(Lane));
+    for (uint32_t k = 0; k < room; k++) {
+        job.lanes[k].chains = chain_trie_create();
+        if (opts->dict != NULL) {
+            dict_load_chains(opts->dict, job.lanes[k].chains);
+        }
+        chain_trie_save(job.lanes[k].chains);
+        job.lanes[k].out = (uint8_t *) malloc(LANE_BOUND);
+    }
+    uint8_t *input = (uint8_t *) malloc((size_t) room * LANE_CHUNK);
+
+    BitWriter bw;
+    bw_init(&bw, outfile);
+    int bitlen = bit_len(job.first_code);
+    bool first = true;
+    bool more = true;
+    while (more) {
+        // A round is a chunk for every lane of every thread, unless the input runs out first.
+        job.chunks = 0;
+        while (job.chunks < room) {
+            uint8_t *syms = input + (size_t) job.chunks * LANE_CHUNK;
+            int len = read_bytes(infile, syms, LANE_CHUNK);
+            if (len > 0) {
+                lane_start(&job.lanes[job.chunks], syms, (uint32_t) len, job.first_code);
+                job.chunks += 1;
+                total_syms += len;
+            }
+            if (len < LANE_CHUNK) {
+                more = false;
+                break;
+            }
+        }
+        if (job.chunks == 0) {
+            break;
+        }
+        job.groups = (job.chunks + job.width - 1) / job.width;
+        run_lanes(&job, threads);
+
+        // Every chunk after the first tells the decoder to reset, as the chunk starts from the dictionary.
+        for (uint32_t k = 0; k < job.chunks; k++) {
+            Lane *l = &job.lanes[k];
+            if (!first) {
+                bw_pair(&bw, STOP_CODE, CTRL_RESET, bitlen);
+                total_bits += bitlen + 8;
+            }
+            write_packed(&bw, l->out, l->bits);
+            total_bits += l->bits;
+            bitlen = bit_len(l->next_code);
+            first = false;
+        }
+    }
+    bw_pair(&bw, STOP_CODE, 0, bitlen);
+    total_bits += bitlen + 8;
+    bw_flush(&bw);
+
+    for (uint32_t k = 0; k < room; k++) {
+        chain_trie_delete(job.lanes[k].chains);
+        free(job.lanes[k].out);
+    }
+    free(job.lanes);
+    free(input);
+}
@@ -0,0 +1,25 @@
+#ifndef __LANES_H__
+#define __LANES_H__
+
+#include "encoder.h"
+
+#define LANE_CHUNK (1 << 20) // Bytes of input each lane encodes from a reset dictionary.
+#define LANES_MAX 16 // Most lanes one thread walks in lockstep.
+
+//
+// Encode everything in infile to outfile, after the header, as chunks of LANE_CHUNK bytes that each
+// start from a reset dictionary, with a CTRL_RESET pair between them.
+//
+// Each thread walks opts->lanes chunks at a time in lockstep, each with a trie of its own: one step
+// of lane 0, then of lane 1, and so on round-robin, where a step is a comparison along a chain, a
+// lookup in the child table, or a pair. Before moving on from a lane, it prefetches what that lane's
+// next step reads first, so that the cache misses of all of its lanes are in flight together rather
+// than one after the other. threads threads, the calling thread being one of them, take the groups
+// of chunks, and the chunks are written out in order.
+//
+// Runs are looked for at the start of every phrase, so the chunks are the pairs encode_stream writes
+// for them, but for where runs are found.
+//
+void encode_lanes(int infile, int outfile, const EncodeOptions *opts, int threads);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> //getopt().
+#include <fcntl.h> // read open
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "code.h"
+#include "dict.h"
+#include "encoder.h"
+#include "io.h"
+
+#define OPTIONS "n:b:D:zh"
+#define PROTECTION 0644 // The protection bits of every stream.
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// Reads all of path into memory, setting *len. Returns NULL if it can't be read.
+static uint8_t *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0) {
+        return NULL;
+    }
+    uint8_t *data = (uint8_t *) malloc(info.st_size + 1);
+    *len = 0;
+    int n;
+    while (*len < (size_t) info.st_size
+           && (n = read_bytes(fd, data + *len, (int) ((size_t) info.st_size - *len))) > 0) {
+        *len += n;
+    }
+    close(fd);
+    return data;
+}
+
+// Makes log-like records for when no samples are given: similar, but never quite the same.
+static uint8_t *make_records(size_t count, size_t *len) {
+    static const char *levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+    static const char *paths[] = { "/api/users", "/api/orders", "/static/app.js", "/health" };
+    uint8_t *data = (uint8_t *) malloc(count * 160);
+    *len = 0;
+    uint32_t x = 12345;
+    for (size_t i = 0; i < count; i++) {
+        x = x * 1103515245 + 12345;
+        *len += sprintf((char *) data + *len,
+            "{\"ts\":%zu,\"level\":\"%s\",\"path\":\"%s\",\"status\":%u,\"user\":%u,\"ms\":%u}\n",
+            1700000000 + i, levels[x >> 30], paths[(x >> 28) & 3], x >> 29 ? 200 : 404, (x >> 8) & 0xFFFF,
+            (x >> 4) & 0xFF);
+    }
+    return data;
+}
+
+// Encodes every message to a stream of its own the way a caller of the stream API has to: with a new
+// encoder, through files. Returns the seconds taken, and keeps the streams in streams.
+static double per_message(const Message *msgs, size_t count, const EncodeOptions *opts, uint8_t *streams,
+    size_t *offsets) {
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    int infile = fileno(in);
+    int outfile = fileno(out);
+    size_t at = 0;
+    double start = now_sec();
+    for (size_t m = 0; m < count; m++) {
+        if (pwrite(infile, msgs[m].data, msgs[m].len, 0) != (ssize_t) msgs[m].len || ftruncate(infile, msgs[m].len) != 0
+            || ftruncate(outfile, 0) != 0) {
+            fprintf(stderr, "Error: unable to write temporary file\n");
+            exit(1);
+        }
+        lseek(infile, 0, SEEK_SET);
+        lseek(outfile, 0, SEEK_SET);
+        Encoder *e = encoder_create();
+        encode_header(outfile, opts, PROTECTION);
+        encode_stream(e, infile, outfile, opts);
+        encoder_delete(e);
+        off_t len = lseek(outfile, 0, SEEK_CUR);
+        offsets[m] = at;
+        at += pread(outfile, streams + at, len, 0);
+    }
+    offsets[count] = at;
+    double secs = now_sec() - start;
+    fclose(in);
+    fclose(out);
+    return secs;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    size_t count = 50000;
+    size_t batch = 1024;
+    char *dict_name = NULL;
+    EncodeOptions opts;
+    memset(&opts, 0, sizeof(opts));
+
+    const char *help_message
+        = "SYNOPSIS\n"
+          "   Benchmarks compressing many small messages with the batch API against encoding\n"
+          "   each one as a stream of its own. The messages are the lines of the samples, or\n"
+          "   made-up log records if there are none.\n"
+          "\n"
+          "USAGE\n"
+          "   ./lz78bench [-zh] [-n count] [-b batch] [-D dict] [sample ...]\n"
+          "\n"
+          "OPTIONS\n"
+          "   -n count    Number of messages (50000 by default)\n"
+          "   -b batch    Messages per batch (1024 by default)\n"
+          "   -D dict     Encode with this trained dictionary\n"
+          "   -z          Encode runs of one symbol as run blocks\n"
+          "   -h          Display program usage\n";
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'n': count = strtoul(optarg, NULL, 10); break;
+        case 'b': batch = strtoul(optarg, NULL, 10); break;
+        case 'D': dict_name = optarg; break;
+        case 'z': opts.runs = true; break;
+        case 'h': printf("%s", help_message); return 1;
+        default: fprintf(stderr, "Usage: %s [-n count] [-b batch] [-D dict] [-z] [-h] [sample ...]\n", argv[0]); exit(1);
+        }
+    }
+    if (count == 0 || batch == 0) {
+        fprintf(stderr, "Error: count and batch must be at least 1\n");
+        exit(1);
+    }
+    if (dict_name != NULL) {
+        opts.dict = dict_open(dict_name);
+        if (opts.dict == NULL) {
+            fprintf(stderr, "Error: unable to load dictionary -- '%s'\n", dict_name);
+            exit(1);
+        }
+    }
+
+    // The records: every line of the samples, in turn, until there are count of them.
+    size_t len = 0;
+    uint8_t *data = NULL;
+    if (optind == argc) {
+        data = make_records(count, &len);
+    }
+    for (int i = optind; i < argc; i++) {
+        size_t n = 0;
+        uint8_t *sample = read_file(argv[i], &n);
+        if (sample == NULL) {
+            fprintf(stderr, "Error: unable to open sample file -- '%s'\n", argv[i]);
+            exit(1);
+        }
+        data = (uint8_t *) realloc(data, len + n);
+        memcpy(data + len, sample, n);
+        len += n;
+        free(sample);
+    }
+    if (len == 0) {
+        fprintf(stderr, "Error: the samples are empty\n");
+        exit(1);
+    }
+    Message *msgs = (Message *) malloc(count * sizeof(Message));
+    size_t pos = 0;
+    size_t total = 0;
+    for (size_t m = 0; m < count; m++) {
+        if (pos == len) {
+            pos = 0;
+        }
+        const uint8_t *nl = (const uint8_t *) memchr(data + pos, '\n', len - pos);
+        size_t end = nl != NULL ? (size_t) (nl - data) + 1 : len;
+        msgs[m].data = data + pos;
+        msgs[m].len = end - pos;
+        total += msgs[m].len;
+        pos = end;
+    }
+
+    BatchEncoder *b = batch_encoder_create(&opts, PROTECTION);
+    Message *out = (Message *) malloc(count * sizeof(Message));
+    size_t batch_bytes = 0;
+    uint8_t *batch_streams = (uint8_t *) malloc(4 * total + 16 * count);
+    size_t at = 0;
+    double start = now_sec();
+    for (size_t m = 0; m < count; m += batch) {
+        size_t n = count - m < batch ? count - m : batch;
+        if (!batch_encode(b, msgs + m, out + m, n)) {
+            fprintf(stderr, "Error: unable to allocate the batch arena\n");
+            exit(1);
+        }
+        // The streams only last until the next batch.
+        for (size_t k = m; k < m + n; k++) {
+            memcpy(batch_streams + at, out[k].data, out[k].len);
+            out[k].data = batch_streams + at;
+            at += out[k].len;
+            batch_bytes += out[k].len;
+        }
+    }
+    double batch_secs = now_sec() - start;
+
+    uint8_t *streams = (uint8_t *) malloc(4 * total + 16 * count);
+    size_t *offsets = (size_t *) malloc((count + 1) * sizeof(size_t));
+    double single_secs = per_message(msgs, count, &opts, streams, offsets);
+
+    // Without runs both write exactly the same streams.
+    size_t differ = 0;
+    for (size_t m = 0; m < count; m++) {
+        if (out[m].len != offsets[m + 1] - offsets[m] || memcmp(out[m].data, streams + offsets[m], out[m].len) != 0) {
+            differ += 1;
+        }
+    }
+
+    printf("Messages: %zu of %.1f bytes on average, compressed to %.1f%% of that\n", count, (double) total / count,
+        100.0 * (double) batch_bytes / (double) total);
+    printf("Batch API:   %10.0f messages/s %8.2f MB/s\n", count / batch_secs, total / batch_secs / 1e6);
+    printf("Per message: %10.0f messages/s %8.2f MB/s\n", count / single_secs, total / single_secs / 1e6);
+    printf("Speedup: %.1fx\n", single_secs / batch_secs);
+    if (opts.runs) {
+        printf("Streams differing: %zu (runs are looked for at every phrase in a batch)\n", differ);
+    } else {
+        printf("Streams differing: %zu\n", differ);
+    }
+
+    batch_encoder_delete(b);
+    free(offsets);
+    free(streams);
+    free(batch_streams);
+    free(out);
+    free(msgs);
+    free(data);
+    dict_close(opts.dict);
+    return !opts.runs && differ != 0;
+}
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE // memfd_create().
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> //getopt().
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "decoder.h"
+#include "dict.h"
+#include "encoder.h"
+#include "filter.h"
+#include "io.h"
+#include "lz78d.h"
+
+#define OPTIONS "s:t:D:vh"
+
+#define LZ78D_QUEUE 64 // Accepted connections waiting for a worker.
+
+// the daemon: accepted connections wait in queue for the next free worker
+typedef struct Server {
+    Dict *dict; // Shared by every worker. NULL if the daemon has none.
+    bool verbose;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int queue[LZ78D_QUEUE];
+    int head;
+    int len;
+} Server;
+
+// what each worker keeps from one request to the next
+typedef struct Worker {
+    Server *server;
+    Encoder *encoder;
+    Decoder *decoder;
+    int memfd; // Holds inline output until its length is known.
+    char error[128]; // Why the last request failed.
+} Worker;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+static void queue_push(Server *s, int client) {
+    pthread_mutex_lock(&s->lock);
+    while (s->len == LZ78D_QUEUE) {
+        pthread_cond_wait(&s->not_full, &s->lock);
+    }
+    s->queue[(s->head + s->len) % LZ78D_QUEUE] = client;
+    s->len += 1;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int queue_pop(Server *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->len == 0) {
+        pthread_cond_wait(&s->not_empty, &s->lock);
+    }
+    int client = s->queue[s->head];
+    s->head = (s->head + 1) % LZ78D_QUEUE;
+    s->len -= 1;
+    pthread_cond_signal(&s->not_full);
+    pthread_mutex_unlock(&s->lock);
+    return client;
+}
+
+// Reads the next request from client into *req, with the descriptors passed along with it in fds.
+// Returns the number of descriptors, or -1 if the connection ended or the request is cut short.
+static int read_request(int client, Lz78dRequest *req, int fds[2]) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = req, .iov_len = sizeof(Lz78dRequest) };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return -1;
+    }
+
+    int nfds = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            int count = (int) ((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                if (nfds < 2) {
+                    fds[nfds++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    // The rest of a request split across reads.
+    int rest = (int) (sizeof(Lz78dRequest) - (size_t) n);
+    if (rest > 0 && read_bytes(client, (uint8_t *) req + n, rest) != rest) {
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+    return nfds;
+}
+
+static bool send_reply(int client, uint32_t status, uint64_t length) {
+    Lz78dReply reply = { .status = status, .reserved = 0, .length = length };
+    return write_bytes(client, (uint8_t *) &reply, sizeof(reply)) == sizeof(reply);
+}
+
+static bool send_error(int client, uint32_t status, const char *message) {
+    size_t len = strlen(message);
+    return send_reply(client, status, len) && write_bytes(client, (uint8_t *) message, (int) len) == (int) len;
+}
+
+// Encodes or decodes infile to outfile for req. Returns the status, and the length of the output in
+// *length or an error message in w->error.
+static uint32_t serve_request(Worker *w, const Lz78dRequest *req, int infile, int outfile, uint64_t *length) {
+    Dict *dict = w->server->dict;
+    total_syms = 0;
+    total_bits = 0;
+
+    if (req->op == LZ78D_ENCODE) {
+        if ((req->flags & LZ78D_DICT) && dict == NULL) {
+            snprintf(w->error, sizeof(w->error), "the daemon has no dictionary");
+            return LZ78D_INVALID;
+        }
+        EncodeOptions opts = {
+            .dict = (req->flags & LZ78D_DICT) ? dict : NULL,
+            .runs = (req->flags & LZ78D_RUNS) != 0,
+            .mem_limit = 0,
+            .flush_ms = 0,
+            .flush_bytes = 0,
+            .check = (req->flags & LZ78D_CHECK) != 0,
+            .flexible = false,
+            .verify = NULL,
+            .dedup = false,
+            .checkpoint = NULL,
+        };
+        // Inline input has no protection bits of its own.
+        struct stat protection_bits;
+        if (fstat(infile, &protection_bits) != 0 || !S_ISREG(protection_bits.st_mode)) {
+            protection_bits.st_mode = 0644;
+        }
+        encode_header(outfile, &opts, protection_bits.st_mode);
+        encode_stream(w->encoder, infile, outfile, &opts);
+        *length = sizeof(FileHeader) + (opts.dict != NULL ? sizeof(uint32_t) : 0) + (total_bits + 7) / 8;
+        return LZ78D_OK;
+    }
+
+    if (req->op == LZ78D_DECODE) {
+        FileHeader header;
+        if (!decode_header(w->decoder, infile, &header, dict)) {
+            snprintf(w->error, sizeof(w->error), "%s", w->decoder->error);
+            return LZ78D_CORRUPT;
+        }
+        FilterOutput unfilter;
+        if (w->decoder->filter != FILTER_NONE) {
+            filter_output_start(&unfilter, outfile, w->decoder->filter);
+        }
+        bool ok = decode_stream(w->decoder, infile, outfile, (header.flags & FLAG_DICT) ? dict : NULL);
+        if (w->decoder->filter != FILTER_NONE) {
+            filter_output_finish(&unfilter);
+        }
+        if (!ok) {
+            snprintf(w->error, sizeof(w->error), "%s", w->decoder->error);
+            return LZ78D_CORRUPT;
+        }
+        *length = total_syms;
+        return LZ78D_OK;
+    }
+
+    snprintf(w->error, sizeof(w->error), "unknown op -- %u", req->op);
+    return LZ78D_INVALID;
+}
+
+// Serves the requests on client until it closes the connection or sends inline input.
+static void serve_client(Worker *w, int client) {
+    Lz78dRequest req;
+    int fds[2];
+    int nfds;
+    while ((nfds = read_request(client, &req, fds)) >= 0) {
+        bool inline_io = !(req.flags & LZ78D_FDS);
+        uint32_t status = LZ78D_OK;
+        uint64_t length = 0;
+        if (req.magic != LZ78D_MAGIC) {
+            snprintf(w->error, sizeof(w->error), "bad request magic -- 0x%08x", req.magic);
+            status = LZ78D_INVALID;
+        } else if (nfds != (inline_io ? 0 : 2)) {
+            snprintf(w->error, sizeof(w->error), "request needs %d descriptors, not %d",
+                inline_io ? 0 : 2, nfds);
+            status = LZ78D_INVALID;
+        } else if (inline_io) {
+            // The output of the last inline request is still in memfd. If it can't be emptied it would be
+            // sent again, so the connection is dropped instead.
+            if (ftruncate(w->memfd, 0) != 0 || lseek(w->memfd, 0, SEEK_SET) != 0) {
+                return;
+            }
+            status = serve_request(w, &req, client, w->memfd, &length);
+            length = (uint64_t) lseek(w->memfd, 0, SEEK_CUR);
+        } else {
+            status = serve_request(w, &req, fds[0], fds[1], &length);
+        }
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        // Whatever inline input wasn't used is read anyway. Closing a socket with unread input would reset
+        // the connection before the client reads the reply.
+        if (inline_io) {
+            uint8_t rest[BLOCK];
+            while (read_some(client, rest, BLOCK) > 0) {
+            }
+        }
+
+        if (w->server->verbose) {
+            fprintf(stderr, "lz78d: %s %lu -> %lu bytes, status %u\n", req.op == LZ78D_DECODE ? "decode" : "encode",
+                req.op == LZ78D_DECODE ? total_bits / 8 : total_syms, length, status);
+        }
+
+        bool sent;
+        if (status != LZ78D_OK) {
+            sent = send_error(client, status, w->error);
+        } else if (inline_io) {
+            sent = send_reply(client, status, length);
+            off_t offset = 0;
+            while (sent && (uint64_t) offset < length) {
+                sent = sendfile(client, w->memfd, &offset, length - (uint64_t) offset) > 0;
+            }
+        } else {
+            sent = send_reply(client, status, length);
+        }
+        if (!sent || inline_io) {
+            return;
+        }
+    }
+}
+
+// worker thread: serves one connection at a time, with an encoder and a decoder kept warm
+static void *serve(void *arg) {
+    Worker *w = (Worker *) arg;
+    w->encoder = encoder_create();
+    w->decoder = decoder_create();
+    w->memfd = memfd_create("lz78d", MFD_CLOEXEC);
+    if (w->encoder == NULL || w->decoder == NULL || w->memfd == -1) {
+        fprintf(stderr, "Error: unable to start worker\n");
+        exit(1);
+    }
+    for (;;) {
+        int client = queue_pop(w->server);
+        serve_client(w, client);
+        close(client);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    int verbose = 0;
+    char *socket_name = "/tmp/lz78d.sock";
+    char *dict_name = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char *help_message
+        = "SYNOPSIS\n"
+          "   Serves LZ78 compression and decompression requests over a Unix domain socket.\n"
+          "   The protocol is described in lz78d.h.\n\n"
+          "USAGE\n"
+          "   ./lz78d [-vh] [-s socket] [-t threads] [-D dict]\n\n"
+          "OPTIONS\n"
+          "   -v          Log every request to stderr\n"
+          "   -s socket   Path of the socket to listen on (/tmp/lz78d.sock by default)\n"
+          "   -t threads  Number of worker threads (one per processor by default)\n"
+          "   -D dict     Dictionary for requests that ask for one\n"
+          "   -h          Display program help and usage\n";
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 's': socket_name = optarg; break;
+        case 't': threads = strtol(optarg, NULL, 10); break;
+        case 'D': dict_name = optarg; break;
+        case 'v': verbose = 1; break;
+        case 'h': printf("%s", help_message); return 1;
+        default: fprintf(stderr, "Usage: %s [-s socket] [-t threads] [-D dict] [-v] [-h]\n", argv[0]); exit(1);
+        }
+    }
+    if (threads < 1) {
+        fprintf(stderr, "Error: invalid number of threads\n");
+        exit(1);
+    }
+
+    Server server = { .dict = NULL, .verbose = verbose, .head = 0, .len = 0 };
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.not_empty, NULL);
+    pthread_cond_init(&server.not_full, NULL);
+    if (dict_name != NULL) {
+        server.dict = dict_open(dict_name);
+        if (server.dict == NULL) {
+            fprintf(stderr, "Error: unable to load dictionary -- '%s'\n", dict_name);
+            exit(1);
+        }
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long -- '%s'\n", socket_name);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_name);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_name);
+    if (listener == -1 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error: unable to listen on socket -- '%s'\n", socket_name);
+        exit(1);
+    }
+
+    // A client going away mid-reply mustn't take the daemon down. SIGINT and SIGTERM interrupt accept()
+    // so that the socket is removed on the way out.
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa = { 0 };
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    Worker *workers = (Worker *) calloc(threads, sizeof(Worker));
+    for (long i = 0; i < threads; i++) {
+        pthread_t thread;
+        workers[i].server = &server;
+        pthread_create(&thread, NULL, serve, &workers[i]);
+        pthread_detach(thread);
+    }
+
+    while (!stopping) {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client == -1) {
+            continue;
+        }
+        queue_push(&server, client);
+    }
+
+    close(listener);
+    unlink(socket_name);
+    return 0;
+}
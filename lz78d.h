@@ -0,0 +1,50 @@
+#ifndef __LZ78D_H__
+#define __LZ78D_H__
+
+#include <stdint.h>
+
+//
+// The lz78d protocol. A client connects to the daemon's Unix stream socket and sends requests, each
+// one an Lz78dRequest, and reads an Lz78dReply back for each. Both are in host byte order, since both
+// ends are on the same machine.
+//
+// A request either passes its input and output as two file descriptors, in that order, in an
+// SCM_RIGHTS message sent with the request (LZ78D_FDS), or sends its input inline after the request.
+// Inline input ends where the client shuts down its side of the connection, so an inline request is
+// the last one on its connection. The daemon writes the output to the output descriptor, or inline
+// after the reply, and the reply's length is the number of bytes of output.
+//
+// If the status isn't LZ78D_OK, length bytes of error message follow the reply instead.
+//
+
+#define LZ78D_MAGIC 0xBAADD00D // Starts every request.
+
+// ops
+#define LZ78D_ENCODE 1
+#define LZ78D_DECODE 2
+
+// request flags
+#define LZ78D_FDS   0x1 // The input and output are passed as file descriptors.
+#define LZ78D_RUNS  0x2 // Encode runs of one symbol as run blocks, like encode -z.
+#define LZ78D_DICT  0x4 // Encode with the daemon's dictionary, like encode -D.
+#define LZ78D_CHECK 0x8 // Encode with checksums, like encode -c.
+
+// reply statuses
+#define LZ78D_OK      0
+#define LZ78D_INVALID 1 // The request can't be served.
+#define LZ78D_CORRUPT 2 // The input can't be decoded.
+
+typedef struct Lz78dRequest {
+    uint32_t magic;
+    uint8_t op;
+    uint8_t flags;
+    uint16_t reserved; // 0.
+} Lz78dRequest;
+
+typedef struct Lz78dReply {
+    uint32_t status;
+    uint32_t reserved; // 0.
+    uint64_t length;
+} Lz78dReply;
+
+#endif
@@ -0,0 +1,490 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> //getopt().
+#include <fcntl.h> // read open
+
+#include "code.h"
+#include "decoder.h"
+#include "dict.h"
+#include "io.h"
+#include "trie.h"
+
+#define OPTIONS "i:D:cnh"
+
+#define GREP_MAX 255 // Longest pattern, so that an automaton state fits in a byte.
+
+// flags of a word's summary
+#define HAS_NL     0x1 // The word holds a newline.
+#define FOUND_HEAD 0x2 // The pattern occurs in the word before its first newline, or anywhere without one.
+#define FOUND_MID  0x4 // The pattern occurs in a line that starts and ends in the word.
+#define FOUND_TAIL 0x8 // The pattern occurs in the word after its last newline.
+
+//
+// What lz78grep keeps about the word of each code instead of the word itself. With the first m - 1
+// symbols of the word, kept in heads, it is enough to carry the pattern automaton over the word from
+// any state, and to tell whether the line the word ends up in matches, in O(m) at most.
+//
+typedef struct Summary {
+    uint16_t parent;
+    uint8_t sym;
+    uint8_t state; // The automaton's state after the word, from the start state.
+    uint8_t flags;
+    uint16_t len;
+    uint16_t first_nl; // Offsets of the first and last newlines in the word, with HAS_NL.
+    uint16_t last_nl;
+    uint16_t lines; // Newlines in the word.
+} Summary;
+
+// a piece of the line being searched: the word of code from offset from, or count copies of sym
+typedef struct Piece {
+    uint16_t code;
+    uint16_t from;
+    uint8_t sym;
+    uint32_t count; // 0 for a word.
+} Piece;
+
+typedef struct Grep {
+    // the pattern and its automaton: the state is the length of the longest prefix of the pattern
+    // that the text ends with, and m is a match
+    const uint8_t *pattern;
+    int m;
+    uint8_t (*dfa)[ALPHABET];
+
+    Summary *words; // By code.
+    uint8_t *heads; // The first m - 1 symbols of the word of code c, at heads + c * (m - 1).
+    uint8_t *word; // Room for a whole word.
+
+    // the line being searched: the text before the last dictionary reset, then the pieces after it
+    uint8_t state;
+    bool matched;
+    uint64_t line; // Its number, from 1.
+    uint8_t *lit;
+    size_t lit_len;
+    size_t lit_cap;
+    Piece *pieces;
+    size_t npieces;
+    size_t pieces_cap;
+
+    bool count_only;
+    bool numbers;
+    uint64_t count; // Matching lines.
+} Grep;
+
+// Builds the automaton of the m symbols of pattern, which hold no newline.
+static void grep_compile(Grep *g) {
+    int m = g->m;
+    memset(g->dfa, 0, (size_t) (m + 1) * ALPHABET);
+    g->dfa[0][g->pattern[0]] = 1;
+    int border = 0;
+    for (int j = 1; j <= m; j++) {
+        memcpy(g->dfa[j], g->dfa[border], ALPHABET);
+        if (j < m) {
+            g->dfa[j][g->pattern[j]] = (uint8_t) (j + 1);
+            border = g->dfa[border][g->pattern[j]];
+        }
+    }
+}
+
+// Adds the word of code, the word of parent followed by sym, summing it up from its parent's summary.
+static void grep_add(Grep *g, uint16_t code, uint16_t parent, uint8_t sym) {
+    Summary *p = &g->words[parent];
+    Summary *w = &g->words[code];
+    int head = g->m - 1;
+    w->parent = parent;
+    w->sym = sym;
+    w->len = (uint16_t) (p->len + 1);
+    w->state = g->dfa[p->state][sym];
+    w->lines = (uint16_t) (p->lines + (sym == '\n'));
+    w->first_nl = p->first_nl;
+    w->last_nl = p->last_nl;
+    bool found = w->state == g->m;
+    if (!(p->flags & HAS_NL)) {
+        if (sym == '\n') {
+            w->flags = HAS_NL | (p->flags & FOUND_HEAD);
+            w->first_nl = p->len;
+            w->last_nl = p->len;
+        } else {
+            w->flags = (p->flags & FOUND_HEAD) | (found ? FOUND_HEAD : 0);
+        }
+    } else {
+        w->flags = p->flags & (HAS_NL | FOUND_HEAD | FOUND_MID);
+        if (sym == '\n') {
+            w->flags |= p->flags & FOUND_TAIL ? FOUND_MID : 0;
+            w->last_nl = p->len;
+        } else {
+            w->flags |= (p->flags & FOUND_TAIL) | (found ? FOUND_TAIL : 0);
+        }
+    }
+    uint8_t *h = g->heads + (size_t) code * head;
+    memcpy(h, g->heads + (size_t) parent * head, p->len < head ? p->len : head);
+    if (p->len < head) {
+        h[p->len] = sym;
+    }
+}
+
+// Starts the table over with just the empty word, and the words of dict if there is one.
+static uint16_t grep_reset(Grep *g, const Dict *dict) {
+    memset(&g->words[EMPTY_CODE], 0, sizeof(Summary));
+    uint16_t next_code = START_CODE;
+    if (dict != NULL) {
+        for (uint32_t i = 0; i < dict->count; i++) {
+            grep_add(g, (uint16_t) (START_CODE + i), dict_parent(dict, i), dict_sym(dict, i));
+        }
+        next_code = dict_next_code(dict);
+    }
+    return next_code;
+}
+
+// Writes the word of code to g->word, and returns its length.
+static int grep_word(Grep *g, uint16_t code) {
+    int len = g->words[code].len;
+    for (int i = len - 1; i >= 0; i--) {
+        g->word[i] = g->words[code].sym;
+        code = g->words[code].parent;
+    }
+    return len;
+}
+
+static void grep_piece(Grep *g, Piece piece) {
+    if (g->count_only) {
+        return;
+    }
+    if (g->npieces == g->pieces_cap) {
+        g->pieces_cap = g->pieces_cap ? g->pieces_cap * 2 : 256;
+        g->pieces = (Piece *) realloc(g->pieces, g->pieces_cap * sizeof(Piece));
+    }
+    g->pieces[g->npieces] = piece;
+    g->npieces += 1;
+}
+
+// Appends the n symbols of syms to the text of the line, or makes room for them if syms is NULL.
+static void grep_lit(Grep *g, const uint8_t *syms, size_t n) {
+    if (g->lit_len + n > g->lit_cap) {
+        g->lit_cap = g->lit_len + n > 2 * g->lit_cap ? g->lit_len + n : 2 * g->lit_cap;
+        g->lit = (uint8_t *) realloc(g->lit, g->lit_cap);
+    }
+    if (syms != NULL) {
+        memcpy(g->lit + g->lit_len, syms, n);
+    }
+    g->lit_len += n;
+}
+
+// Turns the pieces of the line into text, before the codes they use are reused.
+static void grep_flatten(Grep *g) {
+    for (size_t i = 0; i < g->npieces; i++) {
+        Piece *p = &g->pieces[i];
+        if (p->count > 0) {
+            grep_lit(g, NULL, p->count);
+            memset(g->lit + g->lit_len - p->count, p->sym, p->count);
+        } else {
+            int len = grep_word(g, p->code);
+            grep_lit(g, g->word + p->from, len - p->from);
+        }
+    }
+    g->npieces = 0;
+}
+
+// Prints the line number, if asked for.
+static void grep_number(Grep *g, uint64_t line) {
+    if (g->numbers) {
+        printf("%lu:", line);
+    }
+}
+
+// Ends the line being searched, its last symbols being the first end symbols of the word of code, and
+// prints it if it matched. Starts the next one with the automaton in its start state.
+static void grep_end_line(Grep *g, uint16_t code, int end) {
+    if (g->matched) {
+        g->count += 1;
+        if (!g->count_only) {
+            grep_number(g, g->line);
+            fwrite(g->lit, 1, g->lit_len, stdout);
+            for (size_t i = 0; i < g->npieces; i++) {
+                Piece *p = &g->pieces[i];
+                if (p->count > 0) {
+                    for (uint32_t j = 0; j < p->count; j++) {
+                        putchar(p->sym);
+                    }
+                } else {
+                    int len = grep_word(g, p->code);
+                    fwrite(g->word + p->from, 1, len - p->from, stdout);
+                }
+            }
+            if (end > 0) {
+                grep_word(g, code);
+                fwrite(g->word, 1, end, stdout);
+            }
+            putchar('\n');
+        }
+    }
+    g->line += 1;
+    g->lit_len = 0;
+    g->npieces = 0;
+    g->matched = false;
+    g->state = 0;
+}
+
+// Searches the word of code, the next in the text.
+static void grep_search(Grep *g, uint16_t code) {
+    Summary *w = &g->words[code];
+    bool nl = w->flags & HAS_NL;
+    int first = nl ? w->first_nl : w->len;
+
+    // A match can start in the line so far and end in the first m - 1 symbols of the word. Carrying the
+    // automaton over them also gives its state after a short word.
+    uint8_t state = w->state;
+    if (g->state != 0) {
+        const uint8_t *h = g->heads + (size_t) code * (g->m - 1);
+        int n = first < g->m - 1 ? first : g->m - 1;
+        uint8_t q = g->state;
+        for (int i = 0; i < n; i++) {
+            q = g->dfa[q][h[i]];
+            g->matched |= q == g->m;
+        }
+        if (!nl && w->len < g->m) {
+            state = q;
+        }
+    }
+    g->matched |= (w->flags & FOUND_HEAD) != 0;
+    if (!nl) {
+        grep_piece(g, (Piece) { .code = code, .from = 0, .sym = 0, .count = 0 });
+        g->state = state;
+        return;
+    }
+
+    grep_end_line(g, code, first);
+    // The lines the word holds whole only need to be looked at if one of them matches.
+    if (w->flags & FOUND_MID) {
+        grep_word(g, code);
+        int start = first + 1;
+        for (int i = start; i <= w->last_nl; i++) {
+            if (g->word[i] == '\n') {
+                uint8_t q = 0;
+                for (int j = start; j < i && q != g->m; j++) {
+                    q = g->dfa[q][g->word[j]];
+                }
+                if (q == g->m) {
+                    g->count += 1;
+                    if (!g->count_only) {
+                        grep_number(g, g->line);
+                        fwrite(g->word + start, 1, i - start, stdout);
+                        putchar('\n');
+                    }
+                }
+                g->line += 1;
+                start = i + 1;
+            }
+        }
+    } else {
+        g->line += w->lines - 1;
+    }
+    if (w->last_nl + 1 < w->len) {
+        grep_piece(g, (Piece) { .code = code, .from = (uint16_t) (w->last_nl + 1), .sym = 0, .count = 0 });
+    }
+    g->matched = (w->flags & FOUND_TAIL) != 0;
+    g->state = w->state;
+}
+
+// Searches count copies of sym, the next in the text.
+static void grep_run(Grep *g, uint8_t sym, uint32_t count) {
+    if (sym == '\n') {
+        grep_end_line(g, 0, 0);
+        g->line += count - 1;
+        return;
+    }
+    // After m copies the automaton stays in the same state, and any match has been seen.
+    uint32_t n = count < 2 * (uint32_t) g->m ? count : 2 * (uint32_t) g->m;
+    for (uint32_t i = 0; i < n; i++) {
+        g->state = g->dfa[g->state][sym];
+        g->matched |= g->state == g->m;
+    }
+    grep_piece(g, (Piece) { .code = 0, .from = 0, .sym = sym, .count = count });
+}
+
+// Searches the pairs of infile, after the header. Returns false if the stream is corrupt.
+static bool grep_stream(Grep *g, int infile, const Dict *dict) {
+    BitReader br;
+    br_init(&br, infile);
+    uint16_t next_code = grep_reset(g, dict);
+    for (;;) {
+        uint16_t code = 0;
+        uint8_t sym = 0;
+        uint32_t value = 0;
+        uint32_t count = 0;
+        if (!br_pair(&br, &code, &sym, bit_len(next_code))) {
+            break;
+        }
+        if (code == STOP_CODE) {
+            if (sym == 0) {
+                break;
+            }
+            switch (sym) {
+            case CTRL_RUN:
+                if (!br_bits(&br, &value, 8) || !br_bits(&br, &count, 32)) {
+                    return false;
+                }
+                grep_run(g, (uint8_t) value, count);
+                break;
+            case CTRL_RESET:
+                grep_flatten(g);
+                next_code = grep_reset(g, dict);
+                break;
+            case CTRL_SYNC: br_align(&br); break;
+            case CTRL_CHECK:
+                br_align(&br);
+                if (!br_bits(&br, &value, 32) || !br_bits(&br, &count, 32)) {
+                    return false;
+                }
+                break;
+            default: return false;
+            }
+            continue;
+        }
+        if (code >= next_code) {
+            return false;
+        }
+        grep_add(g, next_code, code, sym);
+        grep_search(g, next_code);
+        next_code += 1;
+        if (next_code == MAX_CODE) {
+            grep_flatten(g);
+            next_code = grep_reset(g, dict);
+        }
+    }
+    // The last line may not end with a newline.
+    if (g->lit_len > 0 || g->npieces > 0 || g->matched) {
+        grep_end_line(g, 0, 0);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+
+    // file descriptors
+    int infile_descriptor = STDIN_FILENO;
+
+    // default names for files
+    char *infile_name = NULL;
+    char *dict_name = NULL;
+
+    bool count_only = false;
+    bool numbers = false;
+
+    // help_message
+    const char *help_message
+        = "SYNOPSIS\n"
+          "   Prints the lines of a compressed file that contain a pattern, without decompressing it.\n"
+          "   Exits with 0 if a line matched, 1 if none did and 2 on errors, like grep.\n"
+          "\n"
+          "USAGE\n"
+          "   ./lz78grep [-cnh] [-i input] [-D dict] pattern\n"
+          "\n"
+          "OPTIONS\n"
+          "   -i input    Specify compressed input to search (stdin by default)\n"
+          "   -D dict     Dictionary the input was encoded with\n"
+          "   -c          Print only the number of matching lines\n"
+          "   -n          Print the line number before each matching line\n"
+          "   -h          Display program usage\n";
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'i': infile_name = optarg; break;
+        case 'D': dict_name = optarg; break;
+        case 'c': count_only = true; break;
+        case 'n': numbers = true; break;
+        case 'h': printf("%s", help_message); return 0;
+        default: fprintf(stderr, "Usage: %s [-i input] [-D dict] [-c] [-n] [-h] pattern\n", argv[0]); exit(2);
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-i input] [-D dict] [-c] [-n] [-h] pattern\n", argv[0]);
+        exit(2);
+    }
+    const char *pattern = argv[optind];
+    size_t m = strlen(pattern);
+    if (m == 0 || m > GREP_MAX || strchr(pattern, '\n') != NULL) {
+        fprintf(stderr, "Error: the pattern must be 1 to %d bytes on one line\n", GREP_MAX);
+        exit(2);
+    }
+
+    if (infile_name != NULL) {
+        infile_descriptor = open(infile_name, O_RDONLY);
+        if (infile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to open input file -- '%s'\n", infile_name);
+            exit(2);
+        }
+    }
+    Dict *dict = NULL;
+    if (dict_name != NULL) {
+        dict = dict_open(dict_name);
+        if (dict == NULL) {
+            fprintf(stderr, "Error: unable to load dictionary -- '%s'\n", dict_name);
+            exit(2);
+        }
+    }
+
+    Decoder *decoder = decoder_create();
+    FileHeader header;
+    if (!decode_header(decoder, infile_descriptor, &header, dict)) {
+        fprintf(stderr, "Error: %s\n", decoder->error);
+        exit(2);
+    }
+    if (!(decoder->flags & FLAG_DICT)) {
+        dict_close(dict);
+        dict = NULL;
+    }
+    // Copies of earlier chunks would need the text they copy, which is never rebuilt.
+    if (decoder->flags & FLAG_DEDUP) {
+        fprintf(stderr, "Error: deduplicated streams can't be searched -- use decode\n");
+        exit(2);
+    }
+    // The words of a filtered stream aren't the text, only the filtered bytes.
+    if (decoder->flags & FLAG_FILTER) {
+        fprintf(stderr, "Error: filtered streams can't be searched -- use decode\n");
+        exit(2);
+    }
+
+    Grep g = {
+        .pattern = (const uint8_t *) pattern,
+        .m = (int) m,
+        .dfa = malloc((m + 1) * ALPHABET),
+        .words = (Summary *) malloc((size_t) MAX_CODE * sizeof(Summary)),
+        .heads = (uint8_t *) malloc((size_t) MAX_CODE * (m - 1) + 1),
+        .word = (uint8_t *) malloc(MAX_CODE),
+        .state = 0,
+        .matched = false,
+        .line = 1,
+        .lit = NULL,
+        .lit_len = 0,
+        .lit_cap = 0,
+        .pieces = NULL,
+        .npieces = 0,
+        .pieces_cap = 0,
+        .count_only = count_only,
+        .numbers = numbers,
+        .count = 0,
+    };
+    grep_compile(&g);
+    if (!grep_stream(&g, infile_descriptor, dict)) {
+        fflush(stdout);
+        fprintf(stderr, "Error: corrupt input\n");
+        exit(2);
+    }
+    if (count_only) {
+        printf("%lu\n", g.count);
+    }
+
+    free(g.pieces);
+    free(g.lit);
+    free(g.word);
+    free(g.heads);
+    free(g.words);
+    free(g.dfa);
+    decoder_delete(decoder);
+    dict_close(dict);
+    close(infile_descriptor);
+    return g.count > 0 ? 0 : 1;
+}
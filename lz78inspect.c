@@ -0,0 +1,609 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> //getopt().
+#include <fcntl.h> // read open
+
+#include "code.h"
+#include "decoder.h"
+#include "dict.h"
+#include "filter.h"
+#include "io.h"
+
+#define OPTIONS "i:D:f:r:h"
+
+#define BUCKETS 18 // Power-of-two buckets: [0], [1], [2, 3], [4, 7], ... [65536, ...).
+#define TOP     10 // Most reused codes listed.
+#define TEXT_EVENTS 48 // Most code-width changes listed by the text report.
+#define TEXT_RANGES 10 // Worst offset ranges listed by the text report.
+
+// why an epoch ended
+static const char *const epoch_ends[] = { "full", "reset", "stop", "truncated" };
+#define END_FULL      0 // next_code reached MAX_CODE.
+#define END_RESET     1 // CTRL_RESET.
+#define END_STOP      2 // STOP_CODE.
+#define END_TRUNCATED 3 // The input ran out before STOP_CODE.
+
+// a dictionary epoch: the pairs from one reset to the next
+typedef struct Epoch {
+    uint64_t bit; // Where it starts, in bits from the start of the file.
+    uint64_t sym; // Where its output starts.
+    uint64_t pairs; // Pairs with a code, control pairs left out.
+    uint64_t literals; // Pairs with EMPTY_CODE: a single new symbol.
+    uint64_t bits; // Taken by its pairs and control blocks.
+    uint64_t syms; // Decoded from it.
+    int end;
+} Epoch;
+
+// where the codes got one bit wider
+typedef struct WidthChange {
+    uint32_t epoch;
+    int width;
+    uint64_t bit;
+    uint64_t sym;
+} WidthChange;
+
+// a code of one epoch, and how many later pairs extended its phrase
+typedef struct Reuse {
+    uint32_t epoch;
+    uint16_t code;
+    uint16_t len;
+    uint32_t refs;
+} Reuse;
+
+// the compressed bits spent on a range of the output
+typedef struct Range {
+    uint64_t syms;
+    uint64_t bits;
+} Range;
+
+typedef struct Inspect {
+    FileHeader header;
+    uint32_t filter; // The decoded bytes are the filtered ones.
+    uint64_t header_bits;
+
+    Epoch *epochs;
+    uint32_t nepochs;
+    uint32_t epochs_cap;
+
+    WidthChange *widths;
+    uint32_t nwidths;
+    uint32_t widths_cap;
+
+    uint64_t phrases[BUCKETS]; // By length.
+    uint64_t phrase_syms[BUCKETS];
+    uint64_t reuse[BUCKETS]; // Codes, by how many times they were extended.
+    Reuse top[TOP]; // Most extended first.
+
+    // control blocks
+    uint64_t runs;
+    uint64_t run_syms;
+    uint64_t dups;
+    uint64_t dup_syms;
+    uint64_t resets;
+    uint64_t syncs;
+    uint64_t checks;
+    uint64_t control_bits;
+
+    uint64_t range_size;
+    Range *ranges;
+    uint64_t nranges;
+
+    // the epoch being read
+    uint16_t *lens; // Of the word of each code.
+    uint32_t *refs; // Of each code.
+} Inspect;
+
+// Parses a size in bytes with an optional K, M or G suffix. Returns 0 if it isn't one.
+static uint64_t parse_size(const char *arg) {
+    char *end;
+    uint64_t size = strtoull(arg, &end, 10);
+    switch (*end) {
+    case 'G': size <<= 10; // fall through
+    case 'M': size <<= 10; // fall through
+    case 'K': size <<= 10; end += 1; break;
+    default: break;
+    }
+    return *end == '\0' ? size : 0;
+}
+
+// Returns the power-of-two bucket of n.
+static int bucket(uint64_t n) {
+    int b = 0;
+    while (n > 0 && b < BUCKETS - 1) {
+        n >>= 1;
+        b += 1;
+    }
+    return b;
+}
+
+// Returns the smallest number in bucket b.
+static uint64_t bucket_min(int b) {
+    return b == 0 ? 0 : UINT64_C(1) << (b - 1);
+}
+
+// Returns the largest number in bucket b, or 0 if it has no upper end.
+static uint64_t bucket_max(int b) {
+    return b == BUCKETS - 1 ? 0 : b == 0 ? 0 : (UINT64_C(1) << b) - 1;
+}
+
+static Epoch *current(Inspect *in) {
+    return &in->epochs[in->nepochs - 1];
+}
+
+// Starts a new epoch at total_bits and total_syms, with just the empty word and the dictionary's.
+static uint16_t start_epoch(Inspect *in, const Dict *dict) {
+    if (in->nepochs == in->epochs_cap) {
+        in->epochs_cap = in->epochs_cap ? 2 * in->epochs_cap : 64;
+        in->epochs = (Epoch *) realloc(in->epochs, in->epochs_cap * sizeof(Epoch));
+    }
+    Epoch *e = &in->epochs[in->nepochs];
+    memset(e, 0, sizeof(Epoch));
+    e->bit = in->header_bits + total_bits;
+    e->sym = total_syms;
+    in->nepochs += 1;
+
+    memset(in->refs, 0, MAX_CODE * sizeof(uint32_t));
+    in->lens[EMPTY_CODE] = 0;
+    uint16_t next_code = START_CODE;
+    if (dict != NULL) {
+        for (uint32_t i = 0; i < dict->count; i++) {
+            in->lens[START_CODE + i] = (uint16_t) (in->lens[dict_parent(dict, i)] + 1);
+        }
+        next_code = dict_next_code(dict);
+    }
+    return next_code;
+}
+
+// Ends the epoch being read, whose codes run up to next_code, for reason end.
+static void end_epoch(Inspect *in, uint16_t next_code, int end) {
+    current(in)->end = end;
+    for (uint32_t c = START_CODE; c < next_code; c++) {
+        in->reuse[bucket(in->refs[c])] += 1;
+        // Keep the TOP most extended codes, most extended first.
+        if (in->refs[c] > in->top[TOP - 1].refs) {
+            int i = TOP - 1;
+            while (i > 0 && in->top[i - 1].refs < in->refs[c]) {
+                in->top[i] = in->top[i - 1];
+                i -= 1;
+            }
+            in->top[i] = (Reuse) { .epoch = in->nepochs - 1, .code = (uint16_t) c, .len = in->lens[c], .refs = in->refs[c] };
+        }
+    }
+}
+
+// Records the code width of the epoch being read, if it changed.
+static void note_width(Inspect *in, int width) {
+    uint32_t epoch = in->nepochs - 1;
+    if (in->nwidths > 0 && in->widths[in->nwidths - 1].epoch == epoch && in->widths[in->nwidths - 1].width == width) {
+        return;
+    }
+    if (in->nwidths == in->widths_cap) {
+        in->widths_cap = in->widths_cap ? 2 * in->widths_cap : 256;
+        in->widths = (WidthChange *) realloc(in->widths, in->widths_cap * sizeof(WidthChange));
+    }
+    in->widths[in->nwidths] = (WidthChange) { .epoch = epoch, .width = width, .bit = in->header_bits + total_bits, .sym = total_syms };
+    in->nwidths += 1;
+}
+
+// Counts bits spent on the next syms symbols of the output, which start at total_syms.
+static void spend(Inspect *in, uint64_t bits, uint64_t syms) {
+    uint64_t r = total_syms / in->range_size;
+    uint64_t last = (total_syms + (syms ? syms - 1 : 0)) / in->range_size;
+    if (last >= in->nranges) {
+        uint64_t n = last + 1 > 2 * in->nranges ? last + 1 : 2 * in->nranges;
+        in->ranges = (Range *) realloc(in->ranges, n * sizeof(Range));
+        memset(in->ranges + in->nranges, 0, (n - in->nranges) * sizeof(Range));
+        in->nranges = n;
+    }
+    // The bits go to the range the symbols start in, and the symbols to the ranges they fall in.
+    in->ranges[r].bits += bits;
+    uint64_t at = total_syms;
+    uint64_t left = syms;
+    while (left > 0) {
+        uint64_t end = (at / in->range_size + 1) * in->range_size;
+        uint64_t n = end - at < left ? end - at : left;
+        in->ranges[at / in->range_size].syms += n;
+        at += n;
+        left -= n;
+    }
+    current(in)->bits += bits;
+    current(in)->syms += syms;
+    total_bits += bits;
+    total_syms += syms;
+}
+
+// Reads the control block introduced by (STOP_CODE, ctrl), whose pair took bitlen + 8 bits. Returns
+// false if it is cut short or unknown.
+static bool inspect_control(Inspect *in, BitReader *br, int ctrl, int bitlen) {
+    uint32_t value = 0;
+    uint32_t count = 0;
+    uint32_t high = 0;
+    uint64_t before = total_bits;
+    uint64_t bits = 0;
+    switch (ctrl) {
+    case CTRL_RUN:
+        if (!br_bits(br, &value, 8) || !br_bits(br, &count, 32)) {
+            return false;
+        }
+        in->runs += 1;
+        in->run_syms += count;
+        in->control_bits += bitlen + 8 + 8 + 32;
+        spend(in, bitlen + 8 + 8 + 32, count);
+        return true;
+    case CTRL_RESET:
+        in->resets += 1;
+        in->control_bits += bitlen + 8;
+        spend(in, bitlen + 8, 0);
+        return true;
+    case CTRL_SYNC:
+    case CTRL_CHECK:
+        // br_align adds the padding to total_bits, which spend adds to again.
+        br_align(br);
+        bits = bitlen + 8 + (total_bits - before) + (ctrl == CTRL_CHECK ? 64 : 0);
+        total_bits = before;
+        if (ctrl == CTRL_CHECK && (!br_bits(br, &value, 32) || !br_bits(br, &count, 32))) {
+            return false;
+        }
+        in->syncs += ctrl == CTRL_SYNC;
+        in->checks += ctrl == CTRL_CHECK;
+        in->control_bits += bits;
+        spend(in, bits, 0);
+        return true;
+    case CTRL_DUP:
+        if (!br_bits(br, &value, 32) || !br_bits(br, &high, 32) || !br_bits(br, &count, 32)) {
+            return false;
+        }
+        in->dups += 1;
+        in->dup_syms += count;
+        in->control_bits += bitlen + 8 + 96;
+        spend(in, bitlen + 8 + 96, count);
+        return true;
+    default: return false;
+    }
+}
+
+// Reads every pair of infile, after the header. Returns false if the stream is corrupt.
+static bool inspect_stream(Inspect *in, int infile, const Dict *dict) {
+    BitReader br;
+    br_init(&br, infile);
+    uint16_t next_code = start_epoch(in, dict);
+    for (;;) {
+        uint16_t code = 0;
+        uint8_t sym = 0;
+        int bitlen = bit_len(next_code);
+        note_width(in, bitlen);
+        if (!br_pair(&br, &code, &sym, bitlen)) {
+            end_epoch(in, next_code, END_TRUNCATED);
+            return true;
+        }
+        if (code == STOP_CODE) {
+            if (sym == 0) {
+                spend(in, bitlen + 8, 0);
+                end_epoch(in, next_code, END_STOP);
+                return true;
+            }
+            if (!inspect_control(in, &br, sym, bitlen)) {
+                end_epoch(in, next_code, END_TRUNCATED);
+                return false;
+            }
+            if (sym == CTRL_RESET) {
+                end_epoch(in, next_code, END_RESET);
+                next_code = start_epoch(in, dict);
+            }
+            continue;
+        }
+        if (code >= next_code) {
+            end_epoch(in, next_code, END_TRUNCATED);
+            return false;
+        }
+        uint16_t len = (uint16_t) (in->lens[code] + 1);
+        in->lens[next_code] = len;
+        in->refs[code] += 1;
+        in->phrases[bucket(len)] += 1;
+        in->phrase_syms[bucket(len)] += len;
+        current(in)->pairs += 1;
+        current(in)->literals += code == EMPTY_CODE;
+        spend(in, bitlen + 8, len);
+        next_code += 1;
+        if (next_code == MAX_CODE) {
+            end_epoch(in, next_code, END_FULL);
+            next_code = start_epoch(in, dict);
+        }
+    }
+}
+
+// Returns bits per output byte, or 0 without output.
+static double bits_per_byte(uint64_t bits, uint64_t syms) {
+    return syms ? (double) bits / (double) syms : 0.0;
+}
+
+static void print_text(const Inspect *in) {
+    uint64_t bits = total_bits + in->header_bits;
+    printf("Stream\n");
+    printf("   flags           0x%04x%s%s%s%s%s%s%s%s\n", in->header.flags, in->header.flags & FLAG_RUNS ? " runs" : "",
+        in->header.flags & FLAG_DICT ? " dict" : "", in->header.flags & FLAG_RESETS ? " resets" : "",
+        in->header.flags & FLAG_SYNC ? " sync" : "", in->header.flags & FLAG_CHECK ? " check" : "",
+        in->header.flags & FLAG_DEDUP ? " dedup" : "", in->header.flags & FLAG_FILTER ? " filter" : "",
+        in->header.flags & FLAG_SOLID ? " solid" : "");
+    if (in->filter != FILTER_NONE) {
+        printf("   filter          %s\n", filter_name(in->filter));
+    }
+    printf("   compressed      %lu bytes\n", (bits + 7) / 8);
+    printf("   decoded         %lu bytes\n", total_syms);
+    printf("   bits per byte   %.3f\n", bits_per_byte(bits, total_syms));
+    printf("   epochs          %u\n", in->nepochs);
+    printf("   control blocks  %lu runs (%lu bytes), %lu duplicates (%lu bytes), %lu resets, %lu syncs, %lu checks, %lu bits\n",
+        in->runs, in->run_syms, in->dups, in->dup_syms, in->resets, in->syncs, in->checks, in->control_bits);
+
+    printf("\nEpochs\n");
+    printf("   %6s %14s %14s %10s %10s %12s %12s %8s  %s\n", "epoch", "start bit", "start byte", "pairs", "literals",
+        "bits", "bytes", "bits/B", "end");
+    for (uint32_t k = 0; k < in->nepochs; k++) {
+        const Epoch *e = &in->epochs[k];
+        printf("   %6u %14lu %14lu %10lu %10lu %12lu %12lu %8.3f  %s\n", k, e->bit, e->sym, e->pairs, e->literals,
+            e->bits, e->syms, bits_per_byte(e->bits, e->syms), epoch_ends[e->end]);
+    }
+
+    printf("\nCode widths\n");
+    if (in->nwidths <= TEXT_EVENTS) {
+        printf("   %6s %6s %14s %14s\n", "epoch", "width", "start bit", "start byte");
+        for (uint32_t i = 0; i < in->nwidths; i++) {
+            const WidthChange *w = &in->widths[i];
+            printf("   %6u %6d %14lu %14lu\n", w->epoch, w->width, w->bit, w->sym);
+        }
+    } else {
+        // Too many to list: sum up the bytes decoded at each width instead.
+        uint64_t width_syms[17] = { 0 };
+        for (uint32_t i = 0; i < in->nwidths; i++) {
+            uint64_t end = i + 1 < in->nwidths ? in->widths[i + 1].sym : total_syms;
+            width_syms[in->widths[i].width] += end - in->widths[i].sym;
+        }
+        printf("   %u changes (-f csv lists them all); bytes decoded at each width:\n", in->nwidths);
+        for (int w = 2; w <= 16; w++) {
+            if (width_syms[w] > 0) {
+                printf("   %6d %14lu\n", w, width_syms[w]);
+            }
+        }
+    }
+
+    printf("\nPhrase lengths\n");
+    printf("   %12s %12s %12s\n", "length", "phrases", "bytes");
+    for (int b = 1; b < BUCKETS; b++) {
+        if (in->phrases[b] > 0) {
+            printf("   %5lu-%-6lu %12lu %12lu\n", bucket_min(b), bucket_max(b), in->phrases[b], in->phrase_syms[b]);
+        }
+    }
+
+    printf("\nCode reuse (times a code's phrase was extended)\n");
+    printf("   %12s %12s\n", "times", "codes");
+    for (int b = 0; b < BUCKETS; b++) {
+        if (in->reuse[b] > 0) {
+            printf("   %5lu-%-6lu %12lu\n", bucket_min(b), bucket_max(b), in->reuse[b]);
+        }
+    }
+    printf("   most reused:\n");
+    printf("   %6s %6s %6s %10s\n", "epoch", "code", "length", "times");
+    for (int i = 0; i < TOP && in->top[i].refs > 0; i++) {
+        printf("   %6u %6u %6u %10u\n", in->top[i].epoch, in->top[i].code, in->top[i].len, in->top[i].refs);
+    }
+
+    // The worst ranges, by bits per byte, among the ones with output.
+    printf("\nWorst compressed ranges of %lu bytes\n", in->range_size);
+    printf("   %14s %14s %12s %8s\n", "start byte", "bytes", "bits", "bits/B");
+    uint64_t shown[TEXT_RANGES];
+    int nshown = 0;
+    for (int i = 0; i < TEXT_RANGES; i++) {
+        int64_t worst = -1;
+        for (uint64_t r = 0; r < in->nranges; r++) {
+            bool taken = false;
+            for (int j = 0; j < nshown; j++) {
+                taken = taken || shown[j] == r;
+            }
+            if (!taken && in->ranges[r].syms > 0
+                && (worst < 0
+                    || bits_per_byte(in->ranges[r].bits, in->ranges[r].syms)
+                           > bits_per_byte(in->ranges[worst].bits, in->ranges[worst].syms))) {
+                worst = (int64_t) r;
+            }
+        }
+        if (worst < 0) {
+            break;
+        }
+        shown[nshown] = (uint64_t) worst;
+        nshown += 1;
+        const Range *r = &in->ranges[worst];
+        printf("   %14lu %14lu %12lu %8.3f\n", worst * in->range_size, r->syms, r->bits, bits_per_byte(r->bits, r->syms));
+    }
+}
+
+// Every table is a header row and then its rows, all starting with the table's name, so that each
+// can be picked out with grep.
+static void print_csv(const Inspect *in) {
+    printf("stream,flags,compressed_bits,decoded_bytes,epochs,runs,run_bytes,dups,dup_bytes,resets,syncs,checks,control_bits\n");
+    printf("stream,%u,%lu,%lu,%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", in->header.flags, total_bits + in->header_bits,
+        total_syms, in->nepochs, in->runs, in->run_syms, in->dups, in->dup_syms, in->resets, in->syncs, in->checks,
+        in->control_bits);
+    printf("epoch,index,start_bit,start_byte,pairs,literals,bits,bytes,end\n");
+    for (uint32_t k = 0; k < in->nepochs; k++) {
+        const Epoch *e = &in->epochs[k];
+        printf("epoch,%u,%lu,%lu,%lu,%lu,%lu,%lu,%s\n", k, e->bit, e->sym, e->pairs, e->literals, e->bits, e->syms,
+            epoch_ends[e->end]);
+    }
+    printf("width,epoch,width,start_bit,start_byte\n");
+    for (uint32_t i = 0; i < in->nwidths; i++) {
+        const WidthChange *w = &in->widths[i];
+        printf("width,%u,%d,%lu,%lu\n", w->epoch, w->width, w->bit, w->sym);
+    }
+    printf("phrase,min_length,max_length,phrases,bytes\n");
+    for (int b = 1; b < BUCKETS; b++) {
+        printf("phrase,%lu,%lu,%lu,%lu\n", bucket_min(b), bucket_max(b), in->phrases[b], in->phrase_syms[b]);
+    }
+    printf("reuse,min_times,max_times,codes\n");
+    for (int b = 0; b < BUCKETS; b++) {
+        printf("reuse,%lu,%lu,%lu\n", bucket_min(b), bucket_max(b), in->reuse[b]);
+    }
+    printf("top,epoch,code,length,times\n");
+    for (int i = 0; i < TOP && in->top[i].refs > 0; i++) {
+        printf("top,%u,%u,%u,%u\n", in->top[i].epoch, in->top[i].code, in->top[i].len, in->top[i].refs);
+    }
+    printf("range,start_byte,bytes,bits\n");
+    for (uint64_t r = 0; r < in->nranges && r * in->range_size < total_syms; r++) {
+        printf("range,%lu,%lu,%lu\n", r * in->range_size, in->ranges[r].syms, in->ranges[r].bits);
+    }
+}
+
+static void print_json(const Inspect *in) {
+    printf("{\n  \"flags\": %u,\n  \"compressed_bits\": %lu,\n  \"decoded_bytes\": %lu,\n", in->header.flags,
+        total_bits + in->header_bits, total_syms);
+    printf("  \"control\": {\"runs\": %lu, \"run_bytes\": %lu, \"dups\": %lu, \"dup_bytes\": %lu, \"resets\": %lu, "
+           "\"syncs\": %lu, \"checks\": %lu, \"bits\": %lu},\n",
+        in->runs, in->run_syms, in->dups, in->dup_syms, in->resets, in->syncs, in->checks, in->control_bits);
+    printf("  \"epochs\": [");
+    for (uint32_t k = 0; k < in->nepochs; k++) {
+        const Epoch *e = &in->epochs[k];
+        printf("%s\n    {\"start_bit\": %lu, \"start_byte\": %lu, \"pairs\": %lu, \"literals\": %lu, \"bits\": %lu, "
+               "\"bytes\": %lu, \"end\": \"%s\"}",
+            k ? "," : "", e->bit, e->sym, e->pairs, e->literals, e->bits, e->syms, epoch_ends[e->end]);
+    }
+    printf("\n  ],\n  \"widths\": [");
+    for (uint32_t i = 0; i < in->nwidths; i++) {
+        const WidthChange *w = &in->widths[i];
+        printf("%s\n    {\"epoch\": %u, \"width\": %d, \"start_bit\": %lu, \"start_byte\": %lu}", i ? "," : "", w->epoch,
+            w->width, w->bit, w->sym);
+    }
+    printf("\n  ],\n  \"phrases\": [");
+    for (int b = 1; b < BUCKETS; b++) {
+        printf("%s\n    {\"min_length\": %lu, \"max_length\": %lu, \"phrases\": %lu, \"bytes\": %lu}", b > 1 ? "," : "",
+            bucket_min(b), bucket_max(b), in->phrases[b], in->phrase_syms[b]);
+    }
+    printf("\n  ],\n  \"reuse\": [");
+    for (int b = 0; b < BUCKETS; b++) {
+        printf("%s\n    {\"min_times\": %lu, \"max_times\": %lu, \"codes\": %lu}", b ? "," : "", bucket_min(b),
+            bucket_max(b), in->reuse[b]);
+    }
+    printf("\n  ],\n  \"top\": [");
+    for (int i = 0; i < TOP && in->top[i].refs > 0; i++) {
+        printf("%s\n    {\"epoch\": %u, \"code\": %u, \"length\": %u, \"times\": %u}", i ? "," : "", in->top[i].epoch,
+            in->top[i].code, in->top[i].len, in->top[i].refs);
+    }
+    printf("\n  ],\n  \"range_size\": %lu,\n  \"ranges\": [", in->range_size);
+    for (uint64_t r = 0; r < in->nranges && r * in->range_size < total_syms; r++) {
+        printf("%s\n    {\"start_byte\": %lu, \"bytes\": %lu, \"bits\": %lu}", r ? "," : "", r * in->range_size,
+            in->ranges[r].syms, in->ranges[r].bits);
+    }
+    printf("\n  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+
+    // file descriptors
+    int infile_descriptor = STDIN_FILENO;
+
+    // default names for files
+    char *infile_name = NULL;
+    char *dict_name = NULL;
+
+    // report format and how finely the output is split up to find where compression is poor
+    const char *format = "text";
+    uint64_t range_size = 1 << 20;
+
+    // help_message
+    const char *help_message
+        = "SYNOPSIS\n"
+          "   Reports what is inside a compressed file, without decompressing it: its dictionary epochs,\n"
+          "   code widths, phrase lengths, code reuse and where in the output compression is poor.\n"
+          "\n"
+          "USAGE\n"
+          "   ./lz78inspect [-h] [-i input] [-D dict] [-f text|csv|json] [-r bytes]\n"
+          "\n"
+          "OPTIONS\n"
+          "   -i input    Specify compressed input to inspect (stdin by default)\n"
+          "   -D dict     Dictionary the input was encoded with\n"
+          "   -f format   Report as text (default), csv or json\n"
+          "   -r bytes    Size of the output ranges compression is reported for (1M by default)\n"
+          "   -h          Display program usage\n";
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'i': infile_name = optarg; break;
+        case 'D': dict_name = optarg; break;
+        case 'f':
+            format = optarg;
+            if (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0 && strcmp(format, "json") != 0) {
+                fprintf(stderr, "Error: invalid format -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            range_size = parse_size(optarg);
+            if (range_size == 0) {
+                fprintf(stderr, "Error: invalid range size -- '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'h': printf("%s", help_message); return 1;
+        default: fprintf(stderr, "Usage: %s [-i input] [-D dict] [-f text|csv|json] [-r bytes] [-h]\n", argv[0]); exit(1);
+        }
+    }
+
+    if (infile_name != NULL) {
+        infile_descriptor = open(infile_name, O_RDONLY);
+        if (infile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to open input file -- '%s'\n", infile_name);
+            exit(1);
+        }
+    }
+    Dict *dict = NULL;
+    if (dict_name != NULL) {
+        dict = dict_open(dict_name);
+        if (dict == NULL) {
+            fprintf(stderr, "Error: unable to load dictionary -- '%s'\n", dict_name);
+            exit(1);
+        }
+    }
+
+    Decoder *decoder = decoder_create();
+    Inspect in;
+    memset(&in, 0, sizeof(in));
+    if (!decode_header(decoder, infile_descriptor, &in.header, dict)) {
+        fprintf(stderr, "Error: %s\n", decoder->error);
+        exit(1);
+    }
+    if (!(in.header.flags & FLAG_DICT)) {
+        dict_close(dict);
+        dict = NULL;
+    }
+    in.filter = decoder->filter;
+    in.header_bits = 8 * (sizeof(FileHeader) + (dict != NULL ? sizeof(uint32_t) : 0)
+                          + (in.filter != FILTER_NONE ? sizeof(uint32_t) : 0));
+    in.range_size = range_size;
+    in.lens = (uint16_t *) malloc(MAX_CODE * sizeof(uint16_t));
+    in.refs = (uint32_t *) malloc(MAX_CODE * sizeof(uint32_t));
+
+    // A corrupt stream is still reported up to where it went wrong.
+    bool ok = inspect_stream(&in, infile_descriptor, dict);
+    if (strcmp(format, "csv") == 0) {
+        print_csv(&in);
+    } else if (strcmp(format, "json") == 0) {
+        print_json(&in);
+    } else {
+        print_text(&in);
+    }
+    if (!ok) {
+        fflush(stdout);
+        fprintf(stderr, "Error: corrupt input after bit %lu\n", in.header_bits + total_bits);
+    }
+
+    free(in.refs);
+    free(in.lens);
+    free(in.ranges);
+    free(in.widths);
+    free(in.epochs);
+    decoder_delete(decoder);
+    dict_close(dict);
+    close(infile_descriptor);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,721 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain.h"
+#include "code.h"
+#include "decoder.h"
+#include "dict.h"
+#include "io.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "run.h"
+#include "trie.h"
+#include "word.h"
+
+// a chunk of input, from the reader to the trie walker, or of output, from the word builder to the writer
+typedef struct Chunk {
+    int len; // 0 at the end of the input.
+    uint8_t syms[PIPE_CHUNK + WORD_SLACK]; // Words are copied in WORD_SLACK symbols at a time.
+} Chunk;
+
+// a batch of bit fields, from the trie walker to the packer
+typedef struct Batch {
+    int len;
+    bool last; // No batches follow this one.
+    uint32_t bits[PIPE_BATCH];
+    uint8_t nbits[PIPE_BATCH];
+} Batch;
+
+typedef struct EncodePipe {
+    int infile;
+    int outfile;
+    Ring *full_chunks;
+    Ring *free_chunks;
+    Ring *full_batches;
+    Ring *free_batches;
+    Batch *batch; // The batch the walker is filling.
+    uint64_t packed_bits; // Bits the packer wrote. total_bits is per thread, so they're added to it after the join.
+
+    // the trie walk, carried from one chunk to the next: over chains, or over root and jump with a
+    // mem_limit, which is counted in TrieNodes as encode_stream counts it
+    ChainTrie *chains;
+    uint32_t chain;
+    uint32_t depth;
+    TrieNode *root;
+    TrieJump *jump;
+    Dict *dict;
+    bool runs;
+    uint64_t mem_limit;
+    TrieNode *curr_node;
+    TrieNode *prev_node;
+    uint8_t prev_sym;
+    uint16_t next_code;
+    int bitlen; // bit_len(next_code)
+    uint16_t phase_end; // The first code that needs more than bitlen bits.
+
+    // a run that reached the end of the last chunk and may carry on
+    uint8_t run_sym;
+    uint64_t run_count;
+} EncodePipe;
+
+// reader thread: fills free chunks with input until the input runs out
+static void *read_chunks(void *arg) {
+    EncodePipe *p = (EncodePipe *) arg;
+    for (;;) {
+        Chunk *c = (Chunk *) ring_pop(p->free_chunks);
+        c->len = read_bytes(p->infile, c->syms, PIPE_CHUNK);
+        ring_push(p->full_chunks, c);
+        if (c->len <= 0) {
+            return NULL;
+        }
+    }
+}
+
+// packer thread: packs the fields of every batch and writes them out
+static void *pack_batches(void *arg) {
+    EncodePipe *p = (EncodePipe *) arg;
+    BitWriter *bw = (BitWriter *) malloc(sizeof(BitWriter));
+    bw_init(bw, p->outfile);
+    uint64_t bits = 0;
+    bool last = false;
+    while (!last) {
+        Batch *b = (Batch *) ring_pop(p->full_batches);
+        for (int i = 0; i < b->len; i++) {
+            bw_bits(bw, b->bits[i], b->nbits[i]);
+            bits += b->nbits[i];
+        }
+        last = b->last;
+        b->len = 0;
+        ring_push(p->free_batches, b);
+    }
+    bw_flush(bw);
+    free(bw);
+    p->packed_bits = bits;
+    return NULL;
+}
+
+// adds a field of nbits bits to the batch, handing the batch over once it is full
+static inline void emit(EncodePipe *p, uint32_t bits, int nbits) {
+    Batch *b = p->batch;
+    b->bits[b->len] = bits;
+    b->nbits[b->len] = (uint8_t) nbits;
+    b->len += 1;
+    if (b->len == PIPE_BATCH) {
+        ring_push(p->full_batches, b);
+        p->batch = (Batch *) ring_pop(p->free_batches);
+    }
+}
+
+// writes out the pending run as CTRL_RUN blocks
+static void emit_run(EncodePipe *p) {
+    while (p->run_count > 0) {
+        uint32_t len = p->run_count > UINT32_MAX ? UINT32_MAX : (uint32_t) p->run_count;
+        emit(p, STOP_CODE | CTRL_RUN << p->bitlen, p->bitlen + 8);
+        emit(p, p->run_sym, 8);
+        emit(p, len, 32);
+        p->run_count -= len;
+    }
+}
+
+// sets next_code and the bit length of the codes written with it
+static void set_next_code(EncodePipe *p, uint16_t next_code) {
+    p->next_code = next_code;
+    p->bitlen = bit_len(next_code);
+    p->phase_end = p->bitlen == 16 ? MAX_CODE : (uint16_t) (1 << p->bitlen);
+}
+
+// empties the trie once next_code reaches MAX_CODE, reloading the dictionary if there is one
+static void reset(EncodePipe *p) {
+    if (p->chains != NULL) {
+        chain_trie_reset(p->chains);
+        p->chain = 0;
+        p->depth = 0;
+    } else {
+        trie_reset(p->root);
+        trie_jump_reset(p->jump);
+    }
+    if (p->dict != NULL) {
+        if (p->chains != NULL) {
+            dict_load_chains(p->dict, p->chains);
+        } else {
+            dict_load_trie(p->dict, p->root, p->jump);
+        }
+        set_next_code(p, dict_next_code(p->dict));
+    } else {
+        set_next_code(p, START_CODE);
+    }
+}
+
+// walks the trie over the n symbols of a chunk, emitting a pair for every phrase that ends in it
+static void walk(EncodePipe *p, const uint8_t *syms, int n) {
+    int i = 0;
+    if (p->run_count > 0) {
+        if (syms[0] == p->run_sym) {
+            i = (int) run_length(syms, n);
+            p->run_count += i;
+            if (i == n) {
+                return;
+            }
+        }
+        emit_run(p);
+    }
+
+    TrieNode *root = p->root;
+    TrieNode *curr_node = p->curr_node;
+    TrieNode *prev_node = p->prev_node;
+    uint8_t prev_sym = p->prev_sym;
+    while (i < n) {
+        if (curr_node == root) {
+            // A phrase starts here: look for a run, then for its first two symbols in the jump table.
+            if (p->runs && n - i >= RUN_MIN && syms[i] == syms[i + 1] && syms[i] == syms[i + RUN_MIN - 1]) {
+                uint32_t len = run_length(syms + i, n - i);
+                if (len >= RUN_MIN) {
+                    p->run_sym = syms[i];
+                    p->run_count = len;
+                    i += len;
+                    if (i < n) {
+                        emit_run(p);
+                    }
+                    continue;
+                }
+            }
+            if (n - i >= 2) {
+                TrieNode *node = p->jump[syms[i] << 8 | syms[i + 1]];
+                if (node != NULL) {
+                    prev_node = root->children[syms[i]];
+                    curr_node = node;
+                    prev_sym = syms[i + 1];
+                    i += 2;
+                    continue;
+                }
+            }
+        }
+        uint8_t curr_sym = syms[i];
+        i += 1;
+        TrieNode *next_node = trie_step(curr_node, curr_sym);
+        if (next_node != NULL) {
+            prev_node = curr_node;
+            curr_node = next_node;
+        } else {
+            emit(p, (uint32_t) curr_node->code | (uint32_t) curr_sym << p->bitlen, p->bitlen + 8);
+            TrieNode *child = trie_node_create(p->next_code);
+            curr_node->children[curr_sym] = child;
+            if (prev_node == root && curr_node != root) {
+                p->jump[prev_sym << 8 | curr_sym] = child;
+            }
+            curr_node = root;
+            p->next_code += 1;
+            if (p->next_code == p->phase_end) {
+                if (p->next_code == MAX_CODE) {
+                    reset(p);
+                } else {
+                    set_next_code(p, p->next_code);
+                }
+            }
+            if (p->mem_limit && trie_bytes >= p->mem_limit) {
+                emit(p, STOP_CODE | CTRL_RESET << p->bitlen, p->bitlen + 8);
+                reset(p);
+            }
+        }
+        prev_sym = curr_sym;
+    }
+    p->curr_node = curr_node;
+    p->prev_node = prev_node;
+    p->prev_sym = prev_sym;
+}
+
+// The same as walk, emitting the same fields, but walking p->chains: along a chain the chunk is compared
+// against the symbols of its nodes as many at a time as it has, as encode_chain_phase does.
+static void walk_chains(EncodePipe *p, const uint8_t *syms, int n) {
+    int i = 0;
+    if (p->run_count > 0) {
+        if (syms[0] == p->run_sym) {
+            i = (int) run_length(syms, n);
+            p->run_count += i;
+            if (i == n) {
+                return;
+            }
+        }
+        emit_run(p);
+    }
+
+    ChainTrie *t = p->chains;
+    uint32_t chain = p->chain;
+    uint32_t depth = p->depth;
+    while (i < n) {
+        if (chain == 0 && p->runs && n - i >= RUN_MIN && syms[i] == syms[i + 1] && syms[i] == syms[i + RUN_MIN - 1]) {
+            uint32_t len = run_length(syms + i, n - i);
+            if (len >= RUN_MIN) {
+                p->run_sym = syms[i];
+                p->run_count = len;
+                i += len;
+                if (i < n) {
+                    emit_run(p);
+                }
+                continue;
+            }
+        }
+        Chain *ch = &t->chains[chain];
+        uint32_t below = ch->len - 1 - depth; // nodes of the chain after the current one
+        if (below > 0) {
+            uint32_t span = (uint32_t) (n - i) < below ? (uint32_t) (n - i) : below;
+            uint32_t len = common_prefix(syms + i, ch->syms + depth + 1, span);
+            i += len;
+            depth += len;
+            if (len == span) {
+                continue;
+            }
+        } else if (ch->forks) {
+            uint32_t next = chain_trie_child(t, ch->codes[depth], syms[i]);
+            if (next != 0) {
+                chain = next;
+                depth = 0;
+                i += 1;
+                continue;
+            }
+        }
+        uint8_t curr_sym = syms[i];
+        i += 1;
+        emit(p, (uint32_t) ch->codes[depth] | (uint32_t) curr_sym << p->bitlen, p->bitlen + 8);
+        chain_trie_add(t, chain, depth, curr_sym, p->next_code);
+        chain = 0;
+        depth = 0;
+        p->next_code += 1;
+        if (p->next_code == p->phase_end) {
+            if (p->next_code == MAX_CODE) {
+                reset(p);
+            } else {
+                set_next_code(p, p->next_code);
+            }
+        }
+    }
+    p->chain = chain;
+    p->depth = depth;
+}
+
+void encode_pipelined(int infile, int outfile, const EncodeOptions *opts) {
+    Dict *dict = opts->dict;
+    EncodePipe pipe = {
+        .infile = infile,
+        .outfile = outfile,
+        .full_chunks = ring_create(PIPE_DEPTH),
+        .free_chunks = ring_create(PIPE_DEPTH),
+        .full_batches = ring_create(PIPE_DEPTH),
+        .free_batches = ring_create(PIPE_DEPTH),
+        .chains = opts->mem_limit ? NULL : chain_trie_create(),
+        .root = opts->mem_limit ? trie_create() : NULL,
+        .jump = opts->mem_limit ? trie_jump_create() : NULL,
+        .dict = dict,
+        .runs = opts->runs,
+        .mem_limit = opts->mem_limit,
+    };
+    EncodePipe *p = &pipe;
+    p->curr_node = p->root;
+    if (dict != NULL) {
+        if (p->chains != NULL) {
+            dict_load_chains(dict, p->chains);
+        } else {
+            dict_load_trie(dict, p->root, p->jump);
+        }
+        set_next_code(p, dict_next_code(dict));
+    } else {
+        set_next_code(p, START_CODE);
+    }
+
+    for (int i = 0; i < PIPE_DEPTH; i++) {
+        ring_push(p->free_chunks, malloc(sizeof(Chunk)));
+        Batch *b = (Batch *) malloc(sizeof(Batch));
+        b->len = 0;
+        b->last = false;
+        ring_push(p->free_batches, b);
+    }
+    p->batch = (Batch *) ring_pop(p->free_batches);
+
+    pthread_t reader;
+    pthread_t packer;
+    pthread_create(&reader, NULL, read_chunks, p);
+    pthread_create(&packer, NULL, pack_batches, p);
+
+    for (;;) {
+        Chunk *c = (Chunk *) ring_pop(p->full_chunks);
+        if (c->len <= 0) {
+            free(c);
+            break;
+        }
+        if (p->chains != NULL) {
+            walk_chains(p, c->syms, c->len);
+        } else {
+            walk(p, c->syms, c->len);
+        }
+        total_syms += c->len;
+        ring_push(p->free_chunks, c);
+    }
+
+    // Write the pending run, the phrase still being matched and STOP_CODE, as encode does.
+    emit_run(p);
+    if (p->chains != NULL ? p->chain != 0 : p->curr_node != p->root) {
+        uint16_t code = 0;
+        uint8_t sym = 0;
+        if (p->chains != NULL) {
+            chain_trie_pair(p->chains, p->chain, p->depth, &code, &sym);
+        } else {
+            code = p->prev_node->code;
+            sym = p->prev_sym;
+        }
+        emit(p, (uint32_t) code | (uint32_t) sym << p->bitlen, p->bitlen + 8);
+        set_next_code(p, p->next_code + 1);
+        if (p->next_code == MAX_CODE) {
+            reset(p);
+        }
+    }
+    emit(p, STOP_CODE, p->bitlen + 8);
+    p->batch->last = true;
+    ring_push(p->full_batches, p->batch);
+
+    pthread_join(reader, NULL);
+    pthread_join(packer, NULL);
+    total_bits += p->packed_bits;
+    for (int i = 0; i < PIPE_DEPTH - 1; i++) {
+        free(ring_pop(p->free_chunks));
+    }
+    for (int i = 0; i < PIPE_DEPTH; i++) {
+        free(ring_pop(p->free_batches));
+    }
+    ring_delete(p->full_chunks);
+    ring_delete(p->free_chunks);
+    ring_delete(p->full_batches);
+    ring_delete(p->free_batches);
+    chain_trie_delete(p->chains);
+    trie_jump_delete(p->jump);
+    trie_delete(p->root);
+}
+
+// a batch of pairs, from the unpacker to the word builder
+typedef struct Pairs {
+    int len;
+    bool sync; // Ends at a CTRL_SYNC pair: everything decoded so far is written out.
+    bool last; // No batches follow this one.
+    uint16_t codes[PIPE_BATCH];
+    uint8_t syms[PIPE_BATCH];
+    uint32_t counts[PIPE_BATCH]; // For STOP_CODE: the length of a run of the symbol, or 0 for a reset.
+} Pairs;
+
+typedef struct DecodePipe {
+    int infile;
+    int outfile;
+    uint16_t first_code; // Where next_code starts, and goes back to on a reset.
+    Ring *full_pairs;
+    Ring *free_pairs;
+    Ring *full_chunks;
+    Ring *free_chunks;
+    Chunk *chunk; // The chunk the word builder is filling.
+    uint64_t read_bits; // Bits the unpacker read, added to total_bits after the join.
+    char error[128]; // Why the unpacker stopped early, set before it hands over its last batch.
+} DecodePipe;
+
+// adds a pair to the batch, handing the batch over once it is full
+static inline __attribute__((always_inline)) Pairs *add_pair(DecodePipe *p, Pairs *b, uint16_t code, uint8_t sym, uint32_t count) {
+    b->codes[b->len] = code;
+    b->syms[b->len] = sym;
+    b->counts[b->len] = count;
+    b->len += 1;
+    if (b->len == PIPE_BATCH) {
+        ring_push(p->full_pairs, b);
+        b = (Pairs *) ring_pop(p->free_pairs);
+    }
+    return b;
+}
+
+// what ended an unpack phase, if it wasn't a pair with STOP_CODE, whose symbol is returned instead
+#define UNPACK_NEXT -1 // next_code reached the first code that needs more bits.
+#define UNPACK_TRUNCATED -2 // The input ran out.
+#define UNPACK_CORRUPT -3 // A code that isn't in the table yet.
+
+// Reads pairs into batches until next_code reaches the first code that needs more than bitlen bits,
+// like decode_phase, with bitlen a compile-time constant in each of the unpack_phase_N instances below.
+static inline __attribute__((always_inline)) int unpack_phase(
+    DecodePipe *p, BitReader *br, Pairs **batch, uint16_t *next, int bitlen) {
+    uint16_t next_code = *next;
+    uint16_t phase_end = bitlen == 16 ? MAX_CODE : (uint16_t) (1 << bitlen);
+    uint64_t pairs = 0;
+    int end = UNPACK_NEXT;
+    Pairs *b = *batch;
+    uint16_t code = 0;
+    uint8_t sym = 0;
+    while (next_code != phase_end) {
+        if (!br_pair(br, &code, &sym, bitlen)) {
+            end = UNPACK_TRUNCATED;
+            break;
+        }
+        pairs += 1;
+        if (code == STOP_CODE) {
+            end = sym;
+            break;
+        }
+        if (code >= next_code) {
+            end = UNPACK_CORRUPT;
+            break;
+        }
+        b = add_pair(p, b, code, sym, 0);
+        next_code += 1;
+    }
+    total_bits += pairs * (bitlen + 8);
+    *batch = b;
+    *next = next_code;
+    return end;
+}
+
+#define UNPACK_PHASE(N)                                                                            \
+    static int unpack_phase_##N(DecodePipe *p, BitReader *br, Pairs **batch, uint16_t *next) {     \
+        return unpack_phase(p, br, batch, next, N);                                                \
+    }
+UNPACK_PHASE(2)
+UNPACK_PHASE(3)
+UNPACK_PHASE(4)
+UNPACK_PHASE(5)
+UNPACK_PHASE(6)
+UNPACK_PHASE(7)
+UNPACK_PHASE(8)
+UNPACK_PHASE(9)
+UNPACK_PHASE(10)
+UNPACK_PHASE(11)
+UNPACK_PHASE(12)
+UNPACK_PHASE(13)
+UNPACK_PHASE(14)
+UNPACK_PHASE(15)
+UNPACK_PHASE(16)
+
+// unpack_phases[n] unpacks the phase whose codes are n bits long
+static int (*const unpack_phases[])(DecodePipe *, BitReader *, Pairs **, uint16_t *) = {
+    NULL,
+    NULL,
+    unpack_phase_2,
+    unpack_phase_3,
+    unpack_phase_4,
+    unpack_phase_5,
+    unpack_phase_6,
+    unpack_phase_7,
+    unpack_phase_8,
+    unpack_phase_9,
+    unpack_phase_10,
+    unpack_phase_11,
+    unpack_phase_12,
+    unpack_phase_13,
+    unpack_phase_14,
+    unpack_phase_15,
+    unpack_phase_16,
+};
+
+// unpacker thread: reads the pairs and control blocks of the input into batches, until STOP_CODE, the
+// end of the input or a pair that can't be decoded
+static void *unpack_pairs(void *arg) {
+    DecodePipe *p = (DecodePipe *) arg;
+    BitReader *br = (BitReader *) malloc(sizeof(BitReader));
+    br_init(br, p->infile);
+    Pairs *b = (Pairs *) ring_pop(p->free_pairs);
+    uint16_t next_code = p->first_code;
+    uint32_t run_sym = 0;
+    uint32_t count = 0;
+    // Like decode_stream, a stream cut short ends quietly after its last complete pair.
+    for (;;) {
+        int end = unpack_phases[bit_len(next_code)](p, br, &b, &next_code);
+        if (end == UNPACK_NEXT) {
+            if (next_code == MAX_CODE) {
+                next_code = p->first_code;
+            }
+            continue;
+        }
+        if (end == CTRL_RUN) {
+            if (!br_bits(br, &run_sym, 8) || !br_bits(br, &count, 32)) {
+                break;
+            }
+            total_bits += 8 + 32;
+            if (count > 0) {
+                b = add_pair(p, b, STOP_CODE, (uint8_t) run_sym, count);
+            }
+        } else if (end == CTRL_RESET) {
+            b = add_pair(p, b, STOP_CODE, 0, 0);
+            next_code = p->first_code;
+        } else if (end == CTRL_SYNC) {
+            br_align(br);
+            b->sync = true;
+            ring_push(p->full_pairs, b);
+            b = (Pairs *) ring_pop(p->free_pairs);
+        } else {
+            // Checksums and duplicates are left to decode_stream, so they can only turn up in a stream
+            // whose header doesn't have them.
+            if (end == UNPACK_CORRUPT) {
+                snprintf(p->error, sizeof(p->error), "corrupt input -- code out of range");
+            } else if (end == CTRL_CHECK) {
+                snprintf(p->error, sizeof(p->error), "unexpected checksum block");
+            } else if (end == CTRL_DUP) {
+                snprintf(p->error, sizeof(p->error), "corrupt input -- duplicate out of range");
+            } else if (end > 0) {
+                snprintf(p->error, sizeof(p->error), "unknown control pair -- %d", end);
+            }
+            break;
+        }
+    }
+    b->last = true;
+    p->read_bits = total_bits;
+    ring_push(p->full_pairs, b);
+    free(br);
+    return NULL;
+}
+
+// writer thread: writes out every chunk of output until the empty one that ends it
+static void *write_chunks(void *arg) {
+    DecodePipe *p = (DecodePipe *) arg;
+    for (;;) {
+        Chunk *c = (Chunk *) ring_pop(p->full_chunks);
+        if (c->len == 0) {
+            ring_push(p->free_chunks, c);
+            return NULL;
+        }
+        write_bytes(p->outfile, c->syms, c->len);
+        c->len = 0;
+        ring_push(p->free_chunks, c);
+    }
+}
+
+// hands the chunk being filled to the writer, and starts on the next one
+static void next_chunk(DecodePipe *p) {
+    ring_push(p->full_chunks, p->chunk);
+    p->chunk = (Chunk *) ring_pop(p->free_chunks);
+}
+
+// copies a word into the chunk, WORD_SLACK symbols at a time like write_word
+static inline __attribute__((always_inline)) void put_word(DecodePipe *p, const Word *w) {
+    if (p->chunk->len + (int) w->len > PIPE_CHUNK) {
+        next_chunk(p);
+    }
+    uint8_t *out = p->chunk->syms + p->chunk->len;
+    for (uint32_t i = 0; i < w->len; i += WORD_SLACK) {
+        memcpy(out + i, w->syms + i, WORD_SLACK);
+    }
+    p->chunk->len += w->len;
+    total_syms += w->len;
+}
+
+// adds count copies of sym to the output, over as many chunks as it takes
+static void put_run(DecodePipe *p, uint8_t sym, uint32_t count) {
+    total_syms += count;
+    while (count > 0) {
+        if (p->chunk->len == PIPE_CHUNK) {
+            next_chunk(p);
+        }
+        uint32_t n = PIPE_CHUNK - p->chunk->len;
+        if (n > count) {
+            n = count;
+        }
+        memset(p->chunk->syms + p->chunk->len, sym, n);
+        p->chunk->len += n;
+        count -= n;
+    }
+}
+
+// empties the word table on a reset, reloading the dictionary if there is one
+static uint16_t reset_words(WordTable *table, const Dict *dict) {
+    wt_reset(table);
+    if (dict != NULL) {
+        dict_load_words(dict, table);
+        return dict_next_code(dict);
+    }
+    return START_CODE;
+}
+
+bool decode_pipelined(Decoder *d, int infile, int outfile, const Dict *dict) {
+    d->error[0] = '\0';
+    if (d->flags & (FLAG_CHECK | FLAG_DEDUP | FLAG_FILTER)) {
+        return false;
+    }
+    WordTable *table = d->table;
+    uint16_t next_code = START_CODE;
+    if (dict != NULL) {
+        dict_load_words(dict, table);
+        next_code = dict_next_code(dict);
+    }
+    DecodePipe pipe = {
+        .infile = infile,
+        .outfile = outfile,
+        .first_code = next_code,
+        .full_pairs = ring_create(PIPE_DEPTH),
+        .free_pairs = ring_create(PIPE_DEPTH),
+        .full_chunks = ring_create(PIPE_DEPTH),
+        .free_chunks = ring_create(PIPE_DEPTH),
+        .read_bits = 0,
+        .error = "",
+    };
+    DecodePipe *p = &pipe;
+    for (int i = 0; i < PIPE_DEPTH; i++) {
+        Pairs *b = (Pairs *) malloc(sizeof(Pairs));
+        b->len = 0;
+        b->sync = false;
+        b->last = false;
+        ring_push(p->free_pairs, b);
+        Chunk *c = (Chunk *) malloc(sizeof(Chunk));
+        c->len = 0;
+        ring_push(p->free_chunks, c);
+    }
+    p->chunk = (Chunk *) ring_pop(p->free_chunks);
+
+    pthread_t unpacker;
+    pthread_t writer;
+    pthread_create(&unpacker, NULL, unpack_pairs, p);
+    pthread_create(&writer, NULL, write_chunks, p);
+
+    // Build the words of every batch into chunks of output, as decode_stream builds them in its table.
+    bool last = false;
+    while (!last) {
+        Pairs *b = (Pairs *) ring_pop(p->full_pairs);
+        for (int i = 0; i < b->len; i++) {
+            if (b->codes[i] == STOP_CODE) {
+                if (b->counts[i] > 0) {
+                    put_run(p, b->syms[i], b->counts[i]);
+                } else {
+                    next_code = reset_words(table, dict);
+                }
+                continue;
+            }
+            table[next_code] = word_append_sym(table[b->codes[i]], b->syms[i]);
+            put_word(p, table[next_code]);
+            next_code += 1;
+            if (next_code == MAX_CODE) {
+                next_code = reset_words(table, dict);
+            }
+        }
+        if (b->sync && p->chunk->len > 0) {
+            next_chunk(p);
+        }
+        last = b->last;
+        b->len = 0;
+        b->sync = false;
+        ring_push(p->free_pairs, b);
+    }
+    if (p->chunk->len > 0) {
+        next_chunk(p);
+    }
+    // The empty chunk tells the writer there's no more.
+    ring_push(p->full_chunks, p->chunk);
+
+    pthread_join(unpacker, NULL);
+    pthread_join(writer, NULL);
+    total_bits += p->read_bits;
+    snprintf(d->error, sizeof(d->error), "%s", p->error);
+    for (int i = 0; i < PIPE_DEPTH; i++) {
+        free(ring_pop(p->free_pairs));
+        free(ring_pop(p->free_chunks));
+    }
+    ring_delete(p->full_pairs);
+    ring_delete(p->free_pairs);
+    ring_delete(p->full_chunks);
+    ring_delete(p->free_chunks);
+
+    // Leave just the empty word for the next stream.
+    wt_reset(table);
+    return d->error[0] == '\0';
+}
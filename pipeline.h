@@ -0,0 +1,35 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdbool.h>
+
+#include "decoder.h"
+#include "encoder.h"
+
+#define PIPE_CHUNK (1 << 20) // Bytes of input per chunk handed to the trie walker, or of output to the writer.
+#define PIPE_BATCH 16384 // Bit fields per batch handed to the bit packer, or pairs to the word builder.
+#define PIPE_DEPTH 4 // Chunks or batches in flight between two stages.
+
+//
+// Encode everything in infile to outfile, after the header, with the work split over three threads:
+// a reader fills large chunks of input, the calling thread walks the trie over them and hands the
+// fields it emits to a packer thread in batches, and the packer packs and writes them out.
+//
+// Without runs the output is exactly what the single-threaded encode loop writes. With runs, the
+// larger chunks let run blocks be found across what would be buffer ends for read_sym, so the output
+// may differ but decodes the same.
+//
+void encode_pipelined(int infile, int outfile, const EncodeOptions *opts);
+
+//
+// Decode the stream like decode_stream, with the work split over three threads: an unpacker reads
+// the pairs and control blocks of the input into batches of codes and symbols, the calling thread
+// builds their words in d's table and copies them into large chunks of output, and a writer writes
+// the chunks out. A CTRL_SYNC pair hands over whatever has been decoded before it.
+//
+// The output is exactly what decode_stream writes. Streams with checksums, duplicates or a filter
+// can't be decoded this way: false is returned with d->error empty, before reading any of the stream.
+//
+bool decode_pipelined(Decoder *d, int infile, int outfile, const Dict *dict);
+
+#endif
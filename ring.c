@@ -0,0 +1,62 @@
+#include <sched.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+/*
+ * Constructor: Creates a ring that holds up to size items
+ * size is rounded up to a power of two
+ */
+Ring *ring_create(uint32_t size) {
+    Ring *r = (Ring *) malloc(sizeof(Ring));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->size = 1;
+    while (r->size < size) {
+        r->size <<= 1;
+    }
+    r->slots = (void **) calloc(r->size, sizeof(void *));
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    return r;
+}
+
+/*
+ * Destructor: Frees the ring, not the items left in it
+ */
+void ring_delete(Ring *r) {
+    if (r == NULL) {
+        return;
+    }
+    free(r->slots);
+    free(r);
+}
+
+/*
+ * Adds item to the ring, waiting for the consumer while the ring is full
+ * Only called by the producer
+ */
+void ring_push(Ring *r, void *item) {
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    // Stages hand over large batches, so a full ring is rare and yielding is cheap enough.
+    while (tail - atomic_load_explicit(&r->head, memory_order_acquire) == r->size) {
+        sched_yield();
+    }
+    r->slots[tail & (r->size - 1)] = item;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/*
+ * Removes and returns the oldest item, waiting for the producer while the ring is empty
+ * Only called by the consumer
+ */
+void *ring_pop(Ring *r) {
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (atomic_load_explicit(&r->tail, memory_order_acquire) == head) {
+        sched_yield();
+    }
+    void *item = r->slots[head & (r->size - 1)];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return item;
+}
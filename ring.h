@@ -0,0 +1,43 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// A lock-free ring of pointers with a single producer thread and a single consumer thread. Pipeline
+// stages hand whole batches to each other through it, and usually get the empty batches back through
+// a second ring going the other way.
+//
+typedef struct Ring {
+    void **slots;
+    uint32_t size; // A power of two.
+    _Atomic uint32_t head; // Next slot to pop. Only written by the consumer.
+    _Atomic uint32_t tail; // Next slot to push. Only written by the producer.
+} Ring;
+
+/*
+ * Constructor: Creates a ring that holds up to size items
+ * size is rounded up to a power of two
+ */
+Ring *ring_create(uint32_t size);
+
+/*
+ * Destructor: Frees the ring, not the items left in it
+ */
+void ring_delete(Ring *r);
+
+/*
+ * Adds item to the ring, waiting for the consumer while the ring is full
+ * Only called by the producer
+ */
+void ring_push(Ring *r, void *item);
+
+/*
+ * Removes and returns the oldest item, waiting for the producer while the ring is empty
+ * Only called by the consumer
+ */
+void *ring_pop(Ring *r);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdint.h>
+
+#include "run.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RUN_X86
+#endif
+
+// compares the rest of the symbols one at a time, starting at syms[i]
+static uint32_t run_length_scalar(const uint8_t *syms, uint32_t i, uint32_t n) {
+    uint8_t sym = syms[0];
+    while (i < n && syms[i] == sym) {
+        i += 1;
+    }
+    return i;
+}
+
+// compares the rest of a and b one symbol at a time, starting at a[i] and b[i]
+static uint32_t common_prefix_scalar(const uint8_t *a, const uint8_t *b, uint32_t i, uint32_t n) {
+    while (i < n && a[i] == b[i]) {
+        i += 1;
+    }
+    return i;
+}
+
+#ifdef RUN_X86
+__attribute__((target("sse2"))) static uint32_t run_length_sse2(const uint8_t *syms, uint32_t n) {
+    __m128i sym = _mm_set1_epi8((char) syms[0]);
+    uint32_t i = 0;
+    while (i + 16 <= n) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (syms + i));
+        // a set bit in differ marks a symbol that is not part of the run
+        uint32_t differ = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block, sym)) ^ 0xFFFF;
+        if (differ) {
+            return i + __builtin_ctz(differ);
+        }
+        i += 16;
+    }
+    return run_length_scalar(syms, i, n);
+}
+
+__attribute__((target("avx2"))) static uint32_t run_length_avx2(const uint8_t *syms, uint32_t n) {
+    __m256i sym = _mm256_set1_epi8((char) syms[0]);
+    uint32_t i = 0;
+    while (i + 32 <= n) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (syms + i));
+        uint32_t differ = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, sym)) ^ 0xFFFFFFFF;
+        if (differ) {
+            return i + __builtin_ctz(differ);
+        }
+        i += 32;
+    }
+    return run_length_scalar(syms, i, n);
+}
+
+__attribute__((target("sse2"))) static uint32_t common_prefix_sse2(const uint8_t *a, const uint8_t *b, uint32_t n) {
+    uint32_t i = 0;
+    while (i + 16 <= n) {
+        __m128i block_a = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i block_b = _mm_loadu_si128((const __m128i *) (b + i));
+        uint32_t differ = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block_a, block_b)) ^ 0xFFFF;
+        if (differ) {
+            return i + __builtin_ctz(differ);
+        }
+        i += 16;
+    }
+    return common_prefix_scalar(a, b, i, n);
+}
+
+__attribute__((target("avx2"))) static uint32_t common_prefix_avx2(const uint8_t *a, const uint8_t *b, uint32_t n) {
+    uint32_t i = 0;
+    while (i + 32 <= n) {
+        __m256i block_a = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i block_b = _mm256_loadu_si256((const __m256i *) (b + i));
+        uint32_t differ = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block_a, block_b)) ^ 0xFFFFFFFF;
+        if (differ) {
+            return i + __builtin_ctz(differ);
+        }
+        i += 32;
+    }
+    return common_prefix_scalar(a, b, i, n);
+}
+#endif
+
+/*
+ * Returns how many of the first n symbols of syms are equal to syms[0]
+ * Compares 32 or 16 symbols at a time with AVX2 or SSE2 when the CPU has them
+ */
+uint32_t run_length(const uint8_t *syms, uint32_t n) {
+    if (n == 0) {
+        return 0;
+    }
+#ifdef RUN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return run_length_avx2(syms, n);
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return run_length_sse2(syms, n);
+    }
+#endif
+    return run_length_scalar(syms, 1, n);
+}
+
+/*
+ * Returns how many of the first n symbols of a and b are equal before the first that differ
+ * Compares 32 or 16 symbols at a time with AVX2 or SSE2 when the CPU has them
+ */
+uint32_t common_prefix(const uint8_t *a, const uint8_t *b, uint32_t n) {
+    // most prefixes end within a few symbols, before a block compare pays off
+    uint32_t i = 0;
+    while (i < n && i < 4) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+        i += 1;
+    }
+    if (i == n) {
+        return n;
+    }
+#ifdef RUN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return i + common_prefix_avx2(a + i, b + i, n - i);
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return i + common_prefix_sse2(a + i, b + i, n - i);
+    }
+#endif
+    return common_prefix_scalar(a, b, i, n);
+}
@@ -0,0 +1,20 @@
+#ifndef __RUN_H__
+#define __RUN_H__
+
+#include <stdint.h>
+
+#define RUN_MIN 32 // Shortest run of one symbol that is encoded as a CTRL_RUN block.
+
+/*
+ * Returns how many of the first n symbols of syms are equal to syms[0]
+ * Compares 32 or 16 symbols at a time with AVX2 or SSE2 when the CPU has them
+ */
+uint32_t run_length(const uint8_t *syms, uint32_t n);
+
+/*
+ * Returns how many of the first n symbols of a and b are equal before the first that differ
+ * Compares 32 or 16 symbols at a time with AVX2 or SSE2 when the CPU has them
+ */
+uint32_t common_prefix(const uint8_t *a, const uint8_t *b, uint32_t n);
+
+#endif
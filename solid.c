@@ -0,0 +1,378 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "solid.h"
+
+#define SOLID_TRAILER 12 // Bytes of the table offset and SOLID_MAGIC.
+#define SOLID_BLOCK 65536 // Bytes of a file copied into the pipe at a time.
+
+// Returns true if name is relative and has no '..' component, so that it stays in the directory it's
+// extracted to.
+static bool safe_name(const char *name, size_t len) {
+    if (len == 0 || name[0] == '/') {
+        return false;
+    }
+    for (size_t i = 0; i < len;) {
+        size_t end = i;
+        while (end < len && name[end] != '/') {
+            end += 1;
+        }
+        if (end - i == 2 && name[i] == '.' && name[i + 1] == '.') {
+            return false;
+        }
+        i = end + 1;
+    }
+    return memchr(name, '\0', len) == NULL;
+}
+
+SolidTable *solid_table_create(void) {
+    return (SolidTable *) calloc(1, sizeof(SolidTable));
+}
+
+void solid_table_delete(SolidTable *t) {
+    if (t == NULL) {
+        return;
+    }
+    for (uint32_t k = 0; k < t->count; k++) {
+        free(t->files[k].name);
+    }
+    free(t->files);
+    free(t->resets.resets);
+    free(t);
+}
+
+// Adds the len bytes of name to t.
+static void table_add(SolidTable *t, const char *name, size_t len, uint64_t size, uint32_t mode) {
+    if (t->count == t->cap) {
+        t->cap = t->cap ? 2 * t->cap : 16;
+        t->files = (SolidFile *) realloc(t->files, t->cap * sizeof(SolidFile));
+    }
+    SolidFile *f = &t->files[t->count];
+    f->name = (char *) malloc(len + 1);
+    memcpy(f->name, name, len);
+    f->name[len] = '\0';
+    f->size = size;
+    f->mode = mode;
+    f->start = t->count ? t->files[t->count - 1].start + t->files[t->count - 1].size : 0;
+    t->count += 1;
+}
+
+bool solid_table_add(SolidTable *t, const char *name, uint32_t mode) {
+    size_t len = strlen(name);
+    if (len > UINT16_MAX || !safe_name(name, len)) {
+        return false;
+    }
+    table_add(t, name, len, 0, mode);
+    return true;
+}
+
+uint64_t solid_stream_start(uint16_t flags) {
+    return sizeof(FileHeader) + (flags & FLAG_DICT ? sizeof(uint32_t) : 0)
+           + (flags & FLAG_FILTER ? sizeof(uint32_t) : 0);
+}
+
+// solid thread: copies each file into the pipe, until they're all read or the pipe is closed
+static void *solid_input_thread(void *arg) {
+    SolidInput *in = (SolidInput *) arg;
+    SolidTable *t = in->table;
+    for (uint32_t k = 0; k < t->count && in->failed == NULL; k++) {
+        SolidFile *f = &t->files[k];
+        f->start = k ? t->files[k - 1].start + t->files[k - 1].size : 0;
+        f->size = 0;
+        int infile = open(f->name, O_RDONLY);
+        if (infile == -1) {
+            in->failed = f->name;
+            break;
+        }
+        int len;
+        while ((len = read_bytes(infile, in->block, SOLID_BLOCK)) > 0) {
+            if (write_bytes(in->pipe[1], in->block, len) != len) {
+                in->failed = f->name;
+                break;
+            }
+            f->size += len;
+        }
+        close(infile);
+    }
+    close(in->pipe[1]);
+    return NULL;
+}
+
+int solid_input_start(SolidInput *in, SolidTable *t) {
+    in->table = t;
+    in->failed = NULL;
+    in->block = (uint8_t *) malloc(SOLID_BLOCK);
+    if (in->block == NULL || pipe(in->pipe) != 0) {
+        free(in->block);
+        return -1;
+    }
+    if (pthread_create(&in->thread, NULL, solid_input_thread, in) != 0) {
+        close(in->pipe[0]);
+        close(in->pipe[1]);
+        free(in->block);
+        return -1;
+    }
+    return in->pipe[0];
+}
+
+bool solid_input_finish(SolidInput *in) {
+    pthread_join(in->thread, NULL);
+    free(in->block);
+    return in->failed == NULL;
+}
+
+// the bytes of a file table, as it's built or parsed
+typedef struct TableBuf {
+    uint8_t *bytes;
+    size_t len;
+    size_t cap; // Of bytes when building, or where parsing stops.
+    bool ok; // False once parsing ran past cap.
+} TableBuf;
+
+// Appends the n low bytes of value to b, little-endian.
+static void put(TableBuf *b, uint64_t value, int n) {
+    if (b->len + n > b->cap) {
+        b->cap = 2 * b->cap + n;
+        b->bytes = (uint8_t *) realloc(b->bytes, b->cap);
+    }
+    for (int i = 0; i < n; i++) {
+        b->bytes[b->len++] = (uint8_t) (value >> 8 * i);
+    }
+}
+
+// Takes n little-endian bytes off b, or returns 0 and clears b->ok if there aren't that many left.
+static uint64_t get(TableBuf *b, int n) {
+    if (!b->ok || b->cap - b->len < (size_t) n) {
+        b->ok = false;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++) {
+        value |= (uint64_t) b->bytes[b->len++] << 8 * i;
+    }
+    return value;
+}
+
+void solid_write_table(int outfile, const SolidTable *t, uint64_t offset) {
+    TableBuf b = { .bytes = NULL, .len = 0, .cap = 0, .ok = true };
+    put(&b, t->count, 4);
+    for (uint32_t k = 0; k < t->count; k++) {
+        const SolidFile *f = &t->files[k];
+        size_t len = strlen(f->name);
+        put(&b, f->size, 8);
+        put(&b, f->mode, 4);
+        put(&b, len, 2);
+        for (size_t i = 0; i < len; i++) {
+            put(&b, (uint8_t) f->name[i], 1);
+        }
+    }
+    put(&b, t->resets.count, 4);
+    for (uint32_t r = 0; r < t->resets.count; r++) {
+        put(&b, t->resets.resets[r].bit, 8);
+        put(&b, t->resets.resets[r].sym, 8);
+    }
+    put(&b, offset, 8);
+    put(&b, SOLID_MAGIC, 4);
+    write_bytes(outfile, b.bytes, (int) b.len);
+    free(b.bytes);
+}
+
+SolidTable *solid_read_table(Decoder *d, int infile) {
+    d->error[0] = '\0';
+    if (!(d->flags & FLAG_SOLID)) {
+        snprintf(d->error, sizeof(d->error), "input is not a solid archive");
+        return NULL;
+    }
+    struct stat info;
+    uint8_t trailer[SOLID_TRAILER];
+    if (fstat(infile, &info) != 0 || info.st_size < SOLID_TRAILER
+        || pread(infile, trailer, SOLID_TRAILER, info.st_size - SOLID_TRAILER) != SOLID_TRAILER) {
+        snprintf(d->error, sizeof(d->error), "unable to read the file table -- input must be a file");
+        return NULL;
+    }
+    TableBuf b = { .bytes = trailer, .len = 0, .cap = SOLID_TRAILER, .ok = true };
+    uint64_t offset = get(&b, 8);
+    uint64_t end = (uint64_t) info.st_size - SOLID_TRAILER;
+    if (get(&b, 4) != SOLID_MAGIC || offset < solid_stream_start(d->flags) || offset > end) {
+        snprintf(d->error, sizeof(d->error), "corrupt file table -- bad trailer");
+        return NULL;
+    }
+
+    b = (TableBuf) { .bytes = (uint8_t *) malloc(end - offset + 1), .len = 0, .cap = end - offset, .ok = true };
+    if (b.bytes == NULL || pread(infile, b.bytes, b.cap, offset) != (ssize_t) b.cap) {
+        free(b.bytes);
+        snprintf(d->error, sizeof(d->error), "unable to read the file table");
+        return NULL;
+    }
+    SolidTable *t = solid_table_create();
+    uint32_t count = (uint32_t) get(&b, 4);
+    for (uint32_t k = 0; k < count && b.ok; k++) {
+        uint64_t size = get(&b, 8);
+        uint32_t mode = (uint32_t) get(&b, 4);
+        uint16_t len = (uint16_t) get(&b, 2);
+        if (!b.ok || b.cap - b.len < len || !safe_name((const char *) b.bytes + b.len, len)) {
+            b.ok = false;
+            break;
+        }
+        table_add(t, (const char *) b.bytes + b.len, len, size, mode);
+        b.len += len;
+    }
+    // The stream ends before the table, and every reset is in it, in order.
+    uint64_t syms = t->count ? t->files[t->count - 1].start + t->files[t->count - 1].size : 0;
+    uint64_t bits = 8 * (offset - solid_stream_start(d->flags));
+    ResetLog *log = &t->resets;
+    log->count = (uint32_t) get(&b, 4);
+    if (b.ok && b.cap - b.len == 16 * (uint64_t) log->count) {
+        log->cap = log->count;
+        log->resets = (Reset *) malloc(log->cap * sizeof(Reset) + 1);
+        for (uint32_t r = 0; r < log->count; r++) {
+            Reset *reset = &log->resets[r];
+            reset->bit = get(&b, 8);
+            reset->sym = get(&b, 8);
+            Reset prev = r ? log->resets[r - 1] : (Reset) { .bit = 0, .sym = 0 };
+            if (reset->bit < prev.bit || reset->bit > bits || reset->sym < prev.sym || reset->sym > syms) {
+                b.ok = false;
+            }
+        }
+    } else {
+        log->count = 0;
+        b.ok = false;
+    }
+    free(b.bytes);
+    if (!b.ok) {
+        solid_table_delete(t);
+        snprintf(d->error, sizeof(d->error), "corrupt file table");
+        return NULL;
+    }
+    return t;
+}
+
+int solid_find(const SolidTable *t, const char *name) {
+    for (uint32_t k = 0; k < t->count; k++) {
+        if (strcmp(t->files[k].name, name) == 0) {
+            return (int) k;
+        }
+    }
+    return -1;
+}
+
+bool solid_extract(Decoder *d, int infile, const SolidTable *t, uint32_t k, int outfile, const Dict *dict) {
+    const SolidFile *f = &t->files[k];
+    if (f->size == 0) {
+        return true;
+    }
+    // The last reset at or before the start of the file, or the start of the stream if there is none.
+    const ResetLog *log = &t->resets;
+    uint32_t lo = 0;
+    uint32_t hi = log->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (log->resets[mid].sym <= f->start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    Reset from = lo ? log->resets[lo - 1] : (Reset) { .bit = 0, .sym = 0 };
+    int64_t bit = (int64_t) (8 * solid_stream_start(d->flags) + from.bit);
+    return decode_range(d, infile, bit, f->start - from.sym, f->size, outfile, dict);
+}
+
+// the files solid_extract_all writes the symbols of the stream to, one after the other
+typedef struct SolidOutput {
+    const SolidTable *table;
+    const char *dir;
+    uint32_t next; // The file to open once the one being written is done.
+    int outfile; // The file being written, or -1.
+    uint64_t left; // Bytes of it still to write.
+    const char *failed; // The file that couldn't be created, or NULL.
+    bool extra; // More symbols came than the files take.
+} SolidOutput;
+
+// Creates file k of the table under o->dir, and the directories of its name, leaving it open for
+// writing as o->outfile.
+static void solid_create(SolidOutput *o, uint32_t k) {
+    const SolidFile *f = &o->table->files[k];
+    size_t len = strlen(o->dir) + 1 + strlen(f->name) + 1;
+    char *path = (char *) malloc(len);
+    snprintf(path, len, "%s/%s", o->dir, f->name);
+    for (char *slash = path + strlen(o->dir) + 1; (slash = strchr(slash, '/')) != NULL; slash++) {
+        *slash = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            break;
+        }
+        *slash = '/';
+    }
+    o->outfile = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    free(path);
+    if (o->outfile == -1) {
+        o->failed = f->name;
+        return;
+    }
+    // Only the permission bits: an archive mustn't be able to make setuid files.
+    fchmod(o->outfile, f->mode & 0777);
+    o->left = f->size;
+}
+
+// Closes the file being written, if any, and creates the files after it up to the next one that
+// isn't empty.
+static void solid_next(SolidOutput *o) {
+    if (o->outfile != -1) {
+        close(o->outfile);
+        o->outfile = -1;
+    }
+    while (o->failed == NULL && o->next < o->table->count) {
+        solid_create(o, o->next++);
+        if (o->outfile == -1 || o->left > 0) {
+            return;
+        }
+        close(o->outfile);
+        o->outfile = -1;
+    }
+}
+
+// word tap: writes the symbols to the files they belong to
+static void solid_tap(void *arg, const uint8_t *syms, int n) {
+    SolidOutput *o = (SolidOutput *) arg;
+    while (n > 0 && o->failed == NULL) {
+        if (o->outfile == -1) {
+            o->extra = true;
+            return;
+        }
+        int len = (uint64_t) n < o->left ? n : (int) o->left;
+        write_bytes(o->outfile, (uint8_t *) syms, len);
+        syms += len;
+        n -= len;
+        o->left -= len;
+        if (o->left == 0) {
+            solid_next(o);
+        }
+    }
+}
+
+bool solid_extract_all(Decoder *d, int infile, const SolidTable *t, const char *dir, const Dict *dict) {
+    SolidOutput o = { .table = t, .dir = dir, .next = 0, .outfile = -1, .left = 0, .failed = NULL, .extra = false };
+    solid_next(&o);
+    tap_words(solid_tap, &o);
+    bool ok = decode_stream(d, infile, -1, dict);
+    tap_words(NULL, NULL);
+    bool short_input = o.outfile != -1 || o.next < t->count;
+    if (o.outfile != -1) {
+        close(o.outfile);
+    }
+    if (o.failed != NULL) {
+        snprintf(d->error, sizeof(d->error), "unable to create output file -- '%s'", o.failed);
+        return false;
+    }
+    if (ok && (short_input || o.extra)) {
+        snprintf(d->error, sizeof(d->error), "stream doesn't match the file table");
+        ok = false;
+    }
+    return ok;
+}
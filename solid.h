@@ -0,0 +1,105 @@
+#ifndef __SOLID_H__
+#define __SOLID_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "decoder.h"
+#include "encoder.h"
+
+#define SOLID_MAGIC 0xBAAD5011 // Ends the file table of a solid archive, the last thing in the file.
+
+//
+// A solid archive is the files encoded one after the other as a single stream, sharing one growing
+// dictionary, with FLAG_SOLID in its header. After STOP_CODE, byte aligned, comes its file table,
+// little-endian:
+//
+//   u32 count, then for each file: u64 size, u32 mode, u16 name length, name (no NUL)
+//   u32 count, then for each dictionary reset of the stream: u64 bit, u64 sym (see Reset)
+//   u64 offset of the table in the archive
+//   u32 SOLID_MAGIC
+//
+// A file is extracted on its own by decoding from the last reset before it.
+//
+typedef struct SolidFile {
+    char *name; // Relative, without '..' components.
+    uint64_t size;
+    uint32_t mode;
+    uint64_t start; // Symbols of the stream before the file.
+} SolidFile;
+
+typedef struct SolidTable {
+    SolidFile *files;
+    uint32_t count;
+    uint32_t cap;
+    ResetLog resets;
+} SolidTable;
+
+//
+// Reads the files of a table one after the other into a pipe on a thread of its own, which the
+// encoder reads instead of the input, and sets the size of each to the bytes read from it.
+//
+typedef struct SolidInput {
+    SolidTable *table;
+    int pipe[2];
+    uint8_t *block;
+    const char *failed; // The file that couldn't be read, or NULL.
+    pthread_t thread;
+} SolidInput;
+
+SolidTable *solid_table_create(void);
+
+void solid_table_delete(SolidTable *t);
+
+/*
+ * Adds a file to the end of the table. Returns false if name isn't relative or has a '..' component
+ */
+bool solid_table_add(SolidTable *t, const char *name, uint32_t mode);
+
+/*
+ * Returns the offset of the first pair of a stream with flags, in bytes
+ */
+uint64_t solid_stream_start(uint16_t flags);
+
+/*
+ * Starts reading the files of t. Returns the file descriptor to read them from, or -1 if the thread
+ * can't be started
+ */
+int solid_input_start(SolidInput *in, SolidTable *t);
+
+/*
+ * Waits for the thread reading the files to finish, once all of its output has been read
+ * Returns false if one of them couldn't be read, named by in->failed
+ */
+bool solid_input_finish(SolidInput *in);
+
+/*
+ * Writes the file table of t to outfile, at offset bytes into the archive, right after the stream
+ */
+void solid_write_table(int outfile, const SolidTable *t, uint64_t offset);
+
+/*
+ * Reads the file table from the end of infile, a solid archive whose header was read by decode_header
+ * Returns NULL, with d->error set, if there isn't a valid one
+ */
+SolidTable *solid_read_table(Decoder *d, int infile);
+
+/*
+ * Returns the index of the file called name in t, or -1 if there is none
+ */
+int solid_find(const SolidTable *t, const char *name);
+
+/*
+ * Decodes file k of t to outfile, from the last dictionary reset before it
+ * Returns false, with d->error set, if it can't be decoded
+ */
+bool solid_extract(Decoder *d, int infile, const SolidTable *t, uint32_t k, int outfile, const Dict *dict);
+
+/*
+ * Decodes every file of t into dir, creating the directories of their names
+ * Returns false, with d->error set, if the stream is corrupt or a file can't be created
+ */
+bool solid_extract_all(Decoder *d, int infile, const SolidTable *t, const char *dir, const Dict *dict);
+
+#endif
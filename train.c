@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h> //getopt().
+#include <fcntl.h> // read open
+#include <sys/stat.h>
+
+#include "code.h"
+#include "dict.h"
+#include "io.h"
+#include "trie.h"
+
+#define OPTIONS "o:n:vh"
+
+// what the trainer knows about the phrase with a given code
+typedef struct Phrase {
+    uint64_t uses; // Phrases of the samples that start with this one.
+    uint16_t parent;
+    uint16_t code;
+    uint16_t depth;
+    uint8_t sym;
+} Phrase;
+
+// Most used phrases first. A parent is used at least as often as its children and is shallower, so
+// any prefix of this order is a valid dictionary.
+static int by_uses(const void *a, const void *b) {
+    const Phrase *x = (const Phrase *) a;
+    const Phrase *y = (const Phrase *) b;
+    if (x->uses != y->uses) {
+        return x->uses > y->uses ? -1 : 1;
+    }
+    if (x->depth != y->depth) {
+        return x->depth < y->depth ? -1 : 1;
+    }
+    return (x->code > y->code) - (x->code < y->code);
+}
+
+static int by_code(const void *a, const void *b) {
+    const Phrase *x = (const Phrase *) a;
+    const Phrase *y = (const Phrase *) b;
+    return (x->code > y->code) - (x->code < y->code);
+}
+
+// Parse infile into LZ78 phrases starting from root, counting how often each phrase is used. New
+// phrases are added to the trie until *next_code reaches MAX_CODE.
+static void train(int infile, TrieNode *root, Phrase *phrases, uint16_t *next_code) {
+    TrieNode *curr_node = root;
+    uint8_t curr_sym = 0;
+    while (read_sym(infile, &curr_sym)) {
+        TrieNode *next_node = trie_step(curr_node, curr_sym);
+        if (next_node != NULL) {
+            phrases[next_node->code].uses += 1;
+            curr_node = next_node;
+            continue;
+        }
+        if (*next_code != MAX_CODE) {
+            Phrase *p = &phrases[*next_code];
+            p->uses = 1;
+            p->parent = curr_node->code;
+            p->code = *next_code;
+            p->depth = curr_node == root ? 1 : phrases[curr_node->code].depth + 1;
+            p->sym = curr_sym;
+            curr_node->children[curr_sym] = trie_node_create(*next_code);
+            *next_code += 1;
+        }
+        curr_node = root;
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    int verbose = 0;
+    int outfile_descriptor = STDOUT_FILENO;
+    char *outfile_name = NULL;
+    uint32_t size = 4096;
+
+    const char *help_message
+        = "SYNOPSIS\n"
+          "   Trains a dictionary of common phrases for the LZ78 encoder and decoder.\n"
+          "   The dictionary is used with encode -D and decode -D.\n\n"
+          "USAGE\n"
+          "   ./train [-vh] [-n entries] [-o output] [sample ...]\n\n"
+          "OPTIONS\n"
+          "   -v          Display training statistics\n"
+          "   -n entries  Number of phrases in the dictionary (4096 by default)\n"
+          "   -o output   Specify output of the dictionary (stdout by default)\n"
+          "   -h          Display program help and usage\n"
+          "   sample      Files to train on, each parsed as a separate message (stdin by default)\n";
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'o': outfile_name = optarg; break;
+        case 'n': size = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case 'v': verbose = 1; break;
+        case 'h': printf("%s", help_message); return 1;
+        default:
+            fprintf(stderr, "Usage: %s [-n entries] [-o output] [-v] [-h] [sample ...]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (size == 0 || size > DICT_MAX) {
+        fprintf(stderr, "Error: dictionary size must be between 1 and %d\n", DICT_MAX);
+        exit(1);
+    }
+
+    // Parse every sample on its own, the way encode will parse each message.
+    Phrase *phrases = (Phrase *) calloc(MAX_CODE, sizeof(Phrase));
+    TrieNode *root = trie_create();
+    uint16_t next_code = START_CODE;
+    if (optind == argc) {
+        train(STDIN_FILENO, root, phrases, &next_code);
+    }
+    for (int i = optind; i < argc; i++) {
+        int infile_descriptor = open(argv[i], O_RDONLY);
+        if (infile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to open input file -- '%s'\n", argv[i]);
+            exit(1);
+        }
+        train(infile_descriptor, root, phrases, &next_code);
+        close(infile_descriptor);
+    }
+    trie_delete(root);
+
+    // Keep the most used phrases, then put them back in code order so parents come first.
+    uint32_t count = next_code - START_CODE;
+    Phrase *found = phrases + START_CODE;
+    qsort(found, count, sizeof(Phrase), by_uses);
+    if (count > size) {
+        count = size;
+    }
+    qsort(found, count, sizeof(Phrase), by_code);
+
+    // Renumber the kept phrases from START_CODE and write them out.
+    uint16_t *renumber = (uint16_t *) calloc(MAX_CODE, sizeof(uint16_t));
+    renumber[EMPTY_CODE] = EMPTY_CODE;
+    uint8_t *entries = (uint8_t *) calloc(count, DICT_ENTRY);
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t parent = renumber[found[i].parent];
+        renumber[found[i].code] = (uint16_t) (START_CODE + i);
+        entries[i * DICT_ENTRY] = (uint8_t) parent;
+        entries[i * DICT_ENTRY + 1] = (uint8_t) (parent >> 8);
+        entries[i * DICT_ENTRY + 2] = found[i].sym;
+    }
+
+    DictHeader header;
+    header.magic = DICT_MAGIC;
+    header.id = dict_id(entries, count);
+    header.count = count;
+    if (big_endian()) {
+        header.magic = swap32(header.magic);
+        header.id = swap32(header.id);
+        header.count = swap32(header.count);
+    }
+    if (outfile_name != NULL) {
+        outfile_descriptor = open(outfile_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outfile_descriptor == -1) {
+            fprintf(stderr, "Error: unable to open output file -- '%s'\n", outfile_name);
+            exit(1);
+        }
+    }
+    write_bytes(outfile_descriptor, (uint8_t *) &header, sizeof(header));
+    write_bytes(outfile_descriptor, entries, count * DICT_ENTRY);
+
+    if (verbose) {
+        fprintf(stderr, "Sample size: %lu bytes\n", total_syms);
+        fprintf(stderr, "Dictionary phrases: %u\n", count);
+        fprintf(stderr, "Dictionary ID: %08x\n", dict_id(entries, count));
+    }
+
+    free(entries);
+    free(renumber);
+    free(phrases);
+    close(outfile_descriptor);
+    return 0;
+}
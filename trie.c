@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "trie.h"
 #include "code.h"
 
+_Thread_local uint64_t trie_bytes = 0;
+
 // struct TrieNode {
 //     TrieNode *children[ALPHABET];
 //     uint16_t code;
@@ -20,6 +23,7 @@ TrieNode *trie_node_create(uint16_t index) {
     TrieNode *n = (TrieNode *) malloc(sizeof(TrieNode));
     // if allocated
     if (n) {
+        trie_bytes += sizeof(TrieNode);
         // The node’s code is set to code.
         n->code = index;
         //allocate memo for children arr
@@ -50,6 +54,7 @@ void trie_node_delete(TrieNode *n) {
     // 	n->children[i] = NULL;
     // }
     // // free(n->children);
+    trie_bytes -= sizeof(TrieNode);
     free(n);
 }
 
@@ -121,3 +126,29 @@ TrieNode *trie_step(TrieNode *n, uint8_t sym) {
     }
     return n->children[sym];
 }
+
+/*
+ * Constructor: Creates a jump table for the first two levels of a trie
+ * All entries start out NULL
+ */
+TrieJump *trie_jump_create(void) {
+    return (TrieJump *) calloc(JUMP_SIZE, sizeof(TrieJump));
+}
+
+/*
+ * Resets the jump table: called whenever the trie is reset
+ * Sets all entries back to NULL
+ */
+void trie_jump_reset(TrieJump *jump) {
+    if (jump == NULL) {
+        return;
+    }
+    memset(jump, 0, JUMP_SIZE * sizeof(TrieJump));
+}
+
+/*
+ * Destructor: Frees the jump table, not the nodes it points to
+ */
+void trie_jump_delete(TrieJump *jump) {
+    free(jump);
+}
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #define ALPHABET 256
+#define JUMP_SIZE (ALPHABET * ALPHABET)
 
 typedef struct TrieNode TrieNode;
 
@@ -12,6 +13,12 @@ struct TrieNode {
     uint16_t code;
 };
 
+// Bytes held by the TrieNodes this thread has created and not deleted yet.
+extern _Thread_local uint64_t trie_bytes;
+
+// Entry (a << 8 | b) of a jump table is the node two levels below the root for the symbols a, b.
+typedef TrieNode *TrieJump;
+
 /*
  * Creates a new TrieNode and returns a pointer to it
  * Allocate memory for TrieNode
@@ -53,4 +60,21 @@ void trie_delete(TrieNode *n);
  */
 TrieNode *trie_step(TrieNode *n, uint8_t sym);
 
+/*
+ * Constructor: Creates a jump table for the first two levels of a trie
+ * All entries start out NULL
+ */
+TrieJump *trie_jump_create(void);
+
+/*
+ * Resets the jump table: called whenever the trie is reset
+ * Sets all entries back to NULL
+ */
+void trie_jump_reset(TrieJump *jump);
+
+/*
+ * Destructor: Frees the jump table, not the nodes it points to
+ */
+void trie_jump_delete(TrieJump *jump);
+
 #endif
@@ -0,0 +1,161 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "decoder.h"
+#include "io.h"
+#include "verify.h"
+
+#define INPUT  0
+#define OUTPUT 1
+
+struct Verifier {
+    int pipe[2]; // The stream: written by the encoder, read by the decoder thread.
+    Dict *dict;
+    pthread_t thread;
+
+    // the input, on the encoder's thread
+    uint32_t in_crc; // Of the input since the last whole block.
+    uint64_t in_len;
+
+    // the decoded output, on the decoder thread
+    uint32_t out_crc; // Of the output since the last whole block.
+    uint64_t out_len;
+
+    // The checksums of the blocks that one side has got to and the other hasn't yet, oldest first, and
+    // the first mismatch found.
+    pthread_mutex_t lock;
+    int side; // INPUT or OUTPUT, whichever is ahead.
+    uint32_t *ahead;
+    size_t head;
+    size_t len;
+    size_t cap;
+    uint64_t matched; // Blocks compared.
+    char error[256]; // Room for a decoder error after a prefix.
+};
+
+// Compares the checksum of the next whole block from side with the same block from the other side,
+// or keeps it until the other side gets there.
+static void verify_block(Verifier *v, int side, uint32_t crc) {
+    pthread_mutex_lock(&v->lock);
+    if (v->len == 0 || v->side == side) {
+        if (v->head + v->len == v->cap) {
+            if (v->head > 0) {
+                memmove(v->ahead, v->ahead + v->head, v->len * sizeof(uint32_t));
+                v->head = 0;
+            } else {
+                v->cap = v->cap ? v->cap * 2 : 64;
+                v->ahead = (uint32_t *) realloc(v->ahead, v->cap * sizeof(uint32_t));
+            }
+        }
+        v->ahead[v->head + v->len] = crc;
+        v->len += 1;
+        v->side = side;
+    } else {
+        uint32_t other = v->ahead[v->head];
+        v->head = v->len == 1 ? 0 : v->head + 1;
+        v->len -= 1;
+        if (crc != other && v->error[0] == '\0') {
+            snprintf(v->error, sizeof(v->error), "the stream decodes differently in bytes %lu to %lu of the input",
+                v->matched * VERIFY_BLOCK, (v->matched + 1) * VERIFY_BLOCK);
+        }
+        v->matched += 1;
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+// Checksums the n bytes of buf into *crc, handing over every block completed on the way.
+static void verify_bytes(Verifier *v, int side, uint32_t *crc, uint64_t *len, const uint8_t *buf, int n) {
+    while (n > 0) {
+        int take = VERIFY_BLOCK - (int) (*len % VERIFY_BLOCK);
+        if (take > n) {
+            take = n;
+        }
+        *crc = crc32c(*crc, buf, take);
+        *len += take;
+        buf += take;
+        n -= take;
+        if (*len % VERIFY_BLOCK == 0) {
+            verify_block(v, side, *crc);
+            *crc = 0;
+        }
+    }
+}
+
+// The word tap of the decoder thread.
+static void verify_output(void *arg, const uint8_t *syms, int n) {
+    Verifier *v = (Verifier *) arg;
+    verify_bytes(v, OUTPUT, &v->out_crc, &v->out_len, syms, n);
+}
+
+// The decoder thread: decodes the stream from the pipe, then reads the pipe to the end, so that the
+// encoder never waits on it, whether the stream decoded or not.
+static void *verify_stream(void *arg) {
+    Verifier *v = (Verifier *) arg;
+    Decoder *d = decoder_create();
+    FileHeader header;
+    tap_words(verify_output, v);
+    bool ok = decode_header(d, v->pipe[0], &header, v->dict) && decode_stream(d, v->pipe[0], -1, v->dict);
+    tap_words(NULL, NULL);
+    if (!ok) {
+        pthread_mutex_lock(&v->lock);
+        if (v->error[0] == '\0') {
+            snprintf(v->error, sizeof(v->error), "the stream doesn't decode: %s", d->error);
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    uint8_t buf[BLOCK];
+    while (read_bytes(v->pipe[0], buf, BLOCK) > 0) {
+    }
+    decoder_delete(d);
+    return NULL;
+}
+
+Verifier *verifier_create(const EncodeOptions *opts) {
+    Verifier *v = (Verifier *) calloc(1, sizeof(Verifier));
+    if (v == NULL) {
+        return NULL;
+    }
+    if (pipe(v->pipe) != 0) {
+        free(v);
+        return NULL;
+    }
+    v->dict = opts->dict;
+    pthread_mutex_init(&v->lock, NULL);
+    encode_header(v->pipe[1], opts, 0);
+    pthread_create(&v->thread, NULL, verify_stream, v);
+    return v;
+}
+
+int verifier_pipe(Verifier *v) {
+    return v->pipe[1];
+}
+
+void verify_input(Verifier *v, const uint8_t *syms, int n) {
+    verify_bytes(v, INPUT, &v->in_crc, &v->in_len, syms, n);
+}
+
+bool verifier_finish(Verifier *v, char *error, int size) {
+    close(v->pipe[1]);
+    pthread_join(v->thread, NULL);
+    close(v->pipe[0]);
+
+    // Both sides are done: only the last, partial blocks are left to compare.
+    if (v->error[0] == '\0' && v->out_len != v->in_len) {
+        snprintf(v->error, sizeof(v->error), "the stream decodes to %lu bytes, not %lu", v->out_len, v->in_len);
+    }
+    if (v->error[0] == '\0' && v->out_crc != v->in_crc) {
+        snprintf(v->error, sizeof(v->error), "the stream decodes differently in bytes %lu to %lu of the input",
+            v->in_len - v->in_len % VERIFY_BLOCK, v->in_len);
+    }
+    bool ok = v->error[0] == '\0';
+    snprintf(error, size, "%s", v->error);
+
+    pthread_mutex_destroy(&v->lock);
+    free(v->ahead);
+    free(v);
+    return ok;
+}
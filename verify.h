@@ -0,0 +1,34 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "encoder.h"
+
+#define VERIFY_BLOCK 65536 // Input bytes compared at a time.
+
+//
+// Decodes a stream on a thread of its own while it is being encoded, for encode --verify. The encoder
+// writes the stream to the verifier's pipe as well as its output, and hands it every symbol of the
+// input as it is consumed. The decoded output is compared with the input VERIFY_BLOCK bytes at a time,
+// by their CRC32C, so that only the checksums of the input are kept until the decoder catches up
+// however far ahead of it the encoder gets.
+//
+typedef struct Verifier Verifier;
+
+// Starts a verifier for a stream encoded with opts, writing the header to its pipe. Returns NULL if it
+// can't be started.
+Verifier *verifier_create(const EncodeOptions *opts);
+
+// The write end of the pipe that the verifier decodes from.
+int verifier_pipe(Verifier *v);
+
+// Adds the next n symbols of the input.
+void verify_input(Verifier *v, const uint8_t *syms, int n);
+
+// Waits for the verifier to decode the rest of the stream, once all of it has been written to the
+// pipe, and frees it. Returns false, with a message in error, if the stream doesn't decode to the input.
+bool verifier_finish(Verifier *v, char *error, int size);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "word.h"
 #include "code.h"
@@ -20,7 +21,7 @@ Word *word_create(uint8_t *syms, uint32_t len) {
     // This function returns a Word * if successful or NULL otherwise.
     if (w) {
         // The length of the array of symbols is given by len.
-        w->syms = (uint8_t *) calloc(len + 1, sizeof(uint8_t));
+        w->syms = (uint8_t *) calloc(len + WORD_SLACK, sizeof(uint8_t));
         // copy chars in syms over
         for (uint32_t i = 0; i < len; i++) {
             w->syms[i] = syms[i];
@@ -44,12 +45,11 @@ Word *word_append_sym(Word *w, uint8_t sym) {
     // call word_create
     Word *new_w = (Word *) malloc(sizeof(Word));
     if (new_w) {
-        // The length of the array of symbols is given by len.
-        new_w->syms = (uint8_t *) calloc(new_len, sizeof(uint8_t));
+        // The length of the array of symbols is given by len. The slack is left as it is: it is only
+        // ever copied along with the symbols, never used.
+        new_w->syms = (uint8_t *) malloc(new_len + WORD_SLACK);
         // copy chars in syms over
-        for (uint32_t i = 0; i < w->len; i++) {
-            new_w->syms[i] = w->syms[i];
-        }
+        memcpy(new_w->syms, w->syms, w->len);
         new_w->syms[new_len - 1] = sym;
         new_w->len = new_len;
     }
@@ -92,6 +92,7 @@ void wt_reset(WordTable *wt) {
     // Make sure all the other words in the table are NULL.
     for (int i = START_CODE; i < MAX_CODE; i++) {
         if (wt[i] != NULL) {
+            word_delete(wt[i]);
             wt[i] = NULL;
         }
     }
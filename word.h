@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#define WORD_SLACK 16 // Bytes allocated past the end of a word's symbols, for copies that overrun it.
+
 typedef struct Word {
     uint8_t *syms;
     uint32_t len;
@@ -12,13 +14,13 @@ typedef Word *WordTable;
 
 /*
  * Creates a new Word with symbols syms and length len
- * Allocates new array and copies the symbols over
+ * Allocates new array, with WORD_SLACK bytes to spare, and copies the symbols over
  */
 Word *word_create(uint8_t *syms, uint32_t len);
 
 /*
  * Creates a new word by appending symbol sym to word w
- * Updates the length of the new word and copies symbols over
+ * Updates the length of the new word and copies symbols over, with WORD_SLACK bytes to spare
  * Returns a pointer to the newly allocated word
  */
 Word *word_append_sym(Word *w, uint8_t sym);